@@ -0,0 +1,122 @@
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#include <Windows.h>
+#endif
+
+#include <sys/types.h>
+#include <omp.h>
+
+// Solver
+#include "include/utils.h"
+#include "include/block.h"
+#include "include/defines.h"
+#include "include/solver_stencil.h"
+#include "include/solver_bfecc.h"
+#include "include/interpolator.h"
+#include "include/amr.h"
+
+#if defined(USE_MONOTONE_CUBIC)
+typedef MonotoneCubicInterpolator InterpolatorType;
+#elif defined(USE_TRICUBIC)
+typedef TricubicInterpolator      InterpolatorType;
+#else
+typedef TrilinealInterpolator     InterpolatorType;
+#endif
+
+typedef AdaptiveMesh<BfeccSolver<InterpolatorType>,StencilSolver> MeshType;
+
+int main(int argc, char *argv[]) {
+
+#ifndef _WIN32
+  struct timeval start, end;
+#else
+  int start, end;
+#endif
+  PrecisionType duration = 0.0;
+
+  if(argc < 6) {
+    printf("Usage: %s N steps h patch levels [regrid] [refine coarsen]\n",argv[0]);
+    exit(1);
+  }
+
+  size_t N        = atoi(argv[1]);
+  uint steeps     = atoi(argv[2]);
+  size_t patch    = atoi(argv[4]);
+  size_t levels   = atoi(argv[5]);
+  uint regrid     = argc > 6 ? atoi(argv[6]) : 10;
+  uint frec       = std::max(steeps/10,1u);
+
+  PrecisionType h        = atof(argv[3]);
+  PrecisionType omega    = 1.0f;
+
+  // air
+  PrecisionType ro       = 1.0f;
+  PrecisionType mu       = 1.9e-5;
+  PrecisionType ka       = 1.0e-5f;
+  PrecisionType cc       = 1.0f;
+  PrecisionType cc2      = cc * cc;
+
+  // Same for all the levels, limited by the speed of sound in the finest
+  PrecisionType dx       = h/(PrecisionType)(N << levels);
+  PrecisionType dt       = dx/cc;
+
+  printf("Calculated dt: %f -- finest dx %f\n",dt,dx);
+
+  MeshType mesh(N,patch,levels,h,dt,omega,ro,mu,ka,cc2);
+
+  mesh.SetIndicator(REFINE_VORTICITY);
+
+  if (argc > 8)
+    mesh.SetThresholds(atof(argv[7]),atof(argv[8]));
+
+  mesh.Regrid();
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    printf("-------------------\n");
+    printf("Running with OMP %d\n",omp_get_num_threads());
+    printf("-------------------\n");
+  }
+
+#ifndef _WIN32
+  gettimeofday(&start, NULL);
+#else
+  start = GetTickCount(); // At Program Start
+#endif
+
+  for (uint i = 0; i < steeps; i++) {
+
+    if (regrid && !(i%regrid))
+      mesh.Regrid();
+
+    mesh.Step();
+
+    if (!(i%frec)) {
+      printf(
+        "Step %d: %f -- Seconds: %f, MAXV: %f, Cells: %zu\n",
+        i,
+        dt,
+        dt * i,
+        mesh.GetMaxVelocity(),
+        mesh.GetNumCells());
+      for (size_t l = 0; l <= levels; l++)
+        printf("  Level %zu: %zu patches, %zu leaves\n",l,mesh.GetNumPatches(l),mesh.GetNumLeaves(l));
+    }
+  }
+
+#ifndef _WIN32
+  gettimeofday(&end, NULL);
+  duration = FETCHTIME(start,end)
+#else
+  end = GetTickCount();
+  duration = (end - start) / 1000.0f;
+#endif
+
+  printf("Total time:\t %f s\n",duration);
+  printf("Step  time:\t %f s\n",duration/steeps);
+  printf("Time per sec:\t %f s\n",duration/(steeps*dt));
+
+  return 0;
+}
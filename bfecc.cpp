@@ -15,42 +15,77 @@
 #include "include/solver_bfecc.h"
 #include "include/file_io.h"
 #include "include/interpolator.h"
+#include "include/linear_solver.h"
+#include "include/multigrid.h"
+#include "include/probes.h"
+#include "include/slab_stream.h"
+#include "include/topology.h"
+#include "include/perf_counters.h"
+#include "include/tracers.h"
+#include "include/level_set.h"
+#include "include/field_registry.h"
+
+#if defined(USE_MONOTONE_CUBIC)
+typedef MonotoneCubicInterpolator InterpolatorType;
+#elif defined(USE_TRICUBIC)
+typedef TricubicInterpolator      InterpolatorType;
+#else
+typedef TrilinealInterpolator     InterpolatorType;
+#endif
+
+// Active tiles (-DUSE_ACTIVE_TILES), only used with PRESSURE_EXPLICIT
+const size_t        ACTIVE_TILE_SIZE = 8;
+const PrecisionType ACTIVE_TOLERANCE = 1e-9;
+
+// Damping of the acoustic sub-steps (mode 3). Opt-in stabiliser of the odd-even
+// pressure modes, it adds a pressure diffusion that the explicit mode does not have
+const PrecisionType ACOUSTIC_DAMPING = 0.0f;
+
+// Out-of-core grids (-DUSE_OUT_OF_CORE), slabs mapped around the current one
+const size_t        STREAM_AHEAD     = 4;
+const size_t        STREAM_BEHIND    = 4;
+
+// Tracer particles (-DUSE_TRACERS), Runge-Kutta order and steps between sorts
+const size_t        TRACER_ORDER     = 4;
+const size_t        TRACER_SORT      = 20;
+
+// Narrow band level set (-DUSE_LEVEL_SET), cells at each side and steps between reinitialisations
+const size_t        LEVEL_SET_WIDTH  = 4;
+const size_t        LEVEL_SET_REINIT = 5;
+
+// Solid obstacle (-DUSE_OBSTACLES), radius of the sphere in the centre of the cavity
+const PrecisionType OBSTACLE_RADIUS  = 0.25f;
+
+// Field output, cells between written cells. Only the interior of the velocity
+// and the pressure is written, the ghost cells with -DOUTPUT_GHOSTS and the
+// scratch fields with -DOUTPUT_SCRATCH
+const size_t        OUTPUT_STRIDE    = 1;
 
 #define WRITE_INIT_R(_STEP_)                                                        \
-io.WriteGidMeshBin(dx,N,N,N);                                                       \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_0],N,N,N,0,Dim,"AUX_3D_0");  \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_1],N,N,N,0,Dim,"AUX_3D_1");  \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_2],N,N,N,0,Dim,"velLappl");  \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_3],N,N,N,0,Dim,"accelera");  \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_4],N,N,N,0,Dim,"pressGra");  \
-io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_5],N,N,N,0    ,"VelDiver");  \
-io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_6],N,N,N,0    ,"PresDiff");  \
-io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_7],N,N,N,0    ,"PresLapp");  \
-io.WriteGidResultsBin3D((PrecisionType*)buffers[VELOCITY],N,N,N,0,Dim,"velocity");  \
-io.WriteGidResultsBin1D((PrecisionType*)buffers[PRESSURE],N,N,N,0    ,"pressure");  \
+io.WriteGidMeshBin(dx,N,N,N,outputRegion);                                          \
+io.WriteResults(N,N,N,0);                                                           \
 
 #define WRITE_RESULT(_STEP_)                                                            \
 if (!(i%frec)) {                                                                        \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_0],N,N,N,i+1,Dim,"AUX_3D_0");  \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_1],N,N,N,i+1,Dim,"AUX_3D_1");  \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_2],N,N,N,i+1,Dim,"velLappl");  \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_3],N,N,N,i+1,Dim,"accelera");  \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[AUX_3D_4],N,N,N,i+1,Dim,"pressGra");  \
-  io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_5],N,N,N,i+1    ,"VelDiver");  \
-  io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_6],N,N,N,i+1    ,"PresDiff");  \
-  io.WriteGidResultsBin1D((PrecisionType*)buffers[AUX_3D_7],N,N,N,i+1    ,"PresLapp");  \
-  io.WriteGidResultsBin3D((PrecisionType*)buffers[VELOCITY],N,N,N,i+1,Dim,"velocity");  \
-  io.WriteGidResultsBin1D((PrecisionType*)buffers[PRESSURE],N,N,N,i+1    ,"pressure");  \
+  io.WriteResults(N,N,N,i+1);                                                           \
   OutputStep = _STEP_;                                                                  \
 }                                                                                       \
 OutputStep--;                                                                           \
 
+// Treatment of the pressure (optional 5th argument)
+enum PressureMode {
+  PRESSURE_EXPLICIT   = 0,    // Weakly compressible, dt limited by the speed of sound
+  PRESSURE_PROJECTION = 1,    // Incompressible projection, dt limited by the flow CFL
+  PRESSURE_MULTIGRID  = 2,    // Same as PRESSURE_PROJECTION, solved with multigrid
+  PRESSURE_SUBCYCLE   = 3     // Weakly compressible, acoustics sub-cycled with pdt
+};
+
 PrecisionType calculateMaxDt_CFL(PrecisionType CFL, PrecisionType h, PrecisionType maxv) {
   return CFL*h / maxv;
 }
 
-PrecisionType calculateMaxDt_Fourier() {
-  return 0.0;
+PrecisionType calculateMaxDt_Fourier(PrecisionType h, PrecisionType mu, PrecisionType ro) {
+  return h*h*ro / (6.0f*mu);
 }
 
 PrecisionType calculatePressDt(PrecisionType dt, PrecisionType limit) {
@@ -74,6 +109,12 @@ int main(int argc, char *argv[]) {
   uint OutputStep = 0;
   size_t Dim      = 3;
   uint frec       = steeps/10;
+  uint mode       = argc > 5 ? atoi(argv[5]) : PRESSURE_EXPLICIT;
+
+  if (mode > PRESSURE_SUBCYCLE) {
+    printf("Error: Unknown pressure mode %u.\n",mode);
+    exit(1);
+  }
 
   PrecisionType h        = atof(argv[3]);
   PrecisionType omega    = 1.0f;
@@ -102,6 +143,16 @@ int main(int argc, char *argv[]) {
 
   Block         * block = NULL;
 
+#ifdef USE_THREAD_PINNING
+  Topology topology;
+
+  topology.Pin();
+
+  #pragma omp parallel
+  #pragma omp single
+  topology.Print(omp_get_num_threads());
+#endif
+
   int               NumBuffers = 20;
   PrecisionType **  buffers;
 
@@ -111,6 +162,50 @@ int main(int argc, char *argv[]) {
 
   MemManager memmrg(false);
 
+#ifdef USE_OUT_OF_CORE
+  // Scratch directory of the grids (optional 6th argument)
+  SlabStream stream(argc > 6 ? argv[6] : ".",STREAM_AHEAD,STREAM_BEHIND);
+
+  for( size_t i = 0; i < MAX_BUFF; i++) {
+    stream.AllocateGrid(&buffers[i], N, N, N, 3);
+  }
+
+  stream.AllocateGrid(&flags, N, N, N, 1);
+
+  printf("Out-of-core grids: %zu MB\n",stream.GetBytes() >> 20);
+#elif defined(USE_FIELD_REGISTRY)
+  // Variable, each one with its own components
+  FieldRegistry registry(N,N,N);
+
+  registry.Register(VELOCITY,"velocity",Dim,LIFETIME_PERSISTENT);
+  registry.Register(PRESSURE,"pressure",1  ,LIFETIME_PERSISTENT);
+  registry.Register(AUX_3D_0,"AUX_3D_0",Dim,LIFETIME_PERSISTENT);
+  registry.Register(AUX_3D_1,"AUX_3D_1",Dim,PhaseRange(STEP_ADVECTION,STEP_VELOCITY));
+  registry.Register(AUX_3D_2,"velLappl",Dim,PhaseRange(STEP_VELOCITY,STEP_VELOCITY));
+  registry.Register(AUX_3D_3,"accelera",Dim,PhaseRange(STEP_ADVECTION,STEP_VELOCITY));
+  registry.Register(AUX_3D_4,"pressGra",Dim,PhaseRange(STEP_VELOCITY,STEP_VELOCITY));
+  registry.Register(AUX_3D_5,"VelDiver",1  ,PhaseRange(STEP_DIVERGENCE,STEP_PRESSURE));
+  registry.Register(AUX_3D_6,"PresDiff",1  ,PhaseRange(STEP_DIVERGENCE,STEP_PRESSURE));
+  registry.Register(AUX_3D_7,"PresLapp",1  ,PhaseRange(STEP_PRESSURE,STEP_PRESSURE));
+
+  // AUX_3D_0 holds the sphere set by InitializeVelocity until the output,
+  // so it keeps its own storage. The lifetimes are those of the explicit
+  // task path. The other paths, the obstacles and the active tiles keep
+  // values of the scratch fields across phases, and the output of the
+  // scratch fields writes them at the end of the step.
+  bool aliasScratch = mode == PRESSURE_EXPLICIT;
+#if defined(USE_ACTIVE_TILES) || defined(USE_OBSTACLES) || (defined(OUTPUT_SCRATCH) && !defined(NO_FIELD_OUTPUT))
+  aliasScratch = false;
+#endif
+
+  registry.Allocate(buffers,aliasScratch);
+  registry.Report();
+
+  // Flags
+  memmrg.AllocateGrid(&flags, N, N, N, 1, 1);
+
+  FirstTouch(flags, N, N, N, 1);
+#else
   // Variable
   for( size_t i = 0; i < MAX_BUFF; i++) {
     memmrg.AllocateGrid(&buffers[i], N, N, N, 3, 1);
@@ -119,6 +214,13 @@ int main(int argc, char *argv[]) {
   // Flags
   memmrg.AllocateGrid(&flags, N, N, N, 1, 1);
 
+  for( size_t i = 0; i < MAX_BUFF; i++) {
+    FirstTouch(buffers[i], N, N, N, 3);
+  }
+
+  FirstTouch(flags, N, N, N, 1);
+#endif
+
   for(uint i = 0; i < N+BW; i++)
     for(uint j = 0; j < N+BW; j++)
       for(uint k = 0; k < N+BW; k++)
@@ -170,6 +272,25 @@ int main(int argc, char *argv[]) {
   printf("InitializeVelocity\n");
   block->InitializePressure();
   printf("InitializePressure\n");
+#ifdef USE_ACTIVE_TILES
+  bool useActive = mode == PRESSURE_EXPLICIT;
+  block->InitializeActiveTiles(ACTIVE_TILE_SIZE,ACTIVE_TOLERANCE);
+  printf("InitializeActiveTiles\n");
+#else
+  bool useActive = false;
+#endif
+#ifdef USE_OBSTACLES
+  // Runs of fluid cells are only used by the explicit task path
+  if (mode != PRESSURE_EXPLICIT || useActive) {
+    printf("Error: Obstacles are only supported with the explicit pressure and without active tiles.\n");
+    exit(1);
+  }
+
+  PrecisionType obstacleCenter[3] = {h/2, h/2, h/2};
+
+  block->AddSolidSphere(obstacleCenter,OBSTACLE_RADIUS*h);
+  printf("AddSolidSphere\n");
+#endif
   // block->WriteHeatFocus();
   printf("WriteHeatFocus\n");
 
@@ -185,10 +306,99 @@ int main(int argc, char *argv[]) {
     (PrecisionType)h/(PrecisionType)N,
     maxv);
 
-  Solver<BfeccSolver>   AdvectionSolver(block,dt,pdt);
-  Solver<StencilSolver> DiffusionSolver(block,dt,pdt);
+  BfeccSolver<InterpolatorType> AdvectionSolver(block,dt,pdt);
+  StencilSolver                 DiffusionSolver(block,dt,pdt);
+
+  DiffusionSolver.SetAcousticDamping(ACOUSTIC_DAMPING);
+
+#ifdef USE_OBSTACLES
+  printf("Obstacles: %zu solid cells, %zu on the faces\n",block->mNumSolid,block->mNumSolidFaces);
+#endif
+
+#ifdef USE_OUT_OF_CORE
+  AdvectionSolver.SetStream(&stream);
+  DiffusionSolver.SetStream(&stream);
+#endif
+
+#ifdef USE_PERF_COUNTERS
+  PerfCounters counters;
+
+  AdvectionSolver.SetCounters(&counters);
+  DiffusionSolver.SetCounters(&counters);
+#endif
+
+  // Only the projection modes solve a linear system for the pressure
+  LinearSolver                * PressureSolver = NULL;
+
+  if (mode == PRESSURE_MULTIGRID) {
+    PressureSolver = new MultigridSolver(block);
+  } else if (mode == PRESSURE_PROJECTION) {
+    PressureSolver = new ConjugateGradientSolver(block);
+  }
+
+  DiffusionSolver.SetLinearSolver(PressureSolver);
+
+  // Centreline profile of the cavity, sampled at the output frequency
+  ProbeSet<InterpolatorType> probes(block,"grid",frec);
+
+  PrecisionType lineFrom[3] = {h/2, h/2, 0.0f};
+  PrecisionType lineTo[3]   = {h/2, h/2, h   };
+
+  probes.AddField(VELOCITY,Dim,"velocity");
+  probes.AddField(PRESSURE,1  ,"pressure");
+  probes.AddLine("centreline",lineFrom,lineTo,N+1);
+
+#ifdef USE_TRACERS
+  // One tracer at the centre of every interior cell, written at the output
+  // frequency
+  TracerParticles tracers(block,"grid",frec,TRACER_SORT);
+
+  PrecisionType tracerLow  = dx * (BWP - 0.5f);
+  PrecisionType tracerHigh = dx * (N + BWP - 0.5f);
+
+  PrecisionType tracerFrom[3] = {tracerLow , tracerLow , tracerLow };
+  PrecisionType tracerTo[3]   = {tracerHigh, tracerHigh, tracerHigh};
+  size_t        tracerSide[3] = {N , N , N };
+
+  tracers.AddLattice(tracerFrom,tracerTo,tracerSide);
+
+  printf("Tracers: %zu particles\n",tracers.GetNumParticles());
+#endif
+
+#ifdef USE_LEVEL_SET
+  // Sphere next to the lid
+  NarrowBandLevelSet levelSet(block,LEVEL_SET_WIDTH,LEVEL_SET_REINIT);
+
+  PrecisionType sphereCenter[3] = {h/2, h/2, h/4};
+
+  levelSet.SetSphere(sphereCenter,0.15f*h);
+  levelSet.Initialize();
+
+  printf("Level set: %zu band cells, %zu interface cells\n",levelSet.GetBandSize(),levelSet.GetInterfaceSize());
+#endif
+
+#ifndef NO_FIELD_OUTPUT
+#ifdef OUTPUT_GHOSTS
+  OutputRegion outputRegion = FileIO::PaddedRegion(N,N,N,OUTPUT_STRIDE);
+#else
+  OutputRegion outputRegion = FileIO::InteriorRegion(N,N,N,OUTPUT_STRIDE);
+#endif
+
+#ifdef OUTPUT_SCRATCH
+  io.AddResult(buffers[AUX_3D_0],Dim,"AUX_3D_0",outputRegion);
+  io.AddResult(buffers[AUX_3D_1],Dim,"AUX_3D_1",outputRegion);
+  io.AddResult(buffers[AUX_3D_2],Dim,"velLappl",outputRegion);
+  io.AddResult(buffers[AUX_3D_3],Dim,"accelera",outputRegion);
+  io.AddResult(buffers[AUX_3D_4],Dim,"pressGra",outputRegion);
+  io.AddResult(buffers[AUX_3D_5],1  ,"VelDiver",outputRegion);
+  io.AddResult(buffers[AUX_3D_6],1  ,"PresDiff",outputRegion);
+  io.AddResult(buffers[AUX_3D_7],1  ,"PresLapp",outputRegion);
+#endif
+  io.AddResult(buffers[VELOCITY],Dim,"velocity",outputRegion);
+  io.AddResult(buffers[PRESSURE],1  ,"pressure",outputRegion);
 
   WRITE_INIT_R(frec)
+#endif
 
   #pragma omp parallel
   #pragma omp single
@@ -206,6 +416,9 @@ int main(int argc, char *argv[]) {
 
   AdvectionSolver.Prepare();
 
+  // Simulated time, accumulated since dt changes every step
+  double simTime = 0.0;
+
   for (uint i = 0; i < steeps; i++) {
 
     double intergale;
@@ -219,6 +432,15 @@ int main(int argc, char *argv[]) {
     dt = 1.0f * std::min((h/N)/cc,(h/N)/maxv);
     // dt = calculateMaxDt_CFL(CFL,dx,maxv);
 
+    if (mode != PRESSURE_EXPLICIT) {
+      dt = std::min(
+        calculateMaxDt_CFL(CFL,dx,std::max((PrecisionType)intergale,(PrecisionType)1e-6f)),
+        calculateMaxDt_Fourier(dx,mu,ro));
+    }
+
+    if (mode == PRESSURE_SUBCYCLE) {
+      pdt = calculatePressDt(dt,calculateMaxDt_CFL(CFL,dx,cc));
+    }
 
     if (!(i%10000))
       printf("Step: %d\n",i);
@@ -228,20 +450,90 @@ int main(int argc, char *argv[]) {
       "Step %d: %f -- Seconds: %f, %f, MAXV: %f, [%f,%f] \n",
       i,
       dt,
-      dt * i,
+      simTime,
       (PrecisionType)h/(PrecisionType)N,
       intergale,
       (1.0f/64.0f)/dt,
       (maxv-oldmaxv));
 
-    AdvectionSolver.Execute();
-    DiffusionSolver.ExecuteTask();
+#if defined(USE_FIELD_REGISTRY) && !defined(USE_OUT_OF_CORE)
+    registry.Begin(STEP_ADVECTION);
+#endif
+
+    // The advection reuses the maximum velocity of the step
+    AdvectionSolver.SetMaxVelocity(maxv);
+
+    if (useActive) {
+      PrecisionType activeMaxv;
+      block->UpdateActiveTiles(dt,activeMaxv);
+      if (!(i%frec))
+        printf("Active tiles: %zu of %zu\n",
+          block->mNumActive,
+          block->mNumTiles[0] * block->mNumTiles[1] * block->mNumTiles[2]);
+      AdvectionSolver.ExecuteActive();
+    } else {
+      AdvectionSolver.Execute();
+    }
+
+    if (mode == PRESSURE_SUBCYCLE) {
+      DiffusionSolver.ExecuteSubcycle();
+      if (!(i%frec))
+        printf("Acoustic sub-steps: %zu, pdt %f\n",
+          DiffusionSolver.GetSubsteps(),
+          pdt);
+    } else if (mode != PRESSURE_EXPLICIT) {
+      DiffusionSolver.ExecuteProjection();
+      if (!(i%frec))
+        printf("Pressure solver: %zu iterations, residual %e\n",
+          PressureSolver->GetIterations(),
+          PressureSolver->GetResidual());
+    } else if (useActive) {
+      DiffusionSolver.ExecuteActive();
+    } else {
+#if defined(USE_FIELD_REGISTRY) && !defined(USE_OUT_OF_CORE)
+      registry.Begin(STEP_VELOCITY);
+      DiffusionSolver.ExecuteTaskVelocity();
+      registry.Begin(STEP_DIVERGENCE);
+      DiffusionSolver.ExecuteTaskDivergence();
+      registry.Begin(STEP_PRESSURE);
+      DiffusionSolver.ExecuteTaskPressure();
+#else
+      DiffusionSolver.ExecuteTask();
+#endif
+    }
+
+    simTime += dt;
+
+    probes.Sample(i+1,simTime);
+
+#ifdef USE_TRACERS
+    tracers.Advance(dt,TRACER_ORDER);
+    tracers.Write(i+1,simTime);
+#endif
+
+#ifdef USE_LEVEL_SET
+    levelSet.Advect(AdvectionSolver);
+    if (!(i%frec))
+      printf("Level set: %zu band cells, %zu interface cells\n",levelSet.GetBandSize(),levelSet.GetInterfaceSize());
+#endif
 
+#ifdef USE_PERF_COUNTERS
+    if (!(i%frec)) {
+      char title[64];
+      sprintf(title,"steps %d to %d",std::max((int)i-(int)frec+1,0),i);
+      counters.Report(title,false);
+    }
+#endif
+
+#ifndef NO_FIELD_OUTPUT
     WRITE_RESULT(frec)
+#endif
   }
 
   AdvectionSolver.Finish();
 
+  delete PressureSolver;
+
 #ifndef _WIN32
   gettimeofday(&end, NULL);
   duration = FETCHTIME(start,end)
@@ -249,33 +541,29 @@ int main(int argc, char *argv[]) {
   end = GetTickCount();
   duration = (end - start) / 1000.0f;
 #endif
-/*
-  PrecisionType values_to_print[17] = {
-    1.000,0.977,0.969,0.961,0.953,0.852,0.734,0.617,
-    0.500,0.453,0.281,0.172,0.102,0.070,0.063,0.055,0.000
-  };
-
-  for(size_t i = 0; i < 17; i++) {
-
-    PrecisionType values[3] = {0.0f, 0.0f, 0.0f};
-    PrecisionType coords[3] = {h/2, h/2, values_to_print[i]};
-
-    PrecisionType * velocity = buffers[VELOCITY];
-
-    TrilinealInterpolator::Interpolate(block,velocity,values,coords,3);
-
-    printf("%f\t%f\n",values_to_print[i],values[0]);
-  }
-*/
   printf("Total time:\t %f s\n",duration);
   printf("Step  time:\t %f s\n",duration/steeps);
   printf("Time per sec:\t %f s\n",duration/(steeps*dt));
 
+#ifdef USE_PERF_COUNTERS
+  counters.ReportTotal(true);
+#endif
+
   free(block);
 
+#ifdef USE_OUT_OF_CORE
+  for( size_t i = 0; i < MAX_BUFF; i++) {
+    stream.ReleaseGrid(&buffers[i]);
+  }
+
+  stream.ReleaseGrid(&flags);
+#elif defined(USE_FIELD_REGISTRY)
+  // Buffers are released by the registry
+#else
   for( size_t i = 0; i < MAX_BUFF; i++) {
     memmrg.ReleaseGrid(&buffers[i], 1);
   }
+#endif
 
   printf("De-Allocation correct\n");
 
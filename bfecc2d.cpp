@@ -0,0 +1,163 @@
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#include <Windows.h>
+#endif
+
+#include <sys/types.h>
+#include <omp.h>
+
+// Solver
+#include "include/utils.h"
+#include "include/defines.h"
+#include "include/block_2d.h"
+#include "include/interpolator.h"
+#include "include/solver_stencil_2d.h"
+#include "include/solver_bfecc_2d.h"
+
+int main(int argc, char *argv[]) {
+
+#ifndef _WIN32
+  struct timeval start, end;
+#else
+  int start, end;
+#endif
+  PrecisionType duration = 0.0;
+
+  if(argc < 4) {
+    printf("Usage: %s N steps h\n",argv[0]);
+    exit(1);
+  }
+
+  size_t N        = atoi(argv[1]);
+  uint steeps     = atoi(argv[2]);
+  uint frec       = std::max(steeps/10,1u);
+  size_t Dim      = 2;
+
+  PrecisionType h        = atof(argv[3]);
+  PrecisionType maxv     = 0.0f;
+
+  PrecisionType dx       = h/(PrecisionType)N;
+  PrecisionType dt       = 0.1f;
+  PrecisionType pdt      = 0.1f;
+
+  // air
+  PrecisionType ro       = 1.0f;
+  PrecisionType mu       = 1.9e-5;
+  PrecisionType ka       = 1.0e-5f;
+  PrecisionType cc       = 1.0f;
+  PrecisionType cc2      = cc * cc;
+
+  PrecisionType **  buffers;
+
+  buffers = (PrecisionType **)malloc(sizeof(PrecisionType * ) * MAX_BUFF);
+
+  uint          * flags = NULL;
+
+  MemManager memmrg(false);
+
+  // Variable, all with the components of the velocity
+  for( size_t i = 0; i < MAX_BUFF; i++) {
+    memmrg.AllocateGrid2D(&buffers[i], N, N, Dim, 1);
+  }
+
+  // Flags
+  memmrg.AllocateGrid2D(&flags, N, N, 1, 1);
+
+  printf("Allocation correct\n");
+  printf("Initialize\n");
+
+  Block2D * block = new Block2D(
+    (PrecisionType**) buffers, (uint*) flags,
+    dx, ro, mu, ka, cc2, BW,
+    N, N
+  );
+
+  block->Zero();
+  printf("Zero\n");
+  block->InitializeWalls();
+  printf("InitializeWalls\n");
+  block->InitializeVelocity();
+  printf("InitializeVelocity\n");
+  block->InitializePressure();
+  printf("InitializePressure\n");
+
+  block->calculateMaxVelocity(maxv);
+  dt = 1.0f * std::min((h/N)/cc,(h/N)/maxv);
+
+  printf(
+    "Calculated dt: %f -- %f, %f \n",
+    dt,
+    (PrecisionType)h/(PrecisionType)N,
+    maxv);
+
+  BfeccSolver2D<> AdvectionSolver(block,dt,pdt);
+  StencilSolver2D DiffusionSolver(block,dt,pdt);
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    printf("-------------------\n");
+    printf("Running with OMP %d\n",omp_get_num_threads());
+    printf("-------------------\n");
+  }
+
+#ifndef _WIN32
+  gettimeofday(&start, NULL);
+#else
+  start = GetTickCount(); // At Program Start
+#endif
+
+  AdvectionSolver.Prepare();
+
+  // Simulated time, accumulated since dt changes every step
+  double simTime = 0.0;
+
+  for (uint i = 0; i < steeps; i++) {
+
+    block->calculateMaxVelocity(maxv);
+    dt = 1.0f * std::min((h/N)/cc,(h/N)/maxv);
+
+    if (!(i%frec))
+      printf(
+        "Step %d: %f -- Seconds: %f, %f, MAXV: %f\n",
+        i,
+        dt,
+        simTime,
+        (PrecisionType)h/(PrecisionType)N,
+        maxv);
+
+    AdvectionSolver.SetMaxVelocity(maxv);
+    AdvectionSolver.Execute();
+    DiffusionSolver.ExecuteTask();
+
+    simTime += dt;
+  }
+
+  AdvectionSolver.Finish();
+
+#ifndef _WIN32
+  gettimeofday(&end, NULL);
+  duration = FETCHTIME(start,end)
+#else
+  end = GetTickCount();
+  duration = (end - start) / 1000.0f;
+#endif
+  printf("Total time:\t %f s\n",duration);
+  printf("Step  time:\t %f s\n",duration/steeps);
+  printf("Time per sec:\t %f s\n",duration/(steeps*dt));
+
+  delete block;
+
+  for( size_t i = 0; i < MAX_BUFF; i++) {
+    memmrg.ReleaseGrid(&buffers[i], 1);
+  }
+
+  memmrg.ReleaseGrid(&flags, 1);
+
+  free(buffers);
+
+  printf("De-Allocation correct\n");
+
+  return 0;
+}
@@ -0,0 +1,292 @@
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#include <Windows.h>
+#endif
+
+#include <vector>
+
+#include <sys/types.h>
+#include <omp.h>
+
+// Solver
+#include "include/utils.h"
+#include "include/block.h"
+#include "include/defines.h"
+#include "include/solver_stencil.h"
+#include "include/solver_bfecc.h"
+#include "include/interpolator.h"
+
+#if defined(USE_MONOTONE_CUBIC)
+typedef MonotoneCubicInterpolator InterpolatorType;
+#elif defined(USE_TRICUBIC)
+typedef TricubicInterpolator      InterpolatorType;
+#else
+typedef TrilinealInterpolator     InterpolatorType;
+#endif
+
+/**
+ * Member of the ensemble. Block keeps references to the properties and the
+ * solvers to the time step, so they live here.
+ **/
+struct Member {
+  size_t Id;
+
+  PrecisionType Ro;
+  PrecisionType Mu;
+  PrecisionType Ka;
+  PrecisionType CC;
+  PrecisionType CC2;
+  PrecisionType Lid;
+
+  PrecisionType Dt;
+  PrecisionType Pdt;
+  PrecisionType Maxv;
+
+  // Simulated time, accumulated since the dt changes every step
+  double Time;
+
+  PrecisionType * Buffers[MAX_BUFF];
+
+  Block * block;
+  BfeccSolver<InterpolatorType> * advection;
+  StencilSolver * diffusion;
+
+  double Duration;
+};
+
+/**
+ * Reads the sweep file: one member per line with "mu ka cc lid". Empty
+ * lines and lines starting with '#' are skipped.
+ **/
+void readSweep(const char * fileName, std::vector<Member> &members) {
+
+  FILE * file = fopen(fileName,"r");
+
+  if(file == NULL) {
+    printf("Error: Unable to open the sweep file \"%s\".\n",fileName);
+    exit(1);
+  }
+
+  char line[1024];
+  size_t lineNumber = 0;
+
+  while(fgets(line,sizeof(line),file) != NULL) {
+    lineNumber++;
+
+    char * c = line;
+    while(*c == ' ' || *c == '\t') c++;
+
+    if(*c == '#' || *c == '\n' || *c == '\r' || *c == '\0') {
+      continue;
+    }
+
+    double mu, ka, cc, lid;
+
+    if(sscanf(c,"%lf %lf %lf %lf",&mu,&ka,&cc,&lid) != 4) {
+      printf("Error: Line %zu of \"%s\" must be \"mu ka cc lid\".\n",lineNumber,fileName);
+      exit(1);
+    }
+
+    Member member;
+
+    member.Id  = members.size();
+    member.Ro  = 1.0f;
+    member.Mu  = mu;
+    member.Ka  = ka;
+    member.CC  = cc;
+    member.CC2 = cc * cc;
+    member.Lid = lid;
+
+    members.push_back(member);
+  }
+
+  fclose(file);
+}
+
+PrecisionType calculateMaxDt(PrecisionType h, PrecisionType cc, PrecisionType maxv) {
+  return std::min(h/cc,h/maxv);
+}
+
+int main(int argc, char *argv[]) {
+
+#ifndef _WIN32
+  struct timeval start, end;
+#else
+  int start, end;
+#endif
+  PrecisionType duration = 0.0;
+
+  if(argc < 5) {
+    printf("Usage: %s N steps h sweep [output.csv]\n",argv[0]);
+    exit(1);
+  }
+
+  size_t N        = atoi(argv[1]);
+  uint steeps     = atoi(argv[2]);
+  size_t NB       = 1;
+  size_t NE       = (N+BW)/NB;
+  size_t Dim      = 3;
+  uint frec       = std::max(steeps/10,1u);
+
+  PrecisionType h        = atof(argv[3]);
+  PrecisionType omega    = 1.0f;
+  PrecisionType dx       = h/(PrecisionType)N;
+
+  const char * output    = argc > 5 ? argv[5] : "ensemble.csv";
+
+  std::vector<Member> members;
+
+  readSweep(argv[4],members);
+
+  if(members.empty()) {
+    printf("Error: The sweep file has no members.\n");
+    exit(1);
+  }
+
+  MemManager memmrg(false);
+
+  // Flags are the same for all the members
+  uint * flags = NULL;
+
+  memmrg.AllocateGrid(&flags, N, N, N, 1, 1);
+
+  for(uint i = 0; i < N+BW; i++)
+    for(uint j = 0; j < N+BW; j++)
+      for(uint k = 0; k < N+BW; k++)
+        flags[k*(N+BW)*(N+BW)+j*(N+BW)+i] = 0;
+
+  for(uint a = BWP; a < N+BWP; a++) {
+    for(uint b = BWP; b < N+BWP; b++) {
+      uint fixed = FIXED_VELOCITY_X | FIXED_VELOCITY_Y | FIXED_VELOCITY_Z;
+
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+1] |= fixed;
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+N] |= fixed;
+      flags[a*(N+BW)*(N+BW)+1*(N+BW)+b] |= fixed;
+      flags[a*(N+BW)*(N+BW)+N*(N+BW)+b] |= fixed;
+      flags[1*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+      flags[N*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+    }
+  }
+
+  FILE * csv = fopen(output,"w");
+
+  if(csv == NULL) {
+    printf("Error: Unable to open the output file \"%s\".\n",output);
+    exit(1);
+  }
+
+  fprintf(csv,"member,mu,ka,cc,lid,step,time,maxv\n");
+
+  // Each member runs in a single thread: the parallel regions of the
+  // solvers are nested inside the ensemble loop and run serially.
+  omp_set_max_active_levels(1);
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    printf("-------------------\n");
+    printf("Running %zu members with OMP %d\n",members.size(),omp_get_num_threads());
+    printf("-------------------\n");
+  }
+
+#ifndef _WIN32
+  gettimeofday(&start, NULL);
+#else
+  start = GetTickCount(); // At Program Start
+#endif
+
+  #pragma omp parallel for schedule(dynamic)
+  for(size_t m = 0; m < members.size(); m++) {
+
+    Member &member = members[m];
+
+    double memberStart = omp_get_wtime();
+
+    // First touch of the buffers by the thread that runs the member
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      memmrg.AllocateGrid(&member.Buffers[b], N, N, N, 3, 1);
+      for(size_t c = 0; c < (N+BW)*(N+BW)*(N+BW)*3; c++) {
+        member.Buffers[b][c] = 0.0f;
+      }
+    }
+
+    member.block = new Block(
+      member.Buffers, flags,
+      dx, omega, member.Ro, member.Mu, member.Ka, member.CC2, BW,
+      N, N, N, NB, NE, Dim
+    );
+
+    member.block->InitializeVelocity(member.Lid);
+    member.block->InitializePressure();
+
+    member.block->calculateMaxVelocity(member.Maxv);
+
+    member.Dt  = calculateMaxDt(dx,member.CC,member.Maxv);
+    member.Pdt = member.Dt;
+
+    member.Time = 0.0;
+
+    member.advection = new BfeccSolver<InterpolatorType>(member.block,member.Dt,member.Pdt);
+    member.diffusion = new StencilSolver(member.block,member.Dt,member.Pdt);
+
+    member.advection->Prepare();
+
+    for(uint i = 0; i < steeps; i++) {
+
+      member.block->calculateMaxVelocity(member.Maxv);
+      member.Dt = calculateMaxDt(dx,member.CC,member.Maxv);
+
+      member.advection->SetMaxVelocity(member.Maxv);
+      member.advection->Execute();
+      member.diffusion->ExecuteTask();
+
+      member.Time += member.Dt;
+
+      if (!((i+1)%frec) || i+1 == steeps) {
+        PrecisionType maxv;
+        member.block->calculateRealMaxVelocity(maxv);
+
+        #pragma omp critical
+        fprintf(csv,"%zu,%e,%e,%e,%e,%u,%e,%e\n",
+          member.Id, member.Mu, member.Ka, member.CC, member.Lid,
+          i+1, member.Time, maxv);
+      }
+    }
+
+    member.advection->Finish();
+
+    delete member.advection;
+    delete member.diffusion;
+    delete member.block;
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      memmrg.ReleaseGrid(&member.Buffers[b], 1);
+    }
+
+    member.Duration = omp_get_wtime() - memberStart;
+  }
+
+#ifndef _WIN32
+  gettimeofday(&end, NULL);
+  duration = FETCHTIME(start,end)
+#else
+  end = GetTickCount();
+  duration = (end - start) / 1000.0f;
+#endif
+
+  fclose(csv);
+
+  for(size_t m = 0; m < members.size(); m++) {
+    printf("Member %zu: mu %e, ka %e, cc %e, lid %e -- %f s\n",
+      members[m].Id, members[m].Mu, members[m].Ka, members[m].CC, members[m].Lid,
+      members[m].Duration);
+  }
+
+  printf("Total time:\t %f s\n",duration);
+  printf("Runs per hour:\t %f\n",members.size() * 3600.0f / duration);
+
+  memmrg.ReleaseGrid(&flags, 1);
+
+  return 0;
+}
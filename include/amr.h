@@ -0,0 +1,969 @@
+#ifndef AMR_H
+#define AMR_H
+
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "defines.h"
+#include "utils.h"
+#include "block.h"
+
+// Indicator used to refine and coarsen the patches of an AdaptiveMesh
+enum RefineIndicator {
+  REFINE_GRADIENT,        // Largest velocity difference across a cell
+  REFINE_VORTICITY        // Magnitude of the vorticity times the size of the cell
+};
+
+/**
+ * Block-structured adaptive mesh.
+ *
+ * The domain is covered by an octree of patches of PatchSize^3 cells, each
+ * one with its own Block and solvers. The patch of level l at (px,py,pz)
+ * covers the cells [p*PatchSize,(p+1)*PatchSize) of the grid of level l,
+ * which has RootCells*2^l cells per side. Patches of a level are kept in a
+ * map keyed by the Morton code of (px,py,pz), so the children of a patch
+ * are (key<<3)|c and its parent is key>>3.
+ *
+ * Only leaf patches are advanced. Refined patches hold the restriction of
+ * their children, so the ghost cells of a patch are copied from the patch
+ * of the same level that covers them or, if there is none, interpolated
+ * (trilinear) from the coarser levels. Ghost cells on the border of the
+ * domain are left to the solvers, as in a single Block.
+ *
+ * All the levels advance with the same dt, limited by the finest level, and
+ * the pressure is explicit (PRESSURE_EXPLICIT): there is no composite
+ * Poisson solver for the projection modes.
+ *
+ * @AdvectionSolverType:  solver used to advect the velocity of a patch
+ * @DiffusionSolverType:  solver used for the rest of the step
+ **/
+template<class AdvectionSolverType, class DiffusionSolverType>
+class AdaptiveMesh {
+public:
+
+  typedef Block::IndexType IndexType;
+
+  struct Patch;
+
+  /**
+   * Cell of the mesh that contributes to a ghost cell
+   **/
+  struct GhostSource {
+    Patch * Source;
+    size_t Cell;
+    PrecisionType Weight;
+  };
+
+  /**
+   * Patch of the mesh. Block keeps references to the sizes and the time
+   * step, so they live here.
+   **/
+  struct Patch {
+    size_t Level;
+    size_t Coords[MAX_DIM];
+    __uint64_t Key;
+
+    bool Leaf;
+    PrecisionType Indicator;
+
+    size_t X, Y, Z;
+    size_t NB, NE;
+    size_t Dim;
+    size_t BW;
+
+    PrecisionType Dx;
+
+    PrecisionType * Buffers[MAX_BUFF];
+    uint * Flags;
+
+    // Ghost cells not on the border of the domain
+    std::vector<size_t> Ghosts;
+
+    // The ghost cell Ghosts[c] is the weighted sum of the sources
+    // [GhostOffset[c],GhostOffset[c+1]), built by BuildGhostSources
+    std::vector<size_t> GhostOffset;
+    std::vector<GhostSource> GhostSources;
+
+    Block * block;
+    AdvectionSolverType * advection;
+    DiffusionSolverType * diffusion;
+  };
+
+  typedef std::map<__uint64_t,Patch *> LevelType;
+
+  /**
+   * Creates the mesh with all the patches of the coarsest level
+   * @rootCells:  cells per side of the coarsest level
+   * @patchSize:  cells per side of a patch
+   * @maxLevel:   finest level
+   * @h:          size of the domain
+   * @dt:         time step, limited by the finest level
+   * @omega,ro,mu,ka,cc2: same as in Block
+   **/
+  AdaptiveMesh(
+      const size_t &rootCells,
+      const size_t &patchSize,
+      const size_t &maxLevel,
+      const PrecisionType &h,
+      const PrecisionType &dt,
+      const PrecisionType &omega,
+      const PrecisionType &ro,
+      const PrecisionType &mu,
+      const PrecisionType &ka,
+      const PrecisionType &cc2) :
+      mRootCells(rootCells),
+      mPatchSize(patchSize),
+      mMaxLevel(maxLevel),
+      mH(h),
+      mDt(dt),
+      mPdt(dt),
+      mOmega(omega),
+      mRo(ro),
+      mMu(mu),
+      mKa(ka),
+      mCC2(cc2),
+      mIndicator(REFINE_VORTICITY),
+      mRefineThreshold(1.0e-3f),
+      mCoarsenThreshold(2.5e-4f),
+      mLidVelocity(0.0190f) {
+
+    if(rootCells % patchSize || patchSize % 2) {
+      printf("Error: The root cells (%zu) must be a multiple of the patch size (%zu), which must be even.\n",rootCells,patchSize);
+      exit(1);
+    }
+
+    if(((rootCells / patchSize) << maxLevel) > 0xFFFF) {
+      printf("Error: Too many patches per side for the 3D Morton keys.\n");
+      exit(1);
+    }
+
+    mLevels.resize(maxLevel + 1);
+
+    size_t rootPatches = rootCells / patchSize;
+
+    for(size_t pz = 0; pz < rootPatches; pz++) {
+      for(size_t py = 0; py < rootPatches; py++) {
+        for(size_t px = 0; px < rootPatches; px++) {
+          size_t coords[MAX_DIM] = {px, py, pz};
+          Patch * patch = CreatePatch(0,coords);
+          ApplyWalls(patch);
+          mLevels[0][patch->Key] = patch;
+        }
+      }
+    }
+
+    BuildGhostSources();
+  }
+
+  ~AdaptiveMesh() {
+
+    for(size_t l = 0; l < mLevels.size(); l++) {
+      for(typename LevelType::iterator it = mLevels[l].begin(); it != mLevels[l].end(); it++) {
+        ReleasePatch(it->second);
+      }
+    }
+  }
+
+  void SetIndicator(const RefineIndicator &indicator) {
+    mIndicator = indicator;
+  }
+
+  /**
+   * @refine:     leaves above this value are refined
+   * @coarsen:    siblings all below this value are merged into their parent
+   **/
+  void SetThresholds(const PrecisionType &refine, const PrecisionType &coarsen) {
+    mRefineThreshold  = refine;
+    mCoarsenThreshold = coarsen;
+  }
+
+  /**
+   * Cells per side of a level
+   **/
+  size_t LevelCells(const size_t &level) {
+    return mRootCells << level;
+  }
+
+  PrecisionType LevelDx(const size_t &level) {
+    return mH / (PrecisionType)LevelCells(level);
+  }
+
+  size_t GetNumPatches(const size_t &level) {
+    return mLevels[level].size();
+  }
+
+  size_t GetNumLeaves(const size_t &level) {
+
+    size_t leaves = 0;
+
+    for(typename LevelType::iterator it = mLevels[level].begin(); it != mLevels[level].end(); it++) {
+      leaves += it->second->Leaf;
+    }
+
+    return leaves;
+  }
+
+  /**
+   * Interior cells advanced in every step
+   **/
+  size_t GetNumCells() {
+
+    size_t cells = 0;
+
+    for(size_t l = 0; l < mLevels.size(); l++) {
+      cells += GetNumLeaves(l) * mPatchSize * mPatchSize * mPatchSize;
+    }
+
+    return cells;
+  }
+
+  /**
+   * Maximum velocity component over the leaves
+   **/
+  PrecisionType GetMaxVelocity() {
+
+    PrecisionType maxv = 0.0f;
+
+    for(size_t l = 0; l < mLevels.size(); l++) {
+      for(typename LevelType::iterator it = mLevels[l].begin(); it != mLevels[l].end(); it++) {
+        if(it->second->Leaf) {
+          PrecisionType patchMaxv;
+          it->second->block->calculateRealMaxVelocity(patchMaxv);
+          maxv = std::max(patchMaxv,maxv);
+        }
+      }
+    }
+
+    return maxv;
+  }
+
+  /**
+   * Advances all the leaves one step. The phases of the diffusion solver
+   * are run for all the leaves in turn, exchanging the ghost cells of the
+   * fields they read in between.
+   *
+   * The intermediate fields of BFECC are not exchanged: their ghost cells
+   * take the ghost values of the velocity, so the error correction does not
+   * reach across the border of a patch.
+   **/
+  void Step() {
+
+    std::vector<Patch *> leaves;
+
+    GetLeaves(leaves);
+
+    FillGhosts(leaves,VELOCITY,3);
+    FillGhosts(leaves,PRESSURE,1);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t p = 0; p < leaves.size(); p++) {
+      Patch * patch = leaves[p];
+      for(size_t c = 0; c < patch->Ghosts.size(); c++) {
+        size_t cell = patch->Ghosts[c];
+        for(size_t d = 0; d < 3; d++) {
+          patch->Buffers[AUX_3D_1][cell*3+d] = patch->Buffers[VELOCITY][cell*3+d];
+          patch->Buffers[AUX_3D_3][cell*3+d] = patch->Buffers[VELOCITY][cell*3+d];
+        }
+      }
+    }
+
+    for(size_t p = 0; p < leaves.size(); p++) {
+      leaves[p]->advection->Execute();
+      leaves[p]->diffusion->ExecuteTaskVelocity();
+    }
+
+    Restrict(VELOCITY,3);
+    FillGhosts(leaves,VELOCITY,3);
+
+    for(size_t p = 0; p < leaves.size(); p++) {
+      leaves[p]->diffusion->ExecuteTaskDivergence();
+    }
+
+    Restrict(AUX_3D_5,1);
+    FillGhosts(leaves,AUX_3D_5,1);
+
+    for(size_t p = 0; p < leaves.size(); p++) {
+      leaves[p]->diffusion->ExecuteTaskPressure();
+    }
+
+    Restrict(PRESSURE,1);
+  }
+
+  /**
+   * Refines the leaves whose indicator is above the refine threshold and
+   * merges the groups of 8 sibling leaves below the coarsen threshold.
+   **/
+  void Regrid() {
+
+    std::vector<Patch *> leaves;
+
+    GetLeaves(leaves);
+
+    FillGhosts(leaves,VELOCITY,3);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t p = 0; p < leaves.size(); p++) {
+      leaves[p]->Indicator = CalculateIndicator(leaves[p]);
+    }
+
+    for(size_t p = 0; p < leaves.size(); p++) {
+      if(leaves[p]->Level < mMaxLevel && leaves[p]->Indicator > mRefineThreshold) {
+        Refine(leaves[p]);
+      }
+    }
+
+    for(size_t l = 0; l < mMaxLevel; l++) {
+      for(typename LevelType::iterator it = mLevels[l].begin(); it != mLevels[l].end(); it++) {
+        Patch * parent = it->second;
+
+        if(parent->Leaf) {
+          continue;
+        }
+
+        bool coarsen = true;
+
+        for(size_t c = 0; c < 8 && coarsen; c++) {
+          Patch * child = GetChild(parent,c);
+          coarsen = child != NULL && child->Leaf && child->Indicator < mCoarsenThreshold;
+        }
+
+        if(coarsen) {
+          Coarsen(parent);
+        }
+      }
+    }
+
+    BuildGhostSources();
+  }
+
+private:
+
+  /**
+   * Creates a patch with its block and solvers. All the buffers are set
+   * to zero and the cells on the border of the domain are walls.
+   **/
+  Patch * CreatePatch(const size_t &level, const size_t * coords) {
+
+    Patch * patch = new Patch;
+
+    size_t n      = mPatchSize;
+    size_t cells  = LevelCells(level);
+
+    patch->Level  = level;
+    patch->Leaf   = true;
+    patch->Key    = interleave64(coords[0],coords[1],coords[2]);
+
+    patch->Indicator = std::numeric_limits<PrecisionType>::max();
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      patch->Coords[d] = coords[d];
+    }
+
+    patch->X   = n;
+    patch->Y   = n;
+    patch->Z   = n;
+    patch->NB  = 1;
+    patch->NE  = n + BW;
+    patch->Dim = 3;
+    patch->BW  = BW;
+    patch->Dx  = LevelDx(level);
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      mMemManager.AllocateGrid(&patch->Buffers[b], n, n, n, 3, 1);
+    }
+
+    mMemManager.AllocateGrid(&patch->Flags, n, n, n, 1, 1);
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < n + BW; k++) {
+      for(size_t j = 0; j < n + BW; j++) {
+        for(size_t i = 0; i < n + BW; i++) {
+          size_t cell = IndexType::GetIndex(i,j,k,n+BW,(n+BW)*(n+BW));
+          size_t g[MAX_DIM] = {i, j, k};
+          bool ghost = false;
+          bool wall  = false;
+
+          for(size_t d = 0; d < MAX_DIM; d++) {
+            ghost |= g[d] < BWP || g[d] >= n + BWP;
+            g[d]   = coords[d] * n + g[d] - BWP;
+            wall  |= g[d] == 0 || g[d] == cells - 1;
+          }
+
+          patch->Flags[cell] = (!ghost && wall) ? FIXED_VELOCITY_X | FIXED_VELOCITY_Y | FIXED_VELOCITY_Z : 0;
+
+          for(size_t b = 0; b < MAX_BUFF; b++) {
+            for(size_t d = 0; d < 3; d++) {
+              patch->Buffers[b][cell*3+d] = 0.0f;
+            }
+          }
+        }
+      }
+    }
+
+    // Ghost shell, without the cells outside the domain
+    for(size_t k = 0; k < n + BW; k++) {
+      for(size_t j = 0; j < n + BW; j++) {
+        for(size_t i = 0; i < n + BW; i++) {
+          long g[MAX_DIM] = {(long)i, (long)j, (long)k};
+          bool ghost  = false;
+          bool inside = true;
+
+          for(size_t d = 0; d < MAX_DIM; d++) {
+            ghost  |= g[d] < (long)BWP || g[d] >= (long)(n + BWP);
+            g[d]    = (long)(coords[d] * n) + g[d] - (long)BWP;
+            inside &= g[d] >= 0 && g[d] < (long)cells;
+          }
+
+          if(ghost && inside) {
+            patch->Ghosts.push_back(IndexType::GetIndex(i,j,k,n+BW,(n+BW)*(n+BW)));
+          }
+        }
+      }
+    }
+
+    patch->block = new Block(
+      patch->Buffers, patch->Flags,
+      patch->Dx, mOmega, mRo, mMu, mKa, mCC2,
+      patch->BW,
+      patch->X, patch->Y, patch->Z,
+      patch->NB, patch->NE, patch->Dim
+    );
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      patch->block->mDomainFace[2*d+0] = coords[d] == 0;
+      patch->block->mDomainFace[2*d+1] = coords[d] == cells / n - 1;
+    }
+
+    patch->advection = new AdvectionSolverType(patch->block,mDt,mPdt);
+    patch->diffusion = new DiffusionSolverType(patch->block,mDt,mPdt);
+
+    return patch;
+  }
+
+  void ReleasePatch(Patch * patch) {
+
+    delete patch->advection;
+    delete patch->diffusion;
+    delete patch->block;
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      mMemManager.ReleaseGrid(&patch->Buffers[b], 1);
+    }
+
+    mMemManager.ReleaseGrid(&patch->Flags, 1);
+
+    delete patch;
+  }
+
+  /**
+   * Sets the velocity of the walls: zero except on the lid (first plane in
+   * z), same as Block::InitializeVelocity.
+   **/
+  void ApplyWalls(Patch * patch) {
+
+    size_t n = mPatchSize;
+    PrecisionType * velocity = patch->Buffers[VELOCITY];
+
+    #pragma omp parallel for
+    for(size_t k = BWP; k < n + BWP; k++) {
+      for(size_t j = BWP; j < n + BWP; j++) {
+        size_t cell = IndexType::GetIndex(BWP,j,k,n+BW,(n+BW)*(n+BW));
+        for(size_t i = BWP; i < n + BWP; i++) {
+          if(patch->Flags[cell] & FIXED_VELOCITY_X) {
+            bool lid =
+              patch->Coords[2] * n + k - BWP == 0 &&
+              patch->Coords[1] * n + j - BWP  > 0;
+
+            velocity[cell*3+0] = lid ? mLidVelocity : 0.0f;
+            velocity[cell*3+1] = 0.0f;
+            velocity[cell*3+2] = 0.0f;
+          }
+          cell++;
+        }
+      }
+    }
+  }
+
+  void GetLeaves(std::vector<Patch *> &leaves) {
+
+    for(size_t l = 0; l < mLevels.size(); l++) {
+      for(typename LevelType::iterator it = mLevels[l].begin(); it != mLevels[l].end(); it++) {
+        if(it->second->Leaf) {
+          leaves.push_back(it->second);
+        }
+      }
+    }
+  }
+
+  /**
+   * Child of a refined patch
+   * @parent:   patch
+   * @c:        index of the child (bit d set for the upper half in d)
+   * @return:   the child or NULL if the patch is not refined
+   **/
+  Patch * GetChild(Patch * parent, const size_t &c) {
+
+    if(parent->Level >= mMaxLevel) {
+      return NULL;
+    }
+
+    typename LevelType::iterator it = mLevels[parent->Level + 1].find((parent->Key << 3) | c);
+
+    return it == mLevels[parent->Level + 1].end() ? NULL : it->second;
+  }
+
+  /**
+   * Patch of a level that covers a cell of the level
+   * @level:    level
+   * @g:        global index of the cell in the level
+   * @return:   the patch or NULL if the level does not cover the cell
+   **/
+  Patch * FindPatch(const size_t &level, const long * g) {
+
+    typename LevelType::iterator it = mLevels[level].find(interleave64(
+      g[0] / mPatchSize,
+      g[1] / mPatchSize,
+      g[2] / mPatchSize));
+
+    return it == mLevels[level].end() ? NULL : it->second;
+  }
+
+  /**
+   * Value of a field at the center of a cell of a level. Cells outside the
+   * domain are clamped to the border and cells not covered by the level
+   * are interpolated from the coarser ones.
+   * @level:    level
+   * @g:        global index of the cell in the level
+   * @field:    buffer
+   * @dim:      number of components of the field
+   * @value:    result
+   **/
+  void Sample(
+      const size_t &level,
+      const long * g,
+      const size_t &field,
+      const size_t &dim,
+      PrecisionType * value) {
+
+    long cells = (long)LevelCells(level);
+    long c[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      c[d] = std::min(std::max(g[d],0L),cells - 1);
+    }
+
+    Patch * patch = FindPatch(level,c);
+
+    if(patch != NULL) {
+      size_t n = mPatchSize;
+      size_t cell = IndexType::GetIndex(
+        c[0] - patch->Coords[0] * n + BWP,
+        c[1] - patch->Coords[1] * n + BWP,
+        c[2] - patch->Coords[2] * n + BWP,
+        n+BW,(n+BW)*(n+BW));
+
+      for(size_t d = 0; d < dim; d++) {
+        value[d] = patch->Buffers[field][cell*dim+d];
+      }
+
+      return;
+    }
+
+    PrecisionType x[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      x[d] = ((PrecisionType)c[d] + 0.5f) * 0.5f - 0.5f;
+    }
+
+    Interpolate(level - 1,x,field,dim,value);
+  }
+
+  /**
+   * Trilinear interpolation in a level
+   * @level:    level
+   * @x:        position in cells of the level (cell centers are integers)
+   * @field:    buffer
+   * @dim:      number of components of the field
+   * @value:    result
+   **/
+  void Interpolate(
+      const size_t &level,
+      const PrecisionType * x,
+      const size_t &field,
+      const size_t &dim,
+      PrecisionType * value) {
+
+    long base[MAX_DIM];
+    PrecisionType w[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      base[d] = (long)floor(x[d]);
+      w[d]    = x[d] - (PrecisionType)base[d];
+    }
+
+    for(size_t d = 0; d < dim; d++) {
+      value[d] = 0.0f;
+    }
+
+    for(size_t c = 0; c < 8; c++) {
+      long g[MAX_DIM];
+      PrecisionType weight = 1.0f;
+      PrecisionType corner[MAX_DIM];
+
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        size_t bit = (c >> d) & 1;
+        g[d]    = base[d] + bit;
+        weight *= bit ? w[d] : 1.0f - w[d];
+      }
+
+      Sample(level,g,field,dim,corner);
+
+      for(size_t d = 0; d < dim; d++) {
+        value[d] += weight * corner[d];
+      }
+    }
+  }
+
+  /**
+   * Appends the cells that Sample reads to obtain the value of a cell of a
+   * level, with their weights in the interpolation
+   * @level:    level
+   * @g:        global index of the cell in the level
+   * @weight:   weight of the cell
+   * @sources:  result
+   **/
+  void GatherSources(
+      const size_t &level,
+      const long * g,
+      const PrecisionType &weight,
+      std::vector<GhostSource> &sources) {
+
+    long cells = (long)LevelCells(level);
+    long c[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      c[d] = std::min(std::max(g[d],0L),cells - 1);
+    }
+
+    Patch * patch = FindPatch(level,c);
+
+    if(patch != NULL) {
+      size_t n = mPatchSize;
+      GhostSource source = {
+        patch,
+        IndexType::GetIndex(
+          c[0] - patch->Coords[0] * n + BWP,
+          c[1] - patch->Coords[1] * n + BWP,
+          c[2] - patch->Coords[2] * n + BWP,
+          n+BW,(n+BW)*(n+BW)),
+        weight
+      };
+
+      sources.push_back(source);
+
+      return;
+    }
+
+    long base[MAX_DIM];
+    PrecisionType w[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      PrecisionType x = ((PrecisionType)c[d] + 0.5f) * 0.5f - 0.5f;
+      base[d] = (long)floor(x);
+      w[d]    = x - (PrecisionType)base[d];
+    }
+
+    for(size_t corner = 0; corner < 8; corner++) {
+      long gc[MAX_DIM];
+      PrecisionType wc = weight;
+
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        size_t bit = (corner >> d) & 1;
+        gc[d] = base[d] + bit;
+        wc   *= bit ? w[d] : 1.0f - w[d];
+      }
+
+      GatherSources(level - 1,gc,wc,sources);
+    }
+  }
+
+  /**
+   * Builds the sources of the ghost cells of all the leaves. Sources are
+   * patches of the mesh, so they must be built again after every regrid.
+   **/
+  void BuildGhostSources() {
+
+    std::vector<Patch *> leaves;
+
+    GetLeaves(leaves);
+
+    size_t n = mPatchSize;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t p = 0; p < leaves.size(); p++) {
+      Patch * patch = leaves[p];
+
+      patch->GhostOffset.resize(patch->Ghosts.size() + 1);
+      patch->GhostSources.clear();
+
+      for(size_t c = 0; c < patch->Ghosts.size(); c++) {
+        size_t cell = patch->Ghosts[c];
+        long g[MAX_DIM] = {
+          (long)(cell % (n+BW)),
+          (long)((cell / (n+BW)) % (n+BW)),
+          (long)(cell / ((n+BW)*(n+BW)))
+        };
+
+        for(size_t d = 0; d < MAX_DIM; d++) {
+          g[d] += (long)(patch->Coords[d] * n) - (long)BWP;
+        }
+
+        patch->GhostOffset[c] = patch->GhostSources.size();
+
+        GatherSources(patch->Level,g,1.0f,patch->GhostSources);
+      }
+
+      patch->GhostOffset[patch->Ghosts.size()] = patch->GhostSources.size();
+    }
+  }
+
+  /**
+   * Fills the ghost cells of a field of a patch from the rest of the mesh,
+   * using the sources built by BuildGhostSources
+   **/
+  void FillGhosts(Patch * patch, const size_t &field, const size_t &dim) {
+
+    PrecisionType * dst = patch->Buffers[field];
+
+    for(size_t c = 0; c < patch->Ghosts.size(); c++) {
+      PrecisionType * value = &dst[patch->Ghosts[c]*dim];
+
+      for(size_t d = 0; d < dim; d++) {
+        value[d] = 0.0f;
+      }
+
+      for(size_t s = patch->GhostOffset[c]; s < patch->GhostOffset[c+1]; s++) {
+        const GhostSource &source = patch->GhostSources[s];
+        const PrecisionType * src = &source.Source->Buffers[field][source.Cell*dim];
+
+        for(size_t d = 0; d < dim; d++) {
+          value[d] += source.Weight * src[d];
+        }
+      }
+    }
+  }
+
+  /**
+   * Fills the ghost cells of a field of all the leaves
+   **/
+  void FillGhosts(std::vector<Patch *> &leaves, const size_t &field, const size_t &dim) {
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t p = 0; p < leaves.size(); p++) {
+      FillGhosts(leaves[p],field,dim);
+    }
+  }
+
+  /**
+   * Averages the 8 children of every cell of the refined patches, from the
+   * finest level to the coarsest. Walls of the velocity are set again.
+   * @field:    buffer
+   * @dim:      number of components of the field
+   **/
+  void Restrict(const size_t &field, const size_t &dim) {
+
+    size_t n = mPatchSize;
+    size_t h = mPatchSize / 2;
+
+    for(size_t l = mMaxLevel; l-- > 0; ) {
+      std::vector<Patch *> parents;
+
+      for(typename LevelType::iterator it = mLevels[l].begin(); it != mLevels[l].end(); it++) {
+        if(!it->second->Leaf) {
+          parents.push_back(it->second);
+        }
+      }
+
+      #pragma omp parallel for schedule(dynamic)
+      for(size_t p = 0; p < parents.size() * 8; p++) {
+        Patch * parent = parents[p / 8];
+        Patch * child  = GetChild(parent,p % 8);
+        Block * block  = child->block;
+
+        PrecisionType * coarseField = parent->Buffers[field];
+        PrecisionType * fineField   = child->Buffers[field];
+
+        size_t offset[MAX_DIM] = {(p % 8) & 1, ((p % 8) >> 1) & 1, ((p % 8) >> 2) & 1};
+
+        for(size_t k = 0; k < h; k++) {
+          for(size_t j = 0; j < h; j++) {
+            size_t cell = IndexType::GetIndex(offset[0]*h+BWP,offset[1]*h+j+BWP,offset[2]*h+k+BWP,n+BW,(n+BW)*(n+BW));
+            size_t fine = IndexType::GetIndex(BWP,2*j+BWP,2*k+BWP,n+BW,(n+BW)*(n+BW));
+            for(size_t i = 0; i < h; i++) {
+              for(size_t d = 0; d < dim; d++) {
+                coarseField[cell*dim+d] = 0.125f * (
+                  fineField[(fine                )*dim+d] +
+                  fineField[(fine + block->mPaddA)*dim+d] +
+                  fineField[(fine + block->mPaddB)*dim+d] +
+                  fineField[(fine + block->mPaddC)*dim+d] +
+                  fineField[(fine + block->mPaddD)*dim+d] +
+                  fineField[(fine + block->mPaddE)*dim+d] +
+                  fineField[(fine + block->mPaddF)*dim+d] +
+                  fineField[(fine + block->mPaddG)*dim+d]);
+              }
+              cell += 1;
+              fine += 2;
+            }
+          }
+        }
+      }
+
+      if(field == VELOCITY) {
+        for(size_t p = 0; p < parents.size(); p++) {
+          ApplyWalls(parents[p]);
+        }
+      }
+    }
+  }
+
+  /**
+   * Largest value of the indicator over the interior of a patch. Ghost
+   * cells of the velocity must be up to date.
+   **/
+  PrecisionType CalculateIndicator(Patch * patch) {
+
+    size_t n = mPatchSize;
+    Block * block = patch->block;
+    PrecisionType * velocity = patch->Buffers[VELOCITY];
+
+    size_t stride[MAX_DIM] = {1, block->mPaddY, block->mPaddZ};
+
+    PrecisionType indicator = 0.0f;
+
+    for(size_t k = BWP; k < n + BWP; k++) {
+      for(size_t j = BWP; j < n + BWP; j++) {
+        size_t cell = IndexType::GetIndex(BWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = BWP; i < n + BWP; i++) {
+          // du[a][d]: difference of the component d across the cell in a
+          PrecisionType du[MAX_DIM][MAX_DIM];
+
+          for(size_t a = 0; a < MAX_DIM; a++) {
+            for(size_t d = 0; d < MAX_DIM; d++) {
+              du[a][d] = 0.5f * (velocity[(cell + stride[a])*3+d] - velocity[(cell - stride[a])*3+d]);
+            }
+          }
+
+          if(mIndicator == REFINE_GRADIENT) {
+            for(size_t a = 0; a < MAX_DIM; a++) {
+              for(size_t d = 0; d < MAX_DIM; d++) {
+                indicator = std::max((PrecisionType)fabs(du[a][d]),indicator);
+              }
+            }
+          } else {
+            PrecisionType wx = du[1][2] - du[2][1];
+            PrecisionType wy = du[2][0] - du[0][2];
+            PrecisionType wz = du[0][1] - du[1][0];
+
+            indicator = std::max((PrecisionType)sqrt(wx*wx + wy*wy + wz*wz),indicator);
+          }
+
+          cell++;
+        }
+      }
+    }
+
+    return indicator;
+  }
+
+  /**
+   * Creates the 8 children of a leaf, interpolated from its level
+   **/
+  void Refine(Patch * parent) {
+
+    size_t n = mPatchSize;
+    size_t level = parent->Level + 1;
+
+    size_t fields[3] = {VELOCITY, PRESSURE, AUX_3D_5};
+    size_t dims[3]   = {3, 1, 1};
+
+    for(size_t c = 0; c < 8; c++) {
+      size_t coords[MAX_DIM];
+
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        coords[d] = 2 * parent->Coords[d] + ((c >> d) & 1);
+      }
+
+      Patch * child = CreatePatch(level,coords);
+
+      #pragma omp parallel for
+      for(size_t k = BWP; k < n + BWP; k++) {
+        for(size_t j = BWP; j < n + BWP; j++) {
+          for(size_t i = BWP; i < n + BWP; i++) {
+            size_t cell = IndexType::GetIndex(i,j,k,n+BW,(n+BW)*(n+BW));
+            size_t local[MAX_DIM] = {i, j, k};
+            PrecisionType x[MAX_DIM];
+
+            for(size_t d = 0; d < MAX_DIM; d++) {
+              x[d] = ((PrecisionType)(coords[d] * n + local[d] - BWP) + 0.5f) * 0.5f - 0.5f;
+            }
+
+            for(size_t f = 0; f < 3; f++) {
+              Interpolate(parent->Level,x,fields[f],dims[f],&child->Buffers[fields[f]][cell*dims[f]]);
+            }
+          }
+        }
+      }
+
+      ApplyWalls(child);
+
+      mLevels[level][child->Key] = child;
+    }
+
+    parent->Leaf = false;
+  }
+
+  /**
+   * Removes the children of a patch. The patch already holds their
+   * restriction.
+   **/
+  void Coarsen(Patch * parent) {
+
+    size_t level = parent->Level + 1;
+
+    for(size_t c = 0; c < 8; c++) {
+      Patch * child = GetChild(parent,c);
+      mLevels[level].erase(child->Key);
+      ReleasePatch(child);
+    }
+
+    parent->Leaf = true;
+    parent->Indicator = std::numeric_limits<PrecisionType>::max();
+  }
+
+  MemManager mMemManager;
+
+  std::vector<LevelType> mLevels;
+
+  size_t mRootCells;
+  size_t mPatchSize;
+  size_t mMaxLevel;
+
+  PrecisionType mH;
+  PrecisionType mDt;
+  PrecisionType mPdt;
+
+  PrecisionType mOmega;
+  PrecisionType mRo;
+  PrecisionType mMu;
+  PrecisionType mKa;
+  PrecisionType mCC2;
+
+  RefineIndicator mIndicator;
+  PrecisionType mRefineThreshold;
+  PrecisionType mCoarsenThreshold;
+
+  PrecisionType mLidVelocity;
+};
+
+#endif
@@ -1,10 +1,12 @@
 #ifndef BLOCK_H
 #define BLOCK_H
 
+#include <cmath>
 #include <limits>
 
 #include "defines.h"
 #include "utils.h"
+#include "topology.h"
 
 class Block {
 public:
@@ -61,10 +63,60 @@ public:
     mPaddF = (rZ+rBW)*(rY+rBW) + (rY+rBW);
     mPaddG = (rZ+rBW)*(rY+rBW) + (rY+rBW) + 1;
 
+    mTileSize     = 0;
+    mNumTiles[0]  = 0;
+    mNumTiles[1]  = 0;
+    mNumTiles[2]  = 0;
+    pActiveTiles  = NULL;
+    pRawActive    = NULL;
+    pActiveList   = NULL;
+    pRetiredList  = NULL;
+    mNumActive    = 0;
+    mNumRetired   = 0;
+
+    pFixedOffset  = NULL;
+    pFixedCells   = NULL;
+    pFixedMask    = NULL;
+    mNumFixed     = 0;
+    mFixedVersion = 0;
+
+    pRunOffset    = NULL;
+    pRunStart     = NULL;
+    pRunLength    = NULL;
+    pSolidFaces   = NULL;
+    mNumRuns      = 0;
+    mNumSolid     = 0;
+    mNumSolidFaces = 0;
+    mRunsVersion   = 0;
+
+    mFlagsVersion  = 1;
+
+    for(size_t f = 0; f < MAX_FACE; f++) {
+      mDomainFace[f] = true;
+    }
+
     printf("RIDX: %f\n",rIdx);
   }
 
-  ~Block() {}
+  ~Block() {
+    if(pActiveTiles != NULL) {
+      free(pActiveTiles);
+      free(pRawActive);
+      free(pActiveList);
+      free(pRetiredList);
+    }
+    if(pFixedOffset != NULL) {
+      free(pFixedOffset);
+      free(pFixedCells);
+      free(pFixedMask);
+    }
+    if(pRunOffset != NULL) {
+      free(pRunOffset);
+      free(pRunStart);
+      free(pRunLength);
+      free(pSolidFaces);
+    }
+  }
 
   void Zero() {
 
@@ -84,25 +136,41 @@ public:
 
   void InitializePressure() {
 
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t i = 0; i < rX + rBW; i++) {
-          pBuffers[PRESSURE][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)] = 0.0f;//(-9.8f/(PrecisionType)rZ) * (PrecisionType)k;
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(rZ,0,rZ+rBW,kb,ke);
+
+      for(size_t k = kb; k < ke; k++) {
+        for(size_t j = 0; j < rY + rBW; j++) {
+          for(size_t i = 0; i < rX + rBW; i++) {
+            pBuffers[PRESSURE][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)] = 0.0f;//(-9.8f/(PrecisionType)rZ) * (PrecisionType)k;
+          }
         }
       }
     }
 
   }
 
-  void InitializeVelocity() {
+  /**
+   * Lid driven cavity: zero velocity except on the first plane in z
+   * @lid:      velocity of the lid (x component)
+   **/
+  void InitializeVelocity(const PrecisionType &lid = 0.0190f) {
 
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t i = 0; i < rX + rBW; i++) {
-          for(size_t d = 0; d < rDim; d++) {
-            pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+d] = 0.0f;
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(rZ,0,rZ+rBW,kb,ke);
+
+      for(size_t k = kb; k < ke; k++) {
+        for(size_t j = 0; j < rY + rBW; j++) {
+          for(size_t i = 0; i < rX + rBW; i++) {
+            for(size_t d = 0; d < rDim; d++) {
+              pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+d] = 0.0f;
+            }
           }
         }
       }
@@ -112,14 +180,20 @@ public:
     int toUpdate[update_size] = {VELOCITY,AUX_3D_0,AUX_3D_1,AUX_3D_2};
     // int toUpdate[update_size] = {VELOCITY};
 
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t i = 0; i < rX + rBW; i++ ) {
-          for(size_t b = 0; b < update_size; b++ ) {
-            pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+0] = 0.0f;//-rOmega * (PrecisionType)(j-(rY+1.0)/2.0) * rDx;
-            pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+1] = 0.0f;// rOmega * (PrecisionType)(i-(rX+1.0)/2.0) * rDx;
-            pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+2] = 0.0f;
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(rZ,0,rZ+rBW,kb,ke);
+
+      for(size_t k = kb; k < ke; k++) {
+        for(size_t j = 0; j < rY + rBW; j++) {
+          for(size_t i = 0; i < rX + rBW; i++ ) {
+            for(size_t b = 0; b < update_size; b++ ) {
+              pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+0] = 0.0f;//-rOmega * (PrecisionType)(j-(rY+1.0)/2.0) * rDx;
+              pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+1] = 0.0f;// rOmega * (PrecisionType)(i-(rX+1.0)/2.0) * rDx;
+              pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+2] = 0.0f;
+            }
           }
         }
       }
@@ -133,7 +207,7 @@ public:
     #pragma omp parallel for
     for(size_t a = 1; a < rY + rBW - 1; a++)
       for(size_t b = 2; b < rX + rBW - 1; b++)
-        pBuffers[VELOCITY][IndexType::GetIndex(a,b,1,mPaddY,mPaddZ)*rDim+0] = 0.0190f;
+        pBuffers[VELOCITY][IndexType::GetIndex(a,b,1,mPaddY,mPaddZ)*rDim+0] = lid;
 
     #pragma omp parallel for
     for(size_t jk = 0; jk < rY + rBW; jk++) {
@@ -157,21 +231,33 @@ public:
 
   }
 
+  /**
+   * Maximum velocity component of the block, at least 1. NaN if any
+   * component is not finite, since std::max drops the NaN
+   * @maxv:     maximum velocity component
+   **/
   void calculateMaxVelocity(PrecisionType &maxv) {
 
+    size_t invalid = 0;
+
     maxv = 1.0f;
 
-    #pragma omp parallel for reduction(max:maxv)
+    #pragma omp parallel for reduction(max:maxv) reduction(+:invalid)
     for(size_t k = 0; k < rZ + rBW; k++) {
       for(size_t j = 0; j < rY + rBW; j++) {
         for(size_t i = 0; i < rX + rBW; i++ ) {
-          maxv = std::max((PrecisionType)fabs(pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+0]),maxv);
-          maxv = std::max((PrecisionType)fabs(pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+1]),maxv);
-          maxv = std::max((PrecisionType)fabs(pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+2]),maxv);
+          for(size_t d = 0; d < 3; d++) {
+            PrecisionType v = fabs(pBuffers[VELOCITY][IndexType::GetIndex(i,j,k,mPaddY,mPaddZ)*rDim+d]);
+            maxv = std::max(v,maxv);
+            invalid += !std::isfinite(v);
+          }
         }
       }
     }
 
+    if(invalid) {
+      maxv = std::numeric_limits<PrecisionType>::quiet_NaN();
+    }
   }
 
   void calculateRealMaxVelocity(PrecisionType &maxv) {
@@ -221,6 +307,439 @@ public:
     }
   }
 
+  /**
+   * Builds the lists of fixed cells of every row from pFlags. The cells of
+   * the row (j,k) are [pFixedOffset[FixedRow(j,k)], pFixedOffset[FixedRow(j,k)+1])
+   * and pFixedMask holds their FixedMask. UpdateFixedLists rebuilds them
+   * only if the flags changed since.
+   **/
+  void BuildFixedLists() {
+
+    mFixedVersion = mFlagsVersion;
+
+    size_t numRows = (rY + rBW) * (rZ + rBW);
+
+    if(pFixedOffset != NULL) {
+      free(pFixedOffset);
+      free(pFixedCells);
+      free(pFixedMask);
+    }
+
+    pFixedOffset = (size_t *)malloc(sizeof(size_t) * (numRows + 1));
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < rZ + rBW; k++) {
+      for(size_t j = 0; j < rY + rBW; j++) {
+        size_t count = 0;
+        size_t cell = IndexType::GetIndex(rBWP,j,k,mPaddY,mPaddZ);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          count += ((pFlags[cell++] & ~SOLID) != 0);
+        }
+        pFixedOffset[FixedRow(j,k) + 1] = count;
+      }
+    }
+
+    pFixedOffset[0] = 0;
+
+    for(size_t r = 0; r < numRows; r++) {
+      pFixedOffset[r + 1] += pFixedOffset[r];
+    }
+
+    mNumFixed = pFixedOffset[numRows];
+
+    pFixedCells = (size_t *)malloc(sizeof(size_t) * std::max(mNumFixed,(size_t)1));
+    pFixedMask  = (unsigned char *)malloc(sizeof(unsigned char) * std::max(mNumFixed,(size_t)1));
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < rZ + rBW; k++) {
+      for(size_t j = 0; j < rY + rBW; j++) {
+        size_t b = pFixedOffset[FixedRow(j,k)];
+        size_t cell = IndexType::GetIndex(rBWP,j,k,mPaddY,mPaddZ);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          uint flags = pFlags[cell] & ~SOLID;
+          if(flags) {
+            pFixedCells[b] = cell;
+            pFixedMask[b]  =
+              ((flags & FIXED_VELOCITY_X) ? FIXED_MASK_X : 0) |
+              ((flags & FIXED_VELOCITY_Y) ? FIXED_MASK_Y : 0) |
+              ((flags & FIXED_VELOCITY_Z) ? FIXED_MASK_Z : 0) |
+              ((flags & FIXED_PRESSURE)   ? FIXED_MASK_P : 0);
+            b++;
+          }
+          cell++;
+        }
+      }
+    }
+  }
+
+  /**
+   * Rebuilds the lists of fixed cells if the flags changed since they were
+   * built. Returns true if they were rebuilt
+   **/
+  bool UpdateFixedLists() {
+
+    if(mFixedVersion == mFlagsVersion) {
+      return false;
+    }
+
+    BuildFixedLists();
+
+    return true;
+  }
+
+  /**
+   * Rebuilds the runs of fluid cells if the flags changed since they were
+   * built. Returns true if they were rebuilt
+   **/
+  bool UpdateFluidRuns() {
+
+    if(mRunsVersion == mFlagsVersion) {
+      return false;
+    }
+
+    BuildFluidRuns();
+
+    return true;
+  }
+
+  /**
+   * Marks the lists of fixed cells and the runs of fluid cells as stale.
+   * Must be called after modifying pFlags directly.
+   **/
+  void FlagsChanged() {
+    mFlagsVersion++;
+  }
+
+  /**
+   * Index of a row in pFixedOffset and pRunOffset
+   **/
+  inline size_t FixedRow(const size_t &j, const size_t &k) {
+    return k * (rY + rBW) + j;
+  }
+
+  /**
+   * Marks the interior cells of a box as SOLID and zeroes all the buffers
+   * in them. The lists built from the flags are marked as stale
+   * @low:      first cell of the box in each direction
+   * @high:     last cell of the box in each direction (not included)
+   **/
+  void AddSolidBox(const size_t * low, const size_t * high) {
+
+    size_t size[MAX_DIM] = {rX, rY, rZ};
+
+    size_t lo[MAX_DIM], hi[MAX_DIM];
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      lo[d] = std::max(low[d],rBWP);
+      hi[d] = std::min(high[d],size[d] + rBWP);
+    }
+
+    #pragma omp parallel for
+    for(size_t k = lo[2]; k < hi[2]; k++) {
+      for(size_t j = lo[1]; j < hi[1]; j++) {
+        for(size_t i = lo[0]; i < hi[0]; i++) {
+          setSolid(IndexType::GetIndex(i,j,k,mPaddY,mPaddZ));
+        }
+      }
+    }
+
+    FlagsChanged();
+  }
+
+  /**
+   * Marks the interior cells whose centre is inside a sphere as SOLID and
+   * zeroes all the buffers in them. The lists built from the flags are
+   * marked as stale
+   * @center:   centre of the sphere
+   * @radius:   radius of the sphere
+   **/
+  void AddSolidSphere(const PrecisionType * center, const PrecisionType &radius) {
+
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          PrecisionType dx = i * rDx - center[0];
+          PrecisionType dy = j * rDx - center[1];
+          PrecisionType dz = k * rDx - center[2];
+
+          if(dx*dx + dy*dy + dz*dz < radius*radius) {
+            setSolid(IndexType::GetIndex(i,j,k,mPaddY,mPaddZ));
+          }
+        }
+      }
+    }
+
+    FlagsChanged();
+  }
+
+  /**
+   * Builds the runs of fluid (not SOLID) cells of every interior row. The
+   * runs of the row (j,k) are [pRunOffset[FixedRow(j,k)], pRunOffset[FixedRow(j,k)+1])
+   * and each one covers the cells [pRunStart[r], pRunStart[r]+pRunLength[r]).
+   * Also builds the list of solid cells with a fluid neighbour, whose
+   * pressure is extrapolated from the fluid. UpdateFluidRuns rebuilds them
+   * only if the flags changed since.
+   **/
+  void BuildFluidRuns() {
+
+    mRunsVersion = mFlagsVersion;
+
+    size_t numRows = (rY + rBW) * (rZ + rBW);
+
+    if(pRunOffset != NULL) {
+      free(pRunOffset);
+      free(pRunStart);
+      free(pRunLength);
+      free(pSolidFaces);
+    }
+
+    pRunOffset = (size_t *)malloc(sizeof(size_t) * (numRows + 1));
+
+    size_t numSolid = 0;
+    size_t numFaces = 0;
+
+    #pragma omp parallel for reduction(+:numSolid,numFaces)
+    for(size_t k = 0; k < rZ + rBW; k++) {
+      for(size_t j = 0; j < rY + rBW; j++) {
+        size_t count = 0;
+        if(j >= rBWP && j < rY + rBWP && k >= rBWP && k < rZ + rBWP) {
+          size_t cell = IndexType::GetIndex(rBWP,j,k,mPaddY,mPaddZ);
+          bool fluid = false;
+          for(size_t i = rBWP; i < rX + rBWP; i++) {
+            bool solid = pFlags[cell] & SOLID;
+            count += !solid && !fluid;
+            fluid = !solid;
+            numSolid += solid;
+            numFaces += solid && isSolidFace(cell);
+            cell++;
+          }
+        }
+        pRunOffset[FixedRow(j,k) + 1] = count;
+      }
+    }
+
+    pRunOffset[0] = 0;
+
+    for(size_t r = 0; r < numRows; r++) {
+      pRunOffset[r + 1] += pRunOffset[r];
+    }
+
+    mNumRuns       = pRunOffset[numRows];
+    mNumSolid      = numSolid;
+    mNumSolidFaces = numFaces;
+
+    pRunStart   = (size_t *)malloc(sizeof(size_t) * std::max(mNumRuns,(size_t)1));
+    pRunLength  = (size_t *)malloc(sizeof(size_t) * std::max(mNumRuns,(size_t)1));
+    pSolidFaces = (size_t *)malloc(sizeof(size_t) * std::max(mNumSolidFaces,(size_t)1));
+
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t r = pRunOffset[FixedRow(j,k)];
+        size_t cell = IndexType::GetIndex(rBWP,j,k,mPaddY,mPaddZ);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          if(!(pFlags[cell] & SOLID)) {
+            if(i == rBWP || (pFlags[cell-1] & SOLID)) {
+              pRunStart[r]  = i;
+              pRunLength[r] = 0;
+              r++;
+            }
+            pRunLength[r-1]++;
+          }
+          cell++;
+        }
+      }
+    }
+
+    size_t face = 0;
+
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = IndexType::GetIndex(rBWP,j,k,mPaddY,mPaddZ);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          if((pFlags[cell] & SOLID) && isSolidFace(cell)) {
+            pSolidFaces[face++] = cell;
+          }
+          cell++;
+        }
+      }
+    }
+  }
+
+  /**
+   * Splits the interior of the block in cubic tiles and marks all of them
+   * as active.
+   * @tileSize:   cells per side of a tile
+   * @tolerance:  velocity and pressure variation under which a tile is quiet
+   **/
+  void InitializeActiveTiles(const size_t &tileSize, const PrecisionType &tolerance) {
+
+    mTileSize        = tileSize;
+    mActiveTolerance = tolerance;
+
+    mNumTiles[0] = (rX + tileSize - 1) / tileSize;
+    mNumTiles[1] = (rY + tileSize - 1) / tileSize;
+    mNumTiles[2] = (rZ + tileSize - 1) / tileSize;
+
+    size_t numTiles = mNumTiles[0] * mNumTiles[1] * mNumTiles[2];
+
+    pActiveTiles = (bool *)malloc(sizeof(bool) * numTiles);
+    pRawActive   = (bool *)malloc(sizeof(bool) * numTiles);
+    pActiveList  = (size_t *)malloc(sizeof(size_t) * numTiles);
+    pRetiredList = (size_t *)malloc(sizeof(size_t) * numTiles);
+
+    for(size_t t = 0; t < numTiles; t++) {
+      pActiveTiles[t] = true;
+      pActiveList[t]  = t;
+    }
+
+    mNumActive  = numTiles;
+    mNumRetired = 0;
+  }
+
+  /**
+   * Interior cells of a tile
+   * @tile:       index of the tile
+   * @low:        first cell of the tile
+   * @high:       last cell of the tile (not included)
+   **/
+  void GetTileRange(const size_t &tile, size_t * low, size_t * high) {
+
+    size_t t[MAX_DIM] = {
+      tile % mNumTiles[0],
+      (tile / mNumTiles[0]) % mNumTiles[1],
+      tile / (mNumTiles[0] * mNumTiles[1])
+    };
+
+    size_t size[MAX_DIM] = {rX, rY, rZ};
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      low[d]  = rBWP + t[d] * mTileSize;
+      high[d] = std::min(low[d] + mTileSize, size[d] + rBWP);
+    }
+  }
+
+  /**
+   * Updates the active tiles. A tile is active if any cell of the tile or
+   * of its one cell halo has velocity or if the pressure is not constant
+   * over them. Velocity and pressure are reduced in the same pass. Active
+   * tiles are dilated by the distance travelled in dt plus the ghost width,
+   * which covers the departure points of the advection and the stencils.
+   *
+   * Tiles which are not active anymore are stored in pRetiredList.
+   * @dt:         time step
+   * @maxv:       maximum velocity component of the block
+   **/
+  void UpdateActiveTiles(const PrecisionType &dt, PrecisionType &maxv) {
+
+    size_t numTiles = mNumTiles[0] * mNumTiles[1] * mNumTiles[2];
+
+    maxv = 0.0f;
+
+    #pragma omp parallel for reduction(max:maxv) schedule(dynamic)
+    for(size_t t = 0; t < numTiles; t++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+
+      GetTileRange(t,low,high);
+
+      size_t size[MAX_DIM] = {rX, rY, rZ};
+
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        low[d]  = std::max(low[d] - 1, rBWP);
+        high[d] = std::min(high[d] + 1, size[d] + rBWP);
+      }
+
+      PrecisionType tileMaxv = 0.0f;
+      PrecisionType minp = pBuffers[PRESSURE][IndexType::GetIndex(low[0],low[1],low[2],mPaddY,mPaddZ)];
+      PrecisionType maxp = minp;
+
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = IndexType::GetIndex(low[0],j,k,mPaddY,mPaddZ);
+          for(size_t i = low[0]; i < high[0]; i++) {
+            for(size_t d = 0; d < rDim; d++) {
+              tileMaxv = std::max((PrecisionType)fabs(pBuffers[VELOCITY][cell*rDim+d]),tileMaxv);
+            }
+            minp = std::min(pBuffers[PRESSURE][cell],minp);
+            maxp = std::max(pBuffers[PRESSURE][cell],maxp);
+            cell++;
+          }
+        }
+      }
+
+      pRawActive[t] = tileMaxv > mActiveTolerance || maxp - minp > mActiveTolerance;
+
+      maxv = std::max(tileMaxv,maxv);
+    }
+
+    size_t reach  = (size_t)ceil(maxv * dt * rIdx) + rBW;
+    long   radius = (long)((reach + mTileSize - 1) / mTileSize);
+
+    mNumRetired = 0;
+    mNumActive  = 0;
+
+    for(size_t t = 0; t < numTiles; t++) {
+      long tx = t % mNumTiles[0];
+      long ty = (t / mNumTiles[0]) % mNumTiles[1];
+      long tz = t / (mNumTiles[0] * mNumTiles[1]);
+
+      bool active = false;
+
+      for(long z = std::max(tz - radius, 0L); !active && z < std::min(tz + radius + 1, (long)mNumTiles[2]); z++) {
+        for(long y = std::max(ty - radius, 0L); !active && y < std::min(ty + radius + 1, (long)mNumTiles[1]); y++) {
+          for(long x = std::max(tx - radius, 0L); !active && x < std::min(tx + radius + 1, (long)mNumTiles[0]); x++) {
+            active = pRawActive[(z * mNumTiles[1] + y) * mNumTiles[0] + x];
+          }
+        }
+      }
+
+      if(active) {
+        pActiveList[mNumActive++] = t;
+      } else if(pActiveTiles[t]) {
+        pRetiredList[mNumRetired++] = t;
+      }
+
+      pActiveTiles[t] = active;
+    }
+  }
+
+  /**
+   * Marks a cell as SOLID and zeroes all the buffers in it
+   * @cell:     index of the cell
+   **/
+  void setSolid(const size_t &cell) {
+
+    pFlags[cell] |= SOLID;
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      size_t dim = (b == PRESSURE || b == AUX_3D_5 || b == AUX_3D_6 || b == AUX_3D_7) ? 1 : rDim;
+      for(size_t d = 0; d < dim; d++) {
+        pBuffers[b][cell*dim+d] = 0.0f;
+      }
+    }
+  }
+
+  /**
+   * Returns true if an interior cell has a fluid neighbour. Cells of the
+   * padding count as solid
+   * @cell:     index of the cell
+   **/
+  bool isSolidFace(const size_t &cell) {
+
+    size_t i = cell % mPaddY;
+    size_t j = (cell % mPaddZ) / mPaddY;
+    size_t k = cell / mPaddZ;
+
+    return
+      (i > rBWP          && !(pFlags[cell-1]      & SOLID)) ||
+      (i + 1 < rX + rBWP && !(pFlags[cell+1]      & SOLID)) ||
+      (j > rBWP          && !(pFlags[cell-mPaddY] & SOLID)) ||
+      (j + 1 < rY + rBWP && !(pFlags[cell+mPaddY] & SOLID)) ||
+      (k > rBWP          && !(pFlags[cell-mPaddZ] & SOLID)) ||
+      (k + 1 < rZ + rBWP && !(pFlags[cell+mPaddZ] & SOLID));
+  }
+
   /**
    * @phi:        Result of the operation
    * @phi_auxA:   first  operator
@@ -264,6 +783,46 @@ public:
   size_t mPaddE;
   size_t mPaddF;
   size_t mPaddG;
+
+  // Active tiles
+  size_t mTileSize;
+  size_t mNumTiles[MAX_DIM];
+
+  PrecisionType mActiveTolerance;
+
+  bool   * pActiveTiles;
+  bool   * pRawActive;
+  size_t * pActiveList;
+  size_t * pRetiredList;
+
+  size_t mNumActive;
+  size_t mNumRetired;
+
+  // Fixed cells
+  size_t        * pFixedOffset;
+  size_t        * pFixedCells;
+  unsigned char * pFixedMask;
+
+  size_t mNumFixed;
+  size_t mFixedVersion;
+
+  // Runs of fluid cells and solid cells next to the fluid
+  size_t * pRunOffset;
+  size_t * pRunStart;
+  size_t * pRunLength;
+  size_t * pSolidFaces;
+
+  size_t mNumRuns;
+  size_t mNumSolid;
+  size_t mNumSolidFaces;
+  size_t mRunsVersion;
+
+  // Incremented every time the flags change
+  size_t mFlagsVersion;
+
+  // Faces of the block on the border of the domain. All of them unless the
+  // block is a patch of an AdaptiveMesh
+  bool mDomainFace[MAX_FACE];
 };
 
 #endif
@@ -0,0 +1,288 @@
+#ifndef BLOCK_2D_H
+#define BLOCK_2D_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <math.h>
+
+#include "defines.h"
+#include "utils.h"
+#include "topology.h"
+
+/**
+ * Two dimensional block. Same buffers and flags as Block, but the storage
+ * is a single padded plane of (X+BW)*(Y+BW) cells and vector fields have
+ * rDim = 2 components, so a 2D study does not pay for a padded Z extent.
+ * Rows of the plane are distributed between the threads as the slabs of
+ * the 3D blocks (OwnedSlabs).
+ **/
+class Block2D {
+public:
+
+  typedef Indexer IndexType;
+
+  Block2D(
+      PrecisionType ** buffers,
+      uint * Flags,
+      const PrecisionType &Dx,
+      const PrecisionType &Ro,
+      const PrecisionType &Mu,
+      const PrecisionType &Ka,
+      const PrecisionType &CC2,
+      const size_t &BW,
+      const size_t &X, const size_t &Y) :
+    pBuffers(buffers),
+    pFlags(Flags),
+    rDx(Dx),
+    rIdx(1.0/Dx),
+    rRo(Ro),
+    rMu(Mu),
+    rKa(Ka),
+    rCC2(CC2),
+    rBW(BW),
+    rBWP(BW/2),
+    rX(X),
+    rY(Y),
+    rDim(2) {
+
+    mPaddY = (rX+rBW);
+
+    //   B ------- C
+    //   |         |
+    //   |         |
+    //   0 ------- A
+
+    mPaddA = 1;
+    mPaddB = (rX+rBW);
+    mPaddC = (rX+rBW)+1;
+
+    pFixedOffset  = NULL;
+    pFixedCells   = NULL;
+    pFixedMask    = NULL;
+    mNumFixed     = 0;
+  }
+
+  ~Block2D() {
+    if(pFixedOffset != NULL) {
+      free(pFixedOffset);
+      free(pFixedCells);
+      free(pFixedMask);
+    }
+  }
+
+  /**
+   * Zeroes all the buffers, padding included
+   **/
+  void Zero() {
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,0,rY+rBW,jb,je);
+
+      for(size_t b = 0; b < MAX_BUFF; b++) {
+        for(size_t c = jb * mPaddY * rDim; c < je * mPaddY * rDim; c++) {
+          pBuffers[b][c] = 0.0f;
+        }
+      }
+    }
+  }
+
+  void InitializePressure() {
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,0,rY+rBW,jb,je);
+
+      for(size_t j = jb; j < je; j++) {
+        for(size_t i = 0; i < rX + rBW; i++) {
+          pBuffers[PRESSURE][IndexType::GetIndex(i,j,0,mPaddY,0)] = 0.0f;
+        }
+      }
+    }
+  }
+
+  /**
+   * Lid driven cavity: zero velocity except on the first row in y, the
+   * counterpart of the first plane in z of Block::InitializeVelocity
+   * @lid:      velocity of the lid (x component)
+   **/
+  void InitializeVelocity(const PrecisionType &lid = 0.0190f) {
+
+    const size_t update_size = 4;
+    const int toUpdate[update_size] = {VELOCITY,AUX_3D_0,AUX_3D_1,AUX_3D_2};
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,0,rY+rBW,jb,je);
+
+      for(size_t j = jb; j < je; j++) {
+        for(size_t i = 0; i < rX + rBW; i++) {
+          for(size_t b = 0; b < update_size; b++) {
+            for(size_t d = 0; d < rDim; d++) {
+              pBuffers[toUpdate[b]][IndexType::GetIndex(i,j,0,mPaddY,0)*rDim+d] = 0.0f;
+            }
+          }
+        }
+      }
+    }
+
+    for(size_t i = 2; i < rX + rBW - 1; i++)
+      pBuffers[VELOCITY][IndexType::GetIndex(i,1,0,mPaddY,0)*rDim+0] = lid;
+  }
+
+  /**
+   * Flags the cells of the four walls of the cavity as FIXED_VELOCITY
+   **/
+  void InitializeWalls() {
+
+    uint fixed = FIXED_VELOCITY_X | FIXED_VELOCITY_Y;
+
+    for(size_t c = 0; c < (rX + rBW) * (rY + rBW); c++) {
+      pFlags[c] = 0;
+    }
+
+    for(size_t j = rBWP; j < rY + rBWP; j++) {
+      pFlags[IndexType::GetIndex(rBWP,j,0,mPaddY,0)]          |= fixed;
+      pFlags[IndexType::GetIndex(rX + rBWP - 1,j,0,mPaddY,0)] |= fixed;
+    }
+
+    for(size_t i = rBWP; i < rX + rBWP; i++) {
+      pFlags[IndexType::GetIndex(i,rBWP,0,mPaddY,0)]          |= fixed;
+      pFlags[IndexType::GetIndex(i,rY + rBWP - 1,0,mPaddY,0)] |= fixed;
+    }
+  }
+
+  /**
+   * Maximum velocity component of the interior. NaN if any component is
+   * not finite, as in Block::calculateMaxVelocity
+   * @maxv:     maximum velocity component
+   **/
+  void calculateMaxVelocity(PrecisionType &maxv) {
+
+    size_t invalid = 0;
+
+    maxv = 0.0f;
+
+    #pragma omp parallel for reduction(max:maxv) reduction(+:invalid)
+    for(size_t j = rBWP; j < rY + rBWP; j++) {
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        size_t cell = IndexType::GetIndex(i,j,0,mPaddY,0);
+        for(size_t d = 0; d < rDim; d++) {
+          PrecisionType v = fabs(pBuffers[VELOCITY][cell*rDim+d]);
+          maxv = std::max(v,maxv);
+          invalid += !std::isfinite(v);
+        }
+      }
+    }
+
+    if(invalid) {
+      maxv = std::numeric_limits<PrecisionType>::quiet_NaN();
+    }
+  }
+
+  /**
+   * Builds the list of fixed cells of every interior row, the 2D boundary
+   * lists of the stencil solver. The cells of row j are
+   * [pFixedOffset[j], pFixedOffset[j+1]), with the fixed components in
+   * pFixedMask as in Block::BuildFixedLists.
+   **/
+  void BuildFixedLists() {
+
+    if(pFixedOffset != NULL) {
+      free(pFixedOffset);
+      free(pFixedCells);
+      free(pFixedMask);
+    }
+
+    pFixedOffset = (size_t *)malloc(sizeof(size_t) * (rY + rBW + 1));
+
+    size_t count = 0;
+
+    for(size_t j = 0; j < rY + rBW; j++) {
+      pFixedOffset[j] = count;
+
+      if(j < rBWP || j >= rY + rBWP)
+        continue;
+
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        count += fixedMask(IndexType::GetIndex(i,j,0,mPaddY,0)) != 0;
+      }
+    }
+
+    pFixedOffset[rY + rBW] = count;
+
+    mNumFixed   = count;
+    pFixedCells = (size_t *)malloc(sizeof(size_t) * std::max(count,(size_t)1));
+    pFixedMask  = (unsigned char *)malloc(sizeof(unsigned char) * std::max(count,(size_t)1));
+
+    for(size_t j = rBWP; j < rY + rBWP; j++) {
+      size_t b = pFixedOffset[j];
+
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        size_t cell = IndexType::GetIndex(i,j,0,mPaddY,0);
+        unsigned char mask = fixedMask(cell);
+
+        if(mask) {
+          pFixedCells[b] = cell;
+          pFixedMask[b]  = mask;
+          b++;
+        }
+      }
+    }
+  }
+
+  PrecisionType ** pBuffers;
+
+  uint * pFlags;
+
+  const PrecisionType rDx;
+  const PrecisionType rIdx;
+  const PrecisionType rRo;
+  const PrecisionType rMu;
+  const PrecisionType rKa;
+  const PrecisionType rCC2;
+
+  const size_t rBW;
+  const size_t rBWP;
+  const size_t rX;
+  const size_t rY;
+  const size_t rDim;
+
+  size_t mPaddY;
+
+  size_t mPaddA;
+  size_t mPaddB;
+  size_t mPaddC;
+
+  // Fixed cells of every row
+  size_t * pFixedOffset;
+  size_t * pFixedCells;
+  unsigned char * pFixedMask;
+  size_t mNumFixed;
+
+private:
+
+  /**
+   * Fixed components of a cell, in the bits of FIXED_MASK_*
+   * @cell:     index of the cell
+   **/
+  unsigned char fixedMask(const size_t &cell) {
+
+    unsigned char mask = 0;
+
+    if(pFlags[cell] & FIXED_VELOCITY_X) mask |= FIXED_MASK_X;
+    if(pFlags[cell] & FIXED_VELOCITY_Y) mask |= FIXED_MASK_Y;
+    if(pFlags[cell] & FIXED_PRESSURE)   mask |= FIXED_MASK_P;
+
+    return mask;
+  }
+};
+
+#endif
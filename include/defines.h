@@ -43,7 +43,27 @@ enum Flag {
   FIXED_VELOCITY_X = 0x000001,
   FIXED_VELOCITY_Y = 0x000010,
   FIXED_VELOCITY_Z = 0x000100,
-  FIXED_PRESSURE   = 0x001000
+  FIXED_PRESSURE   = 0x001000,
+  SOLID            = 0x010000
+};
+
+// Compact version of Flag, used by the lists of fixed cells of a Block
+enum FixedMask {
+  FIXED_MASK_X     = 0x01,
+  FIXED_MASK_Y     = 0x02,
+  FIXED_MASK_Z     = 0x04,
+  FIXED_MASK_P     = 0x08
+};
+
+// Faces of a block
+enum Face {
+  FACE_X_LOW,
+  FACE_X_HIGH,
+  FACE_Y_LOW,
+  FACE_Y_HIGH,
+  FACE_Z_LOW,
+  FACE_Z_HIGH,
+  MAX_FACE
 };
 
 enum Buffers {
@@ -0,0 +1,397 @@
+#ifndef FIELD_REGISTRY_H
+#define FIELD_REGISTRY_H
+
+#include <string.h>
+#include <cmath>
+
+#include <limits>
+
+#include "defines.h"
+#include "utils.h"
+#include "topology.h"
+
+// Phases of a time step of the explicit solver, in the order they run
+enum StepPhase {
+  STEP_ADVECTION,     // BfeccSolver::Execute
+  STEP_VELOCITY,      // StencilSolver::ExecuteTaskVelocity
+  STEP_DIVERGENCE,    // StencilSolver::ExecuteTaskDivergence
+  STEP_PRESSURE,      // StencilSolver::ExecuteTaskPressure
+  MAX_STEP_PHASE
+};
+
+// Lifetimes of the fields, as masks of the phases where they are live
+const unsigned int LIFETIME_NONE       = 0x0;
+const unsigned int LIFETIME_PERSISTENT = (1u << MAX_STEP_PHASE) - 1;
+
+/**
+ * Lifetime of a field that is live from one phase to another, both included
+ * @first:    first phase that uses the field
+ * @last:     last phase that uses the field
+ **/
+inline unsigned int PhaseRange(const size_t &first, const size_t &last) {
+
+  unsigned int mask = 0;
+
+  for(size_t p = first; p <= last; p++) {
+    mask |= 1u << p;
+  }
+
+  return mask;
+}
+
+/**
+ * Allocates the buffers of a block, each one with the components of its
+ * field instead of the 3 of a vector.
+ *
+ * Scratch fields declare the phases of the step where they hold values.
+ * When aliasing is enabled, fields whose lifetimes do not overlap share
+ * the same storage. Persistent fields always get their own.
+ *
+ * The solvers rely on the ghost cells of the scratch fields being zero,
+ * since they only ever write the interior. Storage that is shared loses
+ * that, so Begin zeroes the ghost cells of the aliased fields whose
+ * lifetime starts in the phase.
+ *
+ * With CHECK_FIELD_LIFETIMES the lifetimes that aliasing relies on are
+ * verified instead: every field gets its own storage, the fields that are
+ * not live in a phase are filled with NaN and Begin fails if any of them
+ * was written since. Values read from a dead field show up as NaN.
+ **/
+class FieldRegistry {
+public:
+
+  /**
+   * Creates an empty registry for the buffers of a block
+   * @X,Y,Z:    size of the block without padding
+   **/
+  FieldRegistry(const size_t &X, const size_t &Y, const size_t &Z) :
+      mMemory(false),
+      mChecked(false),
+      mStarted(false) {
+
+    mSize[0] = X;
+    mSize[1] = Y;
+    mSize[2] = Z;
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      mFields[b].Name       = NULL;
+      mFields[b].Dim        = 0;
+      mFields[b].Lifetime   = LIFETIME_NONE;
+      mFields[b].Slot       = 0;
+      mFields[b].Aliased    = false;
+    }
+
+    mNumSlots = 0;
+  }
+
+  ~FieldRegistry() {
+
+    for(size_t s = 0; s < mNumSlots; s++) {
+      mMemory.ReleaseGrid(&mSlots[s].Data,1);
+    }
+  }
+
+  /**
+   * Declares the field held by a buffer
+   * @buffer:   buffer of the field (Buffers)
+   * @name:     name of the field, for the report
+   * @dim:      components of the field
+   * @lifetime: phases where the field is live (LIFETIME_PERSISTENT, LIFETIME_NONE or PhaseRange)
+   **/
+  void Register(
+      const size_t &buffer,
+      const char * name,
+      const size_t &dim,
+      const unsigned int &lifetime) {
+
+    if(buffer >= MAX_BUFF || mFields[buffer].Name != NULL) {
+      printf("Error: Buffer %zu (%s) is already registered or does not exist.\n",buffer,name);
+      exit(1);
+    }
+
+    mFields[buffer].Name      = name;
+    mFields[buffer].Dim       = dim;
+    mFields[buffer].Lifetime  = lifetime;
+  }
+
+  /**
+   * Allocates the storage of all the registered fields and points the
+   * buffers to it. Fields are placed from the largest to the smallest, each
+   * one in the first storage that is large enough and not used by any other
+   * field in its phases.
+   * @buffers:  buffers of the block
+   * @alias:    share the storage of the scratch fields
+   **/
+  void Allocate(PrecisionType ** buffers, bool alias) {
+
+    size_t order[MAX_BUFF];
+
+#ifdef CHECK_FIELD_LIFETIMES
+    mChecked  = alias;
+    alias     = false;
+#endif
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      if(mFields[b].Name == NULL) {
+        printf("Error: Buffer %zu is not registered.\n",b);
+        exit(1);
+      }
+
+      order[b] = b;
+    }
+
+    for(size_t a = 1; a < MAX_BUFF; a++) {
+      for(size_t b = a; b > 0 && mFields[order[b-1]].Dim < mFields[order[b]].Dim; b--) {
+        std::swap(order[b-1],order[b]);
+      }
+    }
+
+    for(size_t o = 0; o < MAX_BUFF; o++) {
+      FieldInfo &field = mFields[order[o]];
+
+      size_t s = mNumSlots;
+
+      if(alias && field.Lifetime != LIFETIME_PERSISTENT) {
+        for(s = 0; s < mNumSlots; s++) {
+          if(!mSlots[s].Persistent && mSlots[s].Dim >= field.Dim && !(mSlots[s].Lifetime & field.Lifetime)) {
+            break;
+          }
+        }
+      }
+
+      if(s == mNumSlots) {
+        mSlots[s].Dim         = field.Dim;
+        mSlots[s].Lifetime    = LIFETIME_NONE;
+        mSlots[s].Fields      = 0;
+        mSlots[s].Persistent  = field.Lifetime == LIFETIME_PERSISTENT;
+        mNumSlots++;
+      }
+
+      mSlots[s].Lifetime |= field.Lifetime;
+      mSlots[s].Fields++;
+
+      field.Slot = s;
+    }
+
+    for(size_t s = 0; s < mNumSlots; s++) {
+      mMemory.AllocateGrid(&mSlots[s].Data,mSize[0],mSize[1],mSize[2],mSlots[s].Dim,1);
+      FirstTouch(mSlots[s].Data,mSize[0],mSize[1],mSize[2],mSlots[s].Dim);
+    }
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      mFields[b].Aliased = mSlots[mFields[b].Slot].Fields > 1;
+      buffers[b] = mSlots[mFields[b].Slot].Data;
+    }
+  }
+
+  /**
+   * Marks the start of a phase of the step. Zeroes the ghost cells of the
+   * aliased fields that were not live in the previous phase. When the
+   * lifetimes are checked, fails if a field that was not live in the
+   * previous phase has been written and poisons the fields that are not
+   * live in this one.
+   * @phase:    phase that starts (StepPhase)
+   **/
+  void Begin(const size_t &phase) {
+
+    unsigned int current  = 1u << phase;
+    unsigned int previous = 1u << ((phase + MAX_STEP_PHASE - 1) % MAX_STEP_PHASE);
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      const FieldInfo &field = mFields[b];
+
+      if(mChecked && mStarted && field.Lifetime != LIFETIME_PERSISTENT && !(field.Lifetime & previous)) {
+        if(!isPoisoned(mSlots[field.Slot].Data,field.Dim)) {
+          printf("Error: Field %s was written outside its lifetime, before phase %zu.\n",field.Name,phase);
+          exit(1);
+        }
+      }
+    }
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      const FieldInfo &field = mFields[b];
+
+      if((field.Aliased || mChecked) && (field.Lifetime & current) && !(field.Lifetime & previous)) {
+        zeroGhosts(mSlots[field.Slot].Data,field.Dim);
+      }
+
+      if(mChecked && field.Lifetime != LIFETIME_PERSISTENT && !(field.Lifetime & current)) {
+        if(!mStarted || (field.Lifetime & previous)) {
+          poison(mSlots[field.Slot].Data,field.Dim);
+        }
+      }
+    }
+
+    mStarted = true;
+  }
+
+  /**
+   * Bytes of the storage of the fields
+   **/
+  size_t GetBytes() {
+
+    size_t bytes = 0;
+
+    for(size_t s = 0; s < mNumSlots; s++) {
+      bytes += gridBytes(mSlots[s].Dim);
+    }
+
+    return bytes;
+  }
+
+  /**
+   * Bytes of the same buffers with 3 components each and no aliasing
+   **/
+  size_t GetUnmanagedBytes() {
+    return gridBytes(MAX_DIM) * MAX_BUFF;
+  }
+
+  /**
+   * Prints the storage of every field and the footprint of the registry
+   **/
+  void Report() {
+
+    printf("Fields:\n");
+
+    for(size_t b = 0; b < MAX_BUFF; b++) {
+      const FieldInfo &field = mFields[b];
+
+      printf("  %-10s %zu components, storage %zu%s\n",
+        field.Name,
+        field.Dim,
+        field.Slot,
+        field.Aliased ? " (aliased)" : "");
+    }
+
+    if(mChecked) {
+      printf("Field lifetimes are checked, the storage is not shared\n");
+    }
+
+    printf("Field storage: %zu MB in %zu buffers, %zu MB with %d buffers of %zu components\n",
+      GetBytes() >> 20,
+      mNumSlots,
+      GetUnmanagedBytes() >> 20,
+      MAX_BUFF,
+      MAX_DIM);
+  }
+
+private:
+
+  struct FieldInfo {
+    const char * Name;
+    size_t Dim;
+    unsigned int Lifetime;
+    size_t Slot;
+    bool Aliased;
+  };
+
+  struct SlotInfo {
+    PrecisionType * Data;
+    size_t Dim;
+    unsigned int Lifetime;
+    size_t Fields;
+    bool Persistent;
+  };
+
+  size_t gridBytes(const size_t &dim) {
+    return (mSize[0]+BW) * (mSize[1]+BW) * (mSize[2]+BW) * dim * sizeof(PrecisionType);
+  }
+
+  /**
+   * Zeroes the ghost cells of a field: the ghost planes entirely and both
+   * ends of the rows of the interior planes
+   * @buff:     field
+   * @dim:      components of the field
+   **/
+  void zeroGhosts(PrecisionType * buff, const size_t &dim) {
+
+    const size_t pitch = (mSize[0]+BW) * dim;
+    const size_t slice = (mSize[1]+BW) * pitch;
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(mSize[2],0,mSize[2]+BW,kb,ke);
+
+      for(size_t k = kb; k < ke; k++) {
+        if(k < BWP || k >= mSize[2] + BWP) {
+          memset(&buff[k*slice],0,sizeof(PrecisionType) * slice);
+          continue;
+        }
+
+        for(size_t j = 0; j < mSize[1] + BW; j++) {
+          PrecisionType * row = &buff[k*slice+j*pitch];
+
+          if(j < BWP || j >= mSize[1] + BWP) {
+            memset(row,0,sizeof(PrecisionType) * pitch);
+          } else {
+            memset(row,0,sizeof(PrecisionType) * BWP * dim);
+            memset(&row[(mSize[0] + BWP) * dim],0,sizeof(PrecisionType) * (BW - BWP) * dim);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Fills a field with NaN
+   * @buff:     field
+   * @dim:      components of the field
+   **/
+  void poison(PrecisionType * buff, const size_t &dim) {
+
+    const size_t slab = (mSize[0]+BW) * (mSize[1]+BW) * dim;
+    const PrecisionType nan = std::numeric_limits<PrecisionType>::quiet_NaN();
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(mSize[2],0,mSize[2]+BW,kb,ke);
+
+      for(size_t c = kb * slab; c < ke * slab; c++) {
+        buff[c] = nan;
+      }
+    }
+  }
+
+  /**
+   * Tells if a field still holds the NaN of poison everywhere
+   * @buff:     field
+   * @dim:      components of the field
+   **/
+  bool isPoisoned(PrecisionType * buff, const size_t &dim) {
+
+    const size_t slab = (mSize[0]+BW) * (mSize[1]+BW) * dim;
+
+    size_t written = 0;
+
+    #pragma omp parallel reduction(+:written)
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(mSize[2],0,mSize[2]+BW,kb,ke);
+
+      for(size_t c = kb * slab; c < ke * slab; c++) {
+        written += !std::isnan(buff[c]);
+      }
+    }
+
+    return written == 0;
+  }
+
+  MemManager mMemory;
+
+  bool mChecked;
+  bool mStarted;
+
+  size_t mSize[3];
+
+  FieldInfo mFields[MAX_BUFF];
+
+  SlotInfo mSlots[MAX_BUFF];
+  size_t mNumSlots;
+};
+
+#endif
@@ -2,16 +2,43 @@
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <vector>
 
 #include "hacks.h"
 
 // GiD IO
 #include "gidpost/source/gidpost.h"
 
+/**
+ * Box of cells written by the FileIO writers, in the coordinates of the
+ * padded grid, and the distance between the written cells in every
+ * direction. Boxes larger than the grid are clipped by the writers.
+ **/
+struct OutputRegion {
+  size_t Low[3];      // First cell
+  size_t High[3];     // Last cell + 1
+  size_t Stride;      // Cells between written cells
+};
+
 class FileIO {
 
 private:
 
+  /**
+   * Field written by WriteResults
+   **/
+  struct OutputField {
+    PrecisionType * Grid;
+    size_t Dim;
+    const char * Name;
+    OutputRegion Region;
+  };
+
+  std::vector<OutputField> mResults;
+
+  OutputRegion mRegion;
+  bool mHasRegion;
+
   std::stringstream name_mesh;
   std::stringstream name_post;
   std::stringstream name_raw;
@@ -44,10 +71,65 @@ private:
     (*post_file) << "GiD Post Results File 1.0" << std::endl << std::endl;
   }
 
+  /**
+   * Region to write for a grid: the one given clipped to the grid, or the
+   * whole padded grid if none is given
+   * @region:   region or NULL
+   * @X:        X-Size of the grid
+   * @Y:        Y-Size of the grid
+   * @Z:        Z-Size of the grid
+   **/
+  OutputRegion clipRegion(
+      const OutputRegion * region,
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z) {
+
+    OutputRegion clip = PaddedRegion(X,Y,Z,1);
+
+    if(region != NULL) {
+      for(size_t d = 0; d < 3; d++) {
+        clip.Low[d]  = std::min(region->Low[d],clip.High[d]);
+        clip.High[d] = std::max(std::min(region->High[d],clip.High[d]),clip.Low[d]);
+      }
+
+      clip.Stride = std::max(region->Stride,(size_t)1);
+    }
+
+    return clip;
+  }
+
+  /**
+   * Checks that the mesh and every result use the same region, since the
+   * results are the values of the nodes of the only mesh of the post file
+   * @region:   region of the mesh or the result
+   * @name:     name of the mesh or the result
+   **/
+  void useRegion(const OutputRegion &region, const char * name) {
+
+    if(!mHasRegion) {
+      mRegion     = region;
+      mHasRegion  = true;
+      return;
+    }
+
+    bool same = region.Stride == mRegion.Stride;
+
+    for(size_t d = 0; d < 3; d++) {
+      same = same && region.Low[d] == mRegion.Low[d] && region.High[d] == mRegion.High[d];
+    }
+
+    if(!same) {
+      printf("Error: Output of %s on a region different from the one of the mesh.\n",name);
+      exit(1);
+    }
+  }
+
 public:
 
   // Creator & destructor
-  FileIO(const char * name, const size_t &N) {
+  FileIO(const char * name, const size_t &N) :
+      mHasRegion(false) {
 
     SetMeshName(name,N);
     setPostName(name,N);
@@ -73,6 +155,108 @@ public:
     delete post_file;
   };
 
+  /**
+   * Region of the whole grid, padding included
+   * @X:        X-Size of the grid
+   * @Y:        Y-Size of the grid
+   * @Z:        Z-Size of the grid
+   * @stride:   cells between written cells
+   **/
+  static OutputRegion PaddedRegion(
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z,
+      const size_t &stride) {
+
+    OutputRegion region = {{0, 0, 0}, {X + BW, Y + BW, Z + BW}, stride};
+
+    return region;
+  }
+
+  /**
+   * Region of the interior cells of the grid, without the padding
+   * @X:        X-Size of the grid
+   * @Y:        Y-Size of the grid
+   * @Z:        Z-Size of the grid
+   * @stride:   cells between written cells
+   **/
+  static OutputRegion InteriorRegion(
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z,
+      const size_t &stride) {
+
+    OutputRegion region = {{BWP, BWP, BWP}, {X + BWP, Y + BWP, Z + BWP}, stride};
+
+    return region;
+  }
+
+  /**
+   * Region of a box of cells of the grid
+   * @low:      first cell of the box
+   * @high:     last cell of the box + 1
+   * @stride:   cells between written cells
+   **/
+  static OutputRegion BoxRegion(
+      const size_t * low,
+      const size_t * high,
+      const size_t &stride) {
+
+    OutputRegion region = {{low[0], low[1], low[2]}, {high[0], high[1], high[2]}, stride};
+
+    return region;
+  }
+
+  /**
+   * Selects a field to be written by WriteResults. All the fields and the
+   * mesh are written on the same region.
+   * @grid:     Value of the grid
+   * @dim:      components of the field (1 or 3)
+   * @name:     name of the result
+   * @region:   cells of the grid that are written
+   **/
+  void AddResult(
+      PrecisionType * grid,
+      const size_t &dim,
+      const char * name,
+      const OutputRegion &region) {
+
+    if(region.Stride < 1) {
+      printf("Error: Output of %s with a stride of 0.\n",name);
+      exit(1);
+    }
+
+    useRegion(region,name);
+
+    OutputField field = {grid, dim, name, region};
+
+    mResults.push_back(field);
+  }
+
+  /**
+   * Writes the fields selected with AddResult in GiD format
+   * @X:        X-Size of the grid
+   * @Y:        Y-Size of the grid
+   * @Z:        Z-Size of the grid
+   * @step:     Step of the result
+   **/
+  void WriteResults(
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z,
+      const int &step) {
+
+    for(size_t f = 0; f < mResults.size(); f++) {
+      const OutputField &field = mResults[f];
+
+      if(field.Dim == 1) {
+        WriteGidResultsBin1D(field.Grid,X,Y,Z,step,field.Name,&field.Region);
+      } else {
+        WriteGidResultsBin3D(field.Grid,X,Y,Z,step,field.Dim,field.Name,&field.Region);
+      }
+    }
+  }
+
   // void ReadModelPart(
   //     const MemManager & memmrg,
   //     ) {
@@ -335,6 +519,76 @@ public:
     GiD_EndMesh();
   }
 
+  /**
+   * Writes the nodes of a region of the grid in GiD format, with the same
+   * numbering as WriteGidMeshBin. Elements join consecutive nodes of the
+   * region, so a decimated region gives a coarser mesh.
+   * @X:        X-Size of the grid
+   * @Y:        Y-Size of the grid
+   * @Z:        Z-Size of the grid
+   * @region:   cells of the grid that are written
+   **/
+  void WriteGidMeshBin(
+      const PrecisionType &Dx,
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z,
+      const OutputRegion &region) {
+
+    useRegion(region,name_raw.str().c_str());
+
+    OutputRegion r = clipRegion(&region,X,Y,Z);
+
+    const size_t s = r.Stride;
+
+    const size_t pitch = X + BW;
+    const size_t slice = (Y + BW) * pitch;
+
+    int elemi[8];
+
+    GiD_BeginMesh(name_raw.str().c_str(), GiD_3D, GiD_Hexahedra, 8);
+
+    GiD_BeginCoordinates();
+    for(size_t k = r.Low[2]; k < r.High[2]; k += s) {
+      for(size_t j = r.Low[1]; j < r.High[1]; j += s) {
+        for(size_t i = r.Low[0]; i < r.High[0]; i += s) {
+          GiD_WriteCoordinates(
+            (int)(k*slice+j*pitch+i+1),
+            (PrecisionType)1.0f-i*Dx,
+            (PrecisionType)1.0f-j*Dx,
+            (PrecisionType)1.0f-k*Dx
+          );
+        }
+      }
+    }
+    GiD_EndCoordinates();
+
+    GiD_BeginElements();
+    for(size_t k = r.Low[2]; k + s < r.High[2]; k += s) {
+      for(size_t j = r.Low[1]; j + s < r.High[1]; j += s) {
+        for(size_t i = r.Low[0]; i + s < r.High[0]; i += s) {
+          size_t cell = k*slice+j*pitch+i+1;
+
+          elemi[0] = (int)(cell);
+          elemi[1] = (int)(cell+s);
+          elemi[2] = (int)(cell+s+s*pitch);
+          elemi[3] = (int)(cell+s*pitch);
+          elemi[4] = (int)(cell+s*slice);
+          elemi[5] = (int)(cell+s+s*slice);
+          elemi[6] = (int)(cell+s+s*slice+s*pitch);
+          elemi[7] = (int)(cell+s*slice+s*pitch);
+
+          GiD_WriteElement(
+            (int)cell,
+            elemi);
+        }
+      }
+    }
+
+    GiD_EndElements();
+    GiD_EndMesh();
+  }
+
   /**
    * Writes the results in GiD format.
    * @grid:     Value of the grid in Local or Global coordinatr system
@@ -342,6 +596,7 @@ public:
    * @Y:        Y-Size of the grid
    * @Z:        Z-Size of the grid
    * @step:     Step of the result
+   * @region:   cells of the grid that are written (whole padded grid if NULL)
    **/
   void WriteGidResultsBin1D(
       PrecisionType * grid,
@@ -349,13 +604,16 @@ public:
       const size_t &Y,
       const size_t &Z,
       const int step,
-      const char * name) {
+      const char * name,
+      const OutputRegion * region = NULL) {
+
+    OutputRegion r = clipRegion(region,X,Y,Z);
 
     GiD_BeginResult(name, "Static", step, GiD_Scalar, GiD_OnNodes, NULL, NULL, 0, NULL);
-    for(size_t k = 0; k < Z + BW; k++) {
-      for(size_t j = 0; j < Y + BW; j++) {
-        for(size_t i = 0; i < X + BW; i++) {
-          size_t celln = k*(Z+BW)*(Y+BW)+j*(Y+BW)+i;
+    for(size_t k = r.Low[2]; k < r.High[2]; k += r.Stride) {
+      for(size_t j = r.Low[1]; j < r.High[1]; j += r.Stride) {
+        for(size_t i = r.Low[0]; i < r.High[0]; i += r.Stride) {
+          size_t celln = k*(Y+BW)*(X+BW)+j*(X+BW)+i;
           size_t cell = celln; //interleave64(i,j,k);
 
           GiD_WriteScalar(
@@ -375,6 +633,7 @@ public:
    * @Y:        Y-Size of the grid
    * @Z:        Z-Size of the grid
    * @step:     Step of the result
+   * @region:   cells of the grid that are written (whole padded grid if NULL)
    **/
   void WriteGidResultsBin3D(
       PrecisionType * grid,
@@ -383,7 +642,10 @@ public:
       const size_t &Z,
       const int &step,
       const size_t &dim,
-      const char * name) {
+      const char * name,
+      const OutputRegion * region = NULL) {
+
+    OutputRegion r = clipRegion(region,X,Y,Z);
 
     GiD_BeginResult(
       name,
@@ -396,10 +658,10 @@ public:
       0,
       NULL);
 
-    for(size_t k = 0; k < Z + BW; k++) {
-      for(size_t j = 0; j < Y + BW; j++) {
-        for(size_t i = 0; i < X + BW; i++) {
-          size_t celln = k*(Z+BW)*(Y+BW)+j*(Y+BW)+i;
+    for(size_t k = r.Low[2]; k < r.High[2]; k += r.Stride) {
+      for(size_t j = r.Low[1]; j < r.High[1]; j += r.Stride) {
+        for(size_t i = r.Low[0]; i < r.High[0]; i += r.Stride) {
+          size_t celln = k*(Y+BW)*(X+BW)+j*(X+BW)+i;
           size_t cell = celln; //interleave64(i,j,k);
 
           GiD_WriteVector(
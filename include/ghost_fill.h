@@ -0,0 +1,231 @@
+#ifndef GHOST_FILL_H
+#define GHOST_FILL_H
+
+#include <string.h>
+
+#include "defines.h"
+#include "block.h"
+#include "block_2d.h"
+#include "topology.h"
+
+/**
+ * Fills the ghost cells (faces, edges and corners) of a field of a block.
+ *
+ * Every ghost cell takes the value of one interior cell, found by mapping
+ * each of its coordinates independently: to the adjacent interior layer
+ * (homogeneous Neumann) or to the opposite side of the block (periodic).
+ * Since the sources are always interior cells, the ghosts do not depend on
+ * each other and all of them are filled in a single pass without barriers.
+ *
+ * The pass goes row by row, in the order of the memory. Ghost rows and
+ * ghost planes are copied as whole contiguous rows, and the interior rows
+ * only write their two ends, so no face is walked with the stride of a row
+ * or a plane.
+ *
+ * A ghost cell only reads the slab its k coordinate maps to, so the ghosts
+ * can be filled by the threads of a kernel right after their own slabs,
+ * without waiting for the rest (see FillOwned).
+ *
+ * The plane of a Block2D is filled the same way, with its rows in place of
+ * the slabs.
+ **/
+class GhostFill {
+public:
+
+  /**
+   * Creates the engine for a block, with Neumann ghosts in all directions
+   * @block:    block
+   **/
+  GhostFill(Block * block) :
+      mPitch(block->mPaddY),
+      mSlice(block->mPaddZ),
+      mAxis(2) {
+
+    mSize[0] = block->rX;
+    mSize[1] = block->rY;
+    mSize[2] = block->rZ;
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      mPeriodic[d] = false;
+    }
+  }
+
+  /**
+   * Creates the engine for a 2D block, with Neumann ghosts in all directions
+   * @block:    block
+   **/
+  GhostFill(Block2D * block) :
+      mPitch(block->mPaddY),
+      mSlice(0),
+      mAxis(1) {
+
+    mSize[0] = block->rX;
+    mSize[1] = block->rY;
+    mSize[2] = 1;
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      mPeriodic[d] = false;
+    }
+  }
+
+  ~GhostFill() {
+  }
+
+  /**
+   * Sets the ghosts of a direction to wrap around the block
+   * @axis:     direction (0: x, 1: y, 2: z)
+   * @periodic: true for periodic, false for Neumann
+   **/
+  void SetPeriodic(const size_t &axis, const bool &periodic) {
+    mPeriodic[axis] = periodic;
+  }
+
+  bool IsPeriodic(const size_t &axis) {
+    return mPeriodic[axis];
+  }
+
+  /**
+   * Fills all the ghost cells of a field in one parallel region
+   * @buff:     field
+   * @dim:      components of the field
+   **/
+  void Fill(PrecisionType * buff, const size_t &dim) {
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(mSize[mAxis],BWP,mSize[mAxis]+BWP,kb,ke);
+
+      FillOwned(buff,dim,kb,ke);
+    }
+  }
+
+  /**
+   * Fills the ghost cells whose source is in the interior slabs [kb, ke):
+   * the ghosts of those slabs and the rows of the ghost planes that map to
+   * them. Called by every thread of a parallel region with its own slabs,
+   * after updating them, fills all the ghosts without a barrier. The slabs
+   * of the threads must cover the interior of the block without overlap.
+   * In a 2D block the slabs are rows
+   * @buff:     field
+   * @dim:      components of the field
+   * @kb,ke:    slabs of the thread
+   **/
+  void FillOwned(PrecisionType * buff, const size_t &dim, const size_t &kb, const size_t &ke) {
+
+    const size_t &n = mSize[mAxis];
+
+    size_t begin = std::max(kb,(size_t)BWP);
+    size_t end   = std::min(ke,n + BWP);
+
+    for(size_t k = 0; k < BWP; k++) {
+      size_t src = Source(k,mAxis);
+      if(src >= begin && src < end) {
+        fillLayer(buff,dim,k);
+      }
+    }
+
+    for(size_t k = begin; k < end; k++) {
+      fillLayer(buff,dim,k);
+    }
+
+    for(size_t k = n + BWP; k < n + BW; k++) {
+      size_t src = Source(k,mAxis);
+      if(src >= begin && src < end) {
+        fillLayer(buff,dim,k);
+      }
+    }
+  }
+
+  /**
+   * Interior coordinate a padded coordinate takes its value from
+   * @i:        padded coordinate
+   * @axis:     direction
+   **/
+  inline size_t Source(const size_t &i, const size_t &axis) {
+
+    const size_t &n = mSize[axis];
+
+    if(i < BWP)
+      return mPeriodic[axis] ? i + n : BWP;
+    if(i >= n + BWP)
+      return mPeriodic[axis] ? i - n : n + BWP - 1;
+
+    return i;
+  }
+
+private:
+
+  /**
+   * Fills the ghost cells of the slab k, or of the row k in a 2D block
+   * @buff:     field
+   * @dim:      components of the field
+   * @k:        slab or row
+   **/
+  void fillLayer(PrecisionType * buff, const size_t &dim, const size_t &k) {
+
+    if(mAxis == 1) {
+      fillRow(buff,dim,k,0,0);
+      return;
+    }
+
+    size_t sk = Source(k,2);
+
+    for(size_t j = 0; j < mSize[1] + BW; j++) {
+      fillRow(buff,dim,j,k,sk);
+    }
+  }
+
+  /**
+   * Fills the ghost cells of the row (j,k) from the row (Source(j),sk)
+   * @buff:     field
+   * @dim:      components of the field
+   * @j,k:      row
+   * @sk:       slab of the source row
+   **/
+  inline void fillRow(
+      PrecisionType * buff,
+      const size_t &dim,
+      const size_t &j,
+      const size_t &k,
+      const size_t &sk) {
+
+    const size_t &X = mSize[0];
+
+    size_t sj = Source(j,1);
+
+    size_t row = IndexType::GetIndex(0,j,k,mPitch,mSlice) * dim;
+    size_t src = IndexType::GetIndex(0,sj,sk,mPitch,mSlice) * dim;
+
+    // Ghost row: the interior of the source row in one copy
+    if(src != row) {
+      memcpy(&buff[row + BWP*dim],&buff[src + BWP*dim],sizeof(PrecisionType) * X * dim);
+    }
+
+    for(size_t i = 0; i < BWP; i++) {
+      for(size_t d = 0; d < dim; d++) {
+        buff[row + i*dim + d] = buff[src + Source(i,0)*dim + d];
+      }
+    }
+
+    for(size_t i = X + BWP; i < X + BW; i++) {
+      for(size_t d = 0; d < dim; d++) {
+        buff[row + i*dim + d] = buff[src + Source(i,0)*dim + d];
+      }
+    }
+  }
+
+  typedef Block::IndexType IndexType;
+
+  size_t mSize[MAX_DIM];
+  size_t mPitch;
+  size_t mSlice;
+
+  // Direction of the slabs: z, or y in a 2D block
+  size_t mAxis;
+
+  bool   mPeriodic[MAX_DIM];
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "defines.h"
+#include "block.h"
+
+/**
+ * Sizes and strides of the padded grid of a block, read from the block at
+ * run time. Kernels templated on the grid type use the members of this
+ * struct or the constants of StaticGrid with the same names.
+ * @X,Y,Z:    cells of the block
+ * @Pitch:    stride between rows (j)
+ * @Slice:    stride between planes (k)
+ * @Dim:      components of the vector fields
+ **/
+struct DynamicGrid {
+
+  DynamicGrid(Block * block) :
+    X(block->rX),
+    Y(block->rY),
+    Z(block->rZ),
+    Pitch(block->mPaddY),
+    Slice(block->mPaddZ),
+    Dim(block->rDim) {
+  }
+
+  const size_t X;
+  const size_t Y;
+  const size_t Z;
+  const size_t Pitch;
+  const size_t Slice;
+  const size_t Dim;
+};
+
+/**
+ * Sizes and strides of a cubic padded grid known at compile time, so the
+ * compiler can fold the index arithmetic of the kernels.
+ * @N:        cells per side
+ * @DIM:      components of the vector fields
+ **/
+template<size_t N, size_t DIM = 3>
+struct StaticGrid {
+
+  static const size_t X     = N;
+  static const size_t Y     = N;
+  static const size_t Z     = N;
+  static const size_t Pitch = N + BW;
+  static const size_t Slice = (N + BW) * (N + BW);
+  static const size_t Dim   = DIM;
+};
+
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::X;
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::Y;
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::Z;
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::Pitch;
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::Slice;
+template<size_t N, size_t DIM> const size_t StaticGrid<N,DIM>::Dim;
+
+/**
+ * Calls a function templated on the grid type with the StaticGrid that
+ * matches the block (-DUSE_STATIC_GRID, cubic blocks of 64, 128, 256 or 512
+ * cells with 3 components) or with its DynamicGrid otherwise. The grid is
+ * passed as the first argument.
+ * @_BLOCK_:  block
+ * @_FUNC_:   function to call
+ **/
+#ifdef USE_STATIC_GRID
+#define DISPATCH_GRID(_BLOCK_,_FUNC_,...)                                         \
+switch(                                                                           \
+    (_BLOCK_)->rX == (_BLOCK_)->rY &&                                             \
+    (_BLOCK_)->rX == (_BLOCK_)->rZ &&                                             \
+    (_BLOCK_)->rDim == 3 ? (_BLOCK_)->rX : 0) {                                   \
+  case 64:  _FUNC_(StaticGrid<64>(),  ##__VA_ARGS__); break;                      \
+  case 128: _FUNC_(StaticGrid<128>(), ##__VA_ARGS__); break;                      \
+  case 256: _FUNC_(StaticGrid<256>(), ##__VA_ARGS__); break;                      \
+  case 512: _FUNC_(StaticGrid<512>(), ##__VA_ARGS__); break;                      \
+  default:  _FUNC_(DynamicGrid(_BLOCK_), ##__VA_ARGS__); break;                   \
+}
+#else
+#define DISPATCH_GRID(_BLOCK_,_FUNC_,...)                                         \
+_FUNC_(DynamicGrid(_BLOCK_), ##__VA_ARGS__);
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #define INTERPOLATOR_H
 
 #include "defines.h"
+#include "grid.h"
+#include "block_2d.h"
 
 // "The beast"
 
@@ -24,9 +26,173 @@ public:
 class TrilinealInterpolator : public Interpolator {
 public:
 
+  /**
+   * Cells needed below and above the base cell of a point. Points within
+   * this distance of the padded block must be clamped.
+   **/
+  static const size_t StencilLow  = 0;
+  static const size_t StencilHigh = 1;
+
+  /**
+   * Corners and weights of an interpolation point. They only depend on the
+   * coordinates, so they can be reused to interpolate several fields.
+   **/
+  struct WeightsType {
+    size_t Index[8];
+    PrecisionType Weight[8];
+  };
+
   TrilinealInterpolator() {}
   ~TrilinealInterpolator() {}
 
+  /**
+   * Calculates the corners and weights of a point. Corners are found by
+   * adding the precalculated offsets of the block to the base cell.
+   * @Clamp:    clamp the point to the block. Can only be disabled if the
+   *            point is known to be inside the block
+   * @block:    block
+   * @Coords:   coordinates of the point (Will be clamped and moved to local)
+   * @Weights:  result
+   **/
+  template<bool Clamp>
+  static void CalculateWeights(
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    CalculateWeights<Clamp>(DynamicGrid(block),block,Coords,Weights);
+  }
+
+  /**
+   * Same as above, with the sizes and strides of the grid of the block
+   * @grid:     grid of the block (DynamicGrid or StaticGrid)
+   **/
+  template<bool Clamp, class GridType>
+  static void CalculateWeights(
+      const GridType & grid,
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    Utils::GlobalToLocal(Coords,block->rIdx,MAX_DIM);
+
+    if(Clamp) {
+      PrecisionType limit[MAX_DIM] = {
+        (PrecisionType)(grid.X + BW - 2),
+        (PrecisionType)(grid.Y + BW - 2),
+        (PrecisionType)(grid.Z + BW - 2)
+      };
+
+      for(size_t i = 0; i < MAX_DIM; i++) {
+        Coords[i] = Coords[i] < 0.0f ? 0.0f : Coords[i] > limit[i] ? limit[i] : Coords[i];
+      }
+    }
+
+    size_t pi = (size_t)(Coords[0]);
+    size_t pj = (size_t)(Coords[1]);
+    size_t pk = (size_t)(Coords[2]);
+
+    PrecisionType Nx, Ny, Nz;
+
+    Nx = 1-(Coords[0] - pi);
+    Ny = 1-(Coords[1] - pj);
+    Nz = 1-(Coords[2] - pk);
+
+    size_t base = IndexType::GetIndex(pi,pj,pk,grid.Pitch,grid.Slice);
+
+    Weights.Index[0] = base;
+    Weights.Index[1] = base + 1;
+    Weights.Index[2] = base + grid.Pitch;
+    Weights.Index[3] = base + grid.Pitch + 1;
+    Weights.Index[4] = base + grid.Slice;
+    Weights.Index[5] = base + grid.Slice + 1;
+    Weights.Index[6] = base + grid.Slice + grid.Pitch;
+    Weights.Index[7] = base + grid.Slice + grid.Pitch + 1;
+
+    Weights.Weight[0] = (    Nx) * (    Ny) * (    Nz);
+    Weights.Weight[1] = (1 - Nx) * (    Ny) * (    Nz);
+    Weights.Weight[2] = (    Nx) * (1 - Ny) * (    Nz);
+    Weights.Weight[3] = (1 - Nx) * (1 - Ny) * (    Nz);
+    Weights.Weight[4] = (    Nx) * (    Ny) * (1 - Nz);
+    Weights.Weight[5] = (1 - Nx) * (    Ny) * (1 - Nz);
+    Weights.Weight[6] = (    Nx) * (1 - Ny) * (1 - Nz);
+    Weights.Weight[7] = (1 - Nx) * (1 - Ny) * (1 - Nz);
+  }
+
+  static void CalculateWeights(
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    CalculateWeights<true>(block,Coords,Weights);
+  }
+
+  /**
+   * Interpolates a field using precalculated weights
+   * @Dim:      number of components of the field
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  corners and weights of the point
+   **/
+  template<size_t Dim>
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights) {
+
+    for(size_t d = 0; d < Dim; d++) {
+      *(NewPhi+d) = (
+        OldPhi[Weights.Index[0]*Dim+d] * Weights.Weight[0] +
+        OldPhi[Weights.Index[1]*Dim+d] * Weights.Weight[1] +
+        OldPhi[Weights.Index[2]*Dim+d] * Weights.Weight[2] +
+        OldPhi[Weights.Index[3]*Dim+d] * Weights.Weight[3] +
+        OldPhi[Weights.Index[4]*Dim+d] * Weights.Weight[4] +
+        OldPhi[Weights.Index[5]*Dim+d] * Weights.Weight[5] +
+        OldPhi[Weights.Index[6]*Dim+d] * Weights.Weight[6] +
+        OldPhi[Weights.Index[7]*Dim+d] * Weights.Weight[7]
+      );
+    }
+  }
+
+  /**
+   * Interpolates a field using precalculated weights
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  corners and weights of the point
+   * @Dim:      number of components of the field
+   **/
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights,
+      const size_t &Dim) {
+
+    switch(Dim) {
+      case 1: Apply<1>(OldPhi,NewPhi,Weights); break;
+      case 3: Apply<3>(OldPhi,NewPhi,Weights); break;
+      default:
+        for(size_t d = 0; d < Dim; d++) {
+          *(NewPhi+d) = 0.0f;
+          for(size_t c = 0; c < 8; c++) {
+            *(NewPhi+d) += OldPhi[Weights.Index[c]*Dim+d] * Weights.Weight[c];
+          }
+        }
+    }
+  }
+
+  template<size_t Dim, bool Clamp>
+  static void Interpolate(
+      Block * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords) {
+
+    WeightsType Weights;
+
+    CalculateWeights<Clamp>(block,Coords,Weights);
+    Apply<Dim>(OldPhi,NewPhi,Weights);
+  }
+
   static void Interpolate(
       Block * block,
       PrecisionType * OldPhi,
@@ -34,40 +200,493 @@ public:
       PrecisionType * Coords,
       const size_t &Dim) {
 
-    uint pi,pj,pk,ni,nj,nk;
+    WeightsType Weights;
+
+    CalculateWeights<true>(block,Coords,Weights);
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+  /**
+   * Interpolates a vector field at a batch of points stored as separate
+   * arrays of coordinates. Points are always clamped to the block. The
+   * weights are calculated and applied in the same loop, which the compiler
+   * vectorizes over the points of the batch with gathers for the corners.
+   * @grid:     grid of the block (DynamicGrid or StaticGrid)
+   * @block:    block
+   * @Phi:      field to interpolate (3 components)
+   * @X,Y,Z:    global coordinates of the points
+   * @U,V,W:    components of the result
+   * @count:    number of points
+   **/
+  template<class GridType>
+  static void InterpolateBatch(
+      const GridType & grid,
+      Block * block,
+      const PrecisionType * Phi,
+      const PrecisionType * X,
+      const PrecisionType * Y,
+      const PrecisionType * Z,
+      PrecisionType * U,
+      PrecisionType * V,
+      PrecisionType * W,
+      const size_t &count) {
+
+    const PrecisionType idx = block->rIdx;
+
+    const PrecisionType limitX = (PrecisionType)(grid.X + BW - 2);
+    const PrecisionType limitY = (PrecisionType)(grid.Y + BW - 2);
+    const PrecisionType limitZ = (PrecisionType)(grid.Z + BW - 2);
+
+    #pragma omp simd
+    for(size_t p = 0; p < count; p++) {
+      PrecisionType cx = X[p] * idx;
+      PrecisionType cy = Y[p] * idx;
+      PrecisionType cz = Z[p] * idx;
+
+      cx = cx < 0.0f ? 0.0f : cx > limitX ? limitX : cx;
+      cy = cy < 0.0f ? 0.0f : cy > limitY ? limitY : cy;
+      cz = cz < 0.0f ? 0.0f : cz > limitZ ? limitZ : cz;
+
+      size_t pi = (size_t)(cx);
+      size_t pj = (size_t)(cy);
+      size_t pk = (size_t)(cz);
+
+      PrecisionType Nx = 1-(cx - pi);
+      PrecisionType Ny = 1-(cy - pj);
+      PrecisionType Nz = 1-(cz - pk);
+
+      size_t base = IndexType::GetIndex(pi,pj,pk,grid.Pitch,grid.Slice);
+
+      size_t c0 = (base                           ) * 3;
+      size_t c1 = (base                        + 1) * 3;
+      size_t c2 = (base + grid.Pitch              ) * 3;
+      size_t c3 = (base + grid.Pitch           + 1) * 3;
+      size_t c4 = (base + grid.Slice              ) * 3;
+      size_t c5 = (base + grid.Slice           + 1) * 3;
+      size_t c6 = (base + grid.Slice + grid.Pitch ) * 3;
+      size_t c7 = (base + grid.Slice + grid.Pitch + 1) * 3;
 
-    for(int i = 0; i < Dim; i++) {
-      Coords[i] = Coords[i] < 0.0f ? 0.0f : Coords[i] > 1.0f ? 1.0f : Coords[i];
+      PrecisionType w0 = (    Nx) * (    Ny) * (    Nz);
+      PrecisionType w1 = (1 - Nx) * (    Ny) * (    Nz);
+      PrecisionType w2 = (    Nx) * (1 - Ny) * (    Nz);
+      PrecisionType w3 = (1 - Nx) * (1 - Ny) * (    Nz);
+      PrecisionType w4 = (    Nx) * (    Ny) * (1 - Nz);
+      PrecisionType w5 = (1 - Nx) * (    Ny) * (1 - Nz);
+      PrecisionType w6 = (    Nx) * (1 - Ny) * (1 - Nz);
+      PrecisionType w7 = (1 - Nx) * (1 - Ny) * (1 - Nz);
+
+      U[p] = Phi[c0+0] * w0 + Phi[c1+0] * w1 + Phi[c2+0] * w2 + Phi[c3+0] * w3 +
+             Phi[c4+0] * w4 + Phi[c5+0] * w5 + Phi[c6+0] * w6 + Phi[c7+0] * w7;
+      V[p] = Phi[c0+1] * w0 + Phi[c1+1] * w1 + Phi[c2+1] * w2 + Phi[c3+1] * w3 +
+             Phi[c4+1] * w4 + Phi[c5+1] * w5 + Phi[c6+1] * w6 + Phi[c7+1] * w7;
+      W[p] = Phi[c0+2] * w0 + Phi[c1+2] * w1 + Phi[c2+2] * w2 + Phi[c3+2] * w3 +
+             Phi[c4+2] * w4 + Phi[c5+2] * w5 + Phi[c6+2] * w6 + Phi[c7+2] * w7;
     }
+  }
 
-    Utils::GlobalToLocal(Coords,block->rIdx,Dim);
+};
 
-    pi = (uint)(Coords[0]); ni = pi+1;
-    pj = (uint)(Coords[1]); nj = pj+1;
-    pk = (uint)(Coords[2]); nk = pk+1;
+class BilinealInterpolator : public Interpolator {
+public:
 
-    PrecisionType Nx, Ny, Nz;
+  /**
+   * Cells needed below and above the base cell of a point. Points within
+   * this distance of the padded block must be clamped.
+   **/
+  static const size_t StencilLow  = 0;
+  static const size_t StencilHigh = 1;
+
+  /**
+   * Corners and weights of an interpolation point in a 2D block
+   **/
+  struct WeightsType {
+    size_t Index[4];
+    PrecisionType Weight[4];
+  };
+
+  BilinealInterpolator() {}
+  ~BilinealInterpolator() {}
+
+  /**
+   * Calculates the corners and weights of a point of a 2D block
+   * @Clamp:    clamp the point to the block. Can only be disabled if the
+   *            point is known to be inside the block
+   * @block:    block
+   * @Coords:   coordinates of the point (Will be clamped and moved to local)
+   * @Weights:  result
+   **/
+  template<bool Clamp>
+  static void CalculateWeights(
+      Block2D * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    Utils::GlobalToLocal(Coords,block->rIdx,2);
+
+    if(Clamp) {
+      PrecisionType limit[2] = {
+        (PrecisionType)(block->rX + BW - 2),
+        (PrecisionType)(block->rY + BW - 2)
+      };
+
+      for(size_t i = 0; i < 2; i++) {
+        Coords[i] = Coords[i] < 0.0f ? 0.0f : Coords[i] > limit[i] ? limit[i] : Coords[i];
+      }
+    }
+
+    size_t pi = (size_t)(Coords[0]);
+    size_t pj = (size_t)(Coords[1]);
+
+    PrecisionType Nx, Ny;
 
     Nx = 1-(Coords[0] - pi);
     Ny = 1-(Coords[1] - pj);
-    Nz = 1-(Coords[2] - pk);
+
+    size_t base = IndexType::GetIndex(pi,pj,0,block->mPaddY,0);
+
+    Weights.Index[0] = base;
+    Weights.Index[1] = base + block->mPaddA;
+    Weights.Index[2] = base + block->mPaddB;
+    Weights.Index[3] = base + block->mPaddC;
+
+    Weights.Weight[0] = (    Nx) * (    Ny);
+    Weights.Weight[1] = (1 - Nx) * (    Ny);
+    Weights.Weight[2] = (    Nx) * (1 - Ny);
+    Weights.Weight[3] = (1 - Nx) * (1 - Ny);
+  }
+
+  /**
+   * Interpolates a field using precalculated weights
+   * @Dim:      number of components of the field
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  corners and weights of the point
+   **/
+  template<size_t Dim>
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights) {
 
     for(size_t d = 0; d < Dim; d++) {
       *(NewPhi+d) = (
-        OldPhi[IndexType::GetIndex(pi,pj,pk,block->mPaddY,block->mPaddZ)*Dim+d] * (    Nx) * (    Ny) * (    Nz) +
-        OldPhi[IndexType::GetIndex(ni,pj,pk,block->mPaddY,block->mPaddZ)*Dim+d] * (1 - Nx) * (    Ny) * (    Nz) +
-        OldPhi[IndexType::GetIndex(pi,nj,pk,block->mPaddY,block->mPaddZ)*Dim+d] * (    Nx) * (1 - Ny) * (    Nz) +
-        OldPhi[IndexType::GetIndex(ni,nj,pk,block->mPaddY,block->mPaddZ)*Dim+d] * (1 - Nx) * (1 - Ny) * (    Nz) +
-        OldPhi[IndexType::GetIndex(pi,pj,nk,block->mPaddY,block->mPaddZ)*Dim+d] * (    Nx) * (    Ny) * (1 - Nz) +
-        OldPhi[IndexType::GetIndex(ni,pj,nk,block->mPaddY,block->mPaddZ)*Dim+d] * (1 - Nx) * (    Ny) * (1 - Nz) +
-        OldPhi[IndexType::GetIndex(pi,nj,nk,block->mPaddY,block->mPaddZ)*Dim+d] * (    Nx) * (1 - Ny) * (1 - Nz) +
-        OldPhi[IndexType::GetIndex(ni,nj,nk,block->mPaddY,block->mPaddZ)*Dim+d] * (1 - Nx) * (1 - Ny) * (1 - Nz)
+        OldPhi[Weights.Index[0]*Dim+d] * Weights.Weight[0] +
+        OldPhi[Weights.Index[1]*Dim+d] * Weights.Weight[1] +
+        OldPhi[Weights.Index[2]*Dim+d] * Weights.Weight[2] +
+        OldPhi[Weights.Index[3]*Dim+d] * Weights.Weight[3]
       );
     }
   }
 
-private:
+  /**
+   * Interpolates a field using precalculated weights
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  corners and weights of the point
+   * @Dim:      number of components of the field
+   **/
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights,
+      const size_t &Dim) {
+
+    switch(Dim) {
+      case 1: Apply<1>(OldPhi,NewPhi,Weights); break;
+      case 2: Apply<2>(OldPhi,NewPhi,Weights); break;
+      default:
+        for(size_t d = 0; d < Dim; d++) {
+          *(NewPhi+d) = 0.0f;
+          for(size_t c = 0; c < 4; c++) {
+            *(NewPhi+d) += OldPhi[Weights.Index[c]*Dim+d] * Weights.Weight[c];
+          }
+        }
+    }
+  }
+
+  template<size_t Dim, bool Clamp>
+  static void Interpolate(
+      Block2D * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords) {
+
+    WeightsType Weights;
+
+    CalculateWeights<Clamp>(block,Coords,Weights);
+    Apply<Dim>(OldPhi,NewPhi,Weights);
+  }
+};
+
+class TricubicInterpolator : public Interpolator {
+public:
 
+  /**
+   * Cells needed below and above the base cell of a point. Points within
+   * this distance of the padded block must be clamped.
+   **/
+  static const size_t StencilLow  = 1;
+  static const size_t StencilHigh = 2;
+
+  /**
+   * Offsets and weights of the 4x4x4 Catmull-Rom stencil of a point. They
+   * only depend on the coordinates, so they can be reused to interpolate
+   * several fields.
+   **/
+  struct WeightsType {
+    size_t Index[64];
+    PrecisionType Weight[64];
+  };
+
+  TricubicInterpolator() {}
+  ~TricubicInterpolator() {}
+
+  /**
+   * Calculates the stencil and weights of a point. When clamping, stencil
+   * indices are clamped to the padded block, so the BW ghost layers are
+   * used as support and the stencil degrades to repeated values at the
+   * border.
+   * @Clamp:    clamp the point to the block. Can only be disabled if the
+   *            whole stencil is known to be inside the block
+   * @block:    block
+   * @Coords:   coordinates of the point (Will be clamped and moved to local)
+   * @Weights:  result
+   **/
+  template<bool Clamp>
+  static void CalculateWeights(
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    CalculateWeights<Clamp>(DynamicGrid(block),block,Coords,Weights);
+  }
+
+  /**
+   * Same as above, with the sizes and strides of the grid of the block
+   * @grid:     grid of the block (DynamicGrid or StaticGrid)
+   **/
+  template<bool Clamp, class GridType>
+  static void CalculateWeights(
+      const GridType & grid,
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    const size_t size[MAX_DIM] = {
+      grid.X + BW,
+      grid.Y + BW,
+      grid.Z + BW
+    };
+
+    const size_t stride[MAX_DIM] = {
+      1,
+      grid.Pitch,
+      grid.Slice
+    };
+
+    size_t offset[MAX_DIM][4];
+    PrecisionType weight[MAX_DIM][4];
+
+    Utils::GlobalToLocal(Coords,block->rIdx,MAX_DIM);
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      if(Clamp) {
+        PrecisionType limit = (PrecisionType)(size[d] - 2);
+        Coords[d] = Coords[d] < 0.0f ? 0.0f : Coords[d] > limit ? limit : Coords[d];
+      }
+
+      long p = (long)(Coords[d]);
+      PrecisionType t = Coords[d] - p;
+
+      CalculateCatmullRom(t,weight[d]);
+
+      for(long s = 0; s < 4; s++) {
+        long c = p - 1 + s;
+        if(Clamp) {
+          c = c < 0 ? 0 : c > (long)size[d] - 1 ? (long)size[d] - 1 : c;
+        }
+        offset[d][s] = (size_t)c * stride[d];
+      }
+    }
+
+    #pragma omp simd collapse(3)
+    for(size_t c = 0; c < 4; c++) {
+      for(size_t b = 0; b < 4; b++) {
+        for(size_t a = 0; a < 4; a++) {
+          Weights.Index[c*16+b*4+a]  = offset[2][c] + offset[1][b] + offset[0][a];
+          Weights.Weight[c*16+b*4+a] = weight[2][c] * weight[1][b] * weight[0][a];
+        }
+      }
+    }
+  }
+
+  static void CalculateWeights(
+      Block * block,
+      PrecisionType * Coords,
+      WeightsType & Weights) {
+
+    CalculateWeights<true>(block,Coords,Weights);
+  }
+
+  /**
+   * Interpolates a field using precalculated weights
+   * @Dim:      number of components of the field
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  stencil and weights of the point
+   **/
+  template<size_t Dim>
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights) {
+
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+  /**
+   * Interpolates a field using precalculated weights
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  stencil and weights of the point
+   * @Dim:      number of components of the field
+   **/
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights,
+      const size_t &Dim) {
+
+    for(size_t d = 0; d < Dim; d++) {
+      PrecisionType value = 0.0f;
+
+      #pragma omp simd reduction(+:value)
+      for(size_t n = 0; n < 64; n++) {
+        value += OldPhi[Weights.Index[n]*Dim+d] * Weights.Weight[n];
+      }
+
+      *(NewPhi+d) = value;
+    }
+  }
+
+  template<size_t Dim, bool Clamp>
+  static void Interpolate(
+      Block * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords) {
+
+    WeightsType Weights;
+
+    CalculateWeights<Clamp>(block,Coords,Weights);
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+  static void Interpolate(
+      Block * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords,
+      const size_t &Dim) {
+
+    WeightsType Weights;
+
+    CalculateWeights<true>(block,Coords,Weights);
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+protected:
+
+  /**
+   * Catmull-Rom weights of the 4 points of a 1D stencil
+   * @t:        local coordinate of the point between the 2nd and 3rd points
+   * @w:        result
+   **/
+  static void CalculateCatmullRom(const PrecisionType &t, PrecisionType * w) {
+
+    PrecisionType t2 = t * t;
+    PrecisionType t3 = t * t2;
+
+    w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+    w[1] = 0.5f * ( 3.0f * t3 - 5.0f * t2 + 2.0f);
+    w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+    w[3] = 0.5f * ( t3 - t2);
+  }
+};
+
+class MonotoneCubicInterpolator : public TricubicInterpolator {
+public:
+
+  MonotoneCubicInterpolator() {}
+  ~MonotoneCubicInterpolator() {}
+
+  template<size_t Dim>
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights) {
+
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+  /**
+   * Interpolates a field using precalculated weights. The result is limited
+   * to the range of the 8 corners of the cell containing the point, which
+   * avoids the new extrema produced by the cubic near discontinuities.
+   * @OldPhi:   field to interpolate
+   * @NewPhi:   result
+   * @Weights:  stencil and weights of the point
+   * @Dim:      number of components of the field
+   **/
+  static void Apply(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const WeightsType & Weights,
+      const size_t &Dim) {
+
+    // Position of the cell corners in the 4x4x4 stencil
+    const size_t corners[8] = {21, 22, 25, 26, 37, 38, 41, 42};
+
+    TricubicInterpolator::Apply(OldPhi,NewPhi,Weights,Dim);
+
+    for(size_t d = 0; d < Dim; d++) {
+      PrecisionType minv = OldPhi[Weights.Index[corners[0]]*Dim+d];
+      PrecisionType maxv = minv;
+
+      for(size_t c = 1; c < 8; c++) {
+        minv = std::min(minv,OldPhi[Weights.Index[corners[c]]*Dim+d]);
+        maxv = std::max(maxv,OldPhi[Weights.Index[corners[c]]*Dim+d]);
+      }
+
+      *(NewPhi+d) = std::max(minv,std::min(maxv,*(NewPhi+d)));
+    }
+  }
+
+  template<size_t Dim, bool Clamp>
+  static void Interpolate(
+      Block * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords) {
+
+    WeightsType Weights;
+
+    CalculateWeights<Clamp>(block,Coords,Weights);
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
+
+  static void Interpolate(
+      Block * block,
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      PrecisionType * Coords,
+      const size_t &Dim) {
+
+    WeightsType Weights;
+
+    CalculateWeights<true>(block,Coords,Weights);
+    Apply(OldPhi,NewPhi,Weights,Dim);
+  }
 };
 
 #endif
@@ -0,0 +1,520 @@
+#ifndef LEVEL_SET_H
+#define LEVEL_SET_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <omp.h>
+
+#include "defines.h"
+#include "block.h"
+
+/**
+ * Narrow band level set advected with BFECC.
+ *
+ * Only the cells within "width" cells of the zero contour (the band) are
+ * advected and reinitialised, so the cost per step grows with the area of
+ * the interface instead of the volume of the block. Cells outside the band
+ * hold +-(width+1)*dx, with the same value in the level set, result and
+ * auxiliar buffers, so the interpolation of the band can read them.
+ *
+ * Every few steps the band is rebuilt around the new interface and the
+ * level set is reinitialised to a signed distance with fast sweeping. The
+ * cells adjacent to the interface keep their value and the 8 sweeps update
+ * the band in hyperplanes i+j+k = constant (with the signs of the sweep),
+ * whose cells do not depend on each other, so each plane is updated in
+ * parallel.
+ *
+ * The band must be wider than the distance travelled by the interface
+ * between two reinitialisations.
+ **/
+class NarrowBandLevelSet {
+public:
+
+  typedef Block::IndexType IndexType;
+
+  /**
+   * Creates a level set with the sizes of the block. The level set must be
+   * filled with GetPhi and then Initialize called
+   * @block:      block with the velocity
+   * @width:      cells of the band at each side of the interface
+   * @reinit:     steps between reinitialisations
+   **/
+  NarrowBandLevelSet(Block * block, const size_t &width, const size_t &reinit) :
+      pBlock(block),
+      mWidth(std::max(width,(size_t)1)),
+      mReinit(std::max(reinit,(size_t)1)),
+      mSteps(0),
+      mNumInterface(0) {
+
+    mElements = (block->rX + BW) * (block->rY + BW) * (block->rZ + BW);
+
+    mFar = (mWidth + 1) * block->rDx;
+
+    mPhi.resize(mElements,mFar);
+    mResult.resize(mElements,mFar);
+    mAux.resize(mElements,mFar);
+    mMask.resize(mElements,0);
+  }
+
+  ~NarrowBandLevelSet() {}
+
+  /**
+   * Returns the level set, to be filled before Initialize
+   **/
+  PrecisionType * GetPhi() {
+    return &mPhi[0];
+  }
+
+  /**
+   * Fills the level set with the signed distance to a sphere, negative
+   * inside
+   * @center:   centre of the sphere
+   * @radius:   radius of the sphere
+   **/
+  void SetSphere(const PrecisionType * center, const PrecisionType &radius) {
+
+    const size_t &X = pBlock->rX;
+    const size_t &Y = pBlock->rY;
+    const size_t &Z = pBlock->rZ;
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < Z + BW; k++) {
+      for(size_t j = 0; j < Y + BW; j++) {
+        for(size_t i = 0; i < X + BW; i++) {
+          PrecisionType dx = i * pBlock->rDx - center[0];
+          PrecisionType dy = j * pBlock->rDx - center[1];
+          PrecisionType dz = k * pBlock->rDx - center[2];
+
+          mPhi[IndexType::GetIndex(i,j,k,pBlock->mPaddY,pBlock->mPaddZ)] = sqrt(dx*dx + dy*dy + dz*dz) - radius;
+        }
+      }
+    }
+  }
+
+  /**
+   * Builds the band from a level set filled in the whole block and
+   * reinitialises it. This is the only operation over the whole block
+   **/
+  void Initialize() {
+
+    std::vector<size_t> interface;
+
+    findInterface(interface,NULL,0);
+
+    mBand.clear();
+
+    buildBand(interface);
+
+    #pragma omp parallel for
+    for(size_t c = 0; c < mElements; c++) {
+      if(!mMask[c]) {
+        mPhi[c] = mPhi[c] < 0.0f ? -mFar : mFar;
+      }
+      mResult[c] = mPhi[c];
+      mAux[c]    = mPhi[c];
+    }
+
+    sweep(interface);
+  }
+
+  /**
+   * Advects the level set one step over the band and reinitialises it if
+   * it is a reinitialisation step
+   * @solver:   advection solver of the block, with the time step
+   **/
+  template<class SolverType>
+  void Advect(SolverType &solver) {
+
+    if(mBand.empty()) {
+      return;
+    }
+
+    typename SolverType::AdvectedField field = {
+      &mPhi[0],
+      &mResult[0],
+      &mAux[0],
+      1
+    };
+
+    solver.AdvectFieldsList(&field,1,&mBand[0],mBand.size());
+
+    #pragma omp parallel for
+    for(size_t b = 0; b < mBand.size(); b++) {
+      mPhi[mBand[b]] = mResult[mBand[b]];
+    }
+
+    mSteps++;
+
+    if(!(mSteps % mReinit)) {
+      Reinitialize();
+    }
+  }
+
+  /**
+   * Rebuilds the band around the current interface and reinitialises the
+   * level set to a signed distance inside it
+   **/
+  void Reinitialize() {
+
+    std::vector<size_t> interface;
+
+    // The interface is always inside the band, cells outside hold +-far
+    findInterface(interface,&mBand[0],mBand.size());
+
+    #pragma omp parallel for
+    for(size_t b = 0; b < mBand.size(); b++) {
+      mMask[mBand[b]] = 0;
+    }
+
+    std::vector<size_t> oldBand;
+
+    oldBand.swap(mBand);
+
+    buildBand(interface);
+
+    // Cells that left the band
+    #pragma omp parallel for
+    for(size_t b = 0; b < oldBand.size(); b++) {
+      size_t c = oldBand[b];
+      if(!mMask[c]) {
+        mPhi[c]    = mPhi[c] < 0.0f ? -mFar : mFar;
+        mResult[c] = mPhi[c];
+        mAux[c]    = mPhi[c];
+      }
+    }
+
+    sweep(interface);
+  }
+
+  /**
+   * Returns the number of cells of the band
+   **/
+  size_t GetBandSize() {
+    return mBand.size();
+  }
+
+  /**
+   * Returns the number of cells next to the interface in the last
+   * reinitialisation
+   **/
+  size_t GetInterfaceSize() {
+    return mNumInterface;
+  }
+
+private:
+
+  /**
+   * Finds the interior cells with a neighbour on the other side of the
+   * interface
+   * @interface:  result
+   * @cells:      cells to search or NULL for the whole block
+   * @numCells:   number of cells
+   **/
+  void findInterface(std::vector<size_t> &interface, const size_t * cells, const size_t &numCells) {
+
+    const size_t &X = pBlock->rX;
+    const size_t &Y = pBlock->rY;
+    const size_t &Z = pBlock->rZ;
+
+    const size_t pitch = pBlock->mPaddY;
+    const size_t slice = pBlock->mPaddZ;
+
+    size_t count = cells != NULL ? numCells : mElements;
+
+    #pragma omp parallel
+    {
+      std::vector<size_t> local;
+
+      #pragma omp for schedule(static) nowait
+      for(size_t n = 0; n < count; n++) {
+        size_t c = cells != NULL ? cells[n] : n;
+
+        size_t i = c % pitch;
+        size_t j = (c % slice) / pitch;
+        size_t k = c / slice;
+
+        if(i < BWP || i >= X + BWP || j < BWP || j >= Y + BWP || k < BWP || k >= Z + BWP) {
+          continue;
+        }
+
+        bool inside = mPhi[c] < 0.0f;
+
+        if((mPhi[c-1]     < 0.0f) != inside || (mPhi[c+1]     < 0.0f) != inside ||
+           (mPhi[c-pitch] < 0.0f) != inside || (mPhi[c+pitch] < 0.0f) != inside ||
+           (mPhi[c-slice] < 0.0f) != inside || (mPhi[c+slice] < 0.0f) != inside) {
+          local.push_back(c);
+        }
+      }
+
+      #pragma omp critical
+      interface.insert(interface.end(),local.begin(),local.end());
+    }
+
+    std::sort(interface.begin(),interface.end());
+
+    mNumInterface = interface.size();
+  }
+
+  /**
+   * Builds the band as the interior cells within "width" cells of the
+   * interface, marked in the mask, and orders it for the sweeps. The cube
+   * around every interface cell is built with one dilation per axis, which
+   * visits each cell of the band a few times instead of once per interface
+   * cell in reach. The mask must be clear
+   * @interface:  cells next to the interface
+   **/
+  void buildBand(const std::vector<size_t> &interface) {
+
+    std::vector<size_t> rows;
+    std::vector<size_t> planes;
+
+    dilate(interface,rows,  0,MASK_ROW);
+    dilate(rows,     planes,1,MASK_PLANE);
+    dilate(planes,   mBand, 2,MASK_BAND);
+
+    #pragma omp parallel for
+    for(size_t n = 0; n < rows.size(); n++) {
+      mMask[rows[n]] &= ~MASK_ROW;
+    }
+
+    #pragma omp parallel for
+    for(size_t n = 0; n < planes.size(); n++) {
+      mMask[planes[n]] &= ~MASK_PLANE;
+    }
+
+    std::sort(mBand.begin(),mBand.end());
+
+    orderSweeps();
+  }
+
+  /**
+   * Dilates a set of cells "width" cells along an axis, limited to the
+   * interior of the block
+   * @from:     cells to dilate
+   * @to:       cells of the dilation
+   * @axis:     axis of the dilation
+   * @bit:      bit of the mask marking the cells of the dilation
+   **/
+  void dilate(
+      const std::vector<size_t> &from,
+      std::vector<size_t> &to,
+      const size_t &axis,
+      const unsigned char bit) {
+
+    const size_t size[MAX_DIM]   = {pBlock->rX, pBlock->rY, pBlock->rZ};
+    const size_t stride[MAX_DIM] = {1, pBlock->mPaddY, pBlock->mPaddZ};
+    const size_t period[MAX_DIM] = {pBlock->mPaddY, pBlock->mPaddZ, mElements};
+
+    const size_t w = mWidth;
+
+    #pragma omp parallel
+    {
+      std::vector<size_t> local;
+
+      #pragma omp for schedule(static) nowait
+      for(size_t n = 0; n < from.size(); n++) {
+        size_t c = from[n];
+        size_t x = (c % period[axis]) / stride[axis];
+
+        size_t first = std::max(x,BWP + w) - w;
+        size_t last  = std::min(x + w,size[axis]);
+
+        for(size_t y = first; y <= last; y++) {
+          size_t d = c + y * stride[axis] - x * stride[axis];
+
+          unsigned char old;
+
+          #pragma omp atomic capture
+          { old = mMask[d]; mMask[d] |= bit; }
+
+          if(!(old & bit)) {
+            local.push_back(d);
+          }
+        }
+      }
+
+      #pragma omp critical
+      to.insert(to.end(),local.begin(),local.end());
+    }
+  }
+
+  /**
+   * Buckets the cells of the band by hyperplane for each of the 8 sweep
+   * directions
+   **/
+  void orderSweeps() {
+
+    const size_t X = pBlock->rX + BW;
+    const size_t Y = pBlock->rY + BW;
+    const size_t Z = pBlock->rZ + BW;
+
+    const size_t pitch = pBlock->mPaddY;
+    const size_t slice = pBlock->mPaddZ;
+
+    size_t numPlanes = X + Y + Z;
+    size_t numCells  = mBand.size();
+
+    std::vector<size_t> coords(numCells * MAX_DIM);
+
+    #pragma omp parallel for
+    for(size_t b = 0; b < numCells; b++) {
+      coords[b*MAX_DIM+0] = mBand[b] % pitch;
+      coords[b*MAX_DIM+1] = (mBand[b] % slice) / pitch;
+      coords[b*MAX_DIM+2] = mBand[b] / slice;
+    }
+
+    // Counting sort by plane, one direction per thread
+    #pragma omp parallel for schedule(static,1)
+    for(size_t s = 0; s < 8; s++) {
+      std::vector<size_t> &cells  = mSweepCells[s];
+      std::vector<size_t> &planes = mSweepPlanes[s];
+
+      cells.resize(numCells);
+      planes.assign(numPlanes + 1,0);
+
+      for(size_t b = 0; b < numCells; b++) {
+        planes[plane(s,&coords[b*MAX_DIM],X,Y,Z) + 1]++;
+      }
+
+      for(size_t p = 0; p < numPlanes; p++) {
+        planes[p+1] += planes[p];
+      }
+
+      std::vector<size_t> next(planes.begin(),planes.end() - 1);
+
+      for(size_t b = 0; b < numCells; b++) {
+        cells[next[plane(s,&coords[b*MAX_DIM],X,Y,Z)]++] = mBand[b];
+      }
+    }
+  }
+
+  /**
+   * Hyperplane of a cell in a sweep direction. Bits of the direction select
+   * the decreasing axes
+   * @s:        direction
+   * @coords:   index of the cell in each axis
+   * @X,Y,Z:    size of the padded block
+   **/
+  static size_t plane(
+      const size_t &s,
+      const size_t * coords,
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z) {
+
+    return ((s & 1) ? X - 1 - coords[0] : coords[0]) +
+           ((s & 2) ? Y - 1 - coords[1] : coords[1]) +
+           ((s & 4) ? Z - 1 - coords[2] : coords[2]);
+  }
+
+  /**
+   * Reinitialises the band to a signed distance with fast sweeping. The
+   * cells next to the interface keep their value
+   * @interface:  cells next to the interface
+   **/
+  void sweep(const std::vector<size_t> &interface) {
+
+    const size_t pitch = pBlock->mPaddY;
+    const size_t slice = pBlock->mPaddZ;
+
+    const PrecisionType h = pBlock->rDx;
+    const PrecisionType far = mFar;
+    const PrecisionType zero = 0.0f;
+
+    #pragma omp parallel for
+    for(size_t n = 0; n < interface.size(); n++) {
+      mMask[interface[n]] = MASK_FROZEN;
+    }
+
+    #pragma omp parallel for
+    for(size_t b = 0; b < mBand.size(); b++) {
+      size_t c = mBand[b];
+      if(mMask[c] != MASK_FROZEN) {
+        mPhi[c] = mPhi[c] < 0.0f ? -far : far;
+      }
+    }
+
+    #pragma omp parallel
+    for(size_t s = 0; s < 8; s++) {
+      const std::vector<size_t> &cells  = mSweepCells[s];
+      const std::vector<size_t> &planes = mSweepPlanes[s];
+
+      for(size_t p = 0; p + 1 < planes.size(); p++) {
+        if(planes[p] == planes[p+1]) {
+          continue;
+        }
+
+        #pragma omp for schedule(static)
+        for(size_t n = planes[p]; n < planes[p+1]; n++) {
+          size_t c = cells[n];
+
+          if(mMask[c] == MASK_FROZEN) {
+            continue;
+          }
+
+          PrecisionType d[3] = {
+            (PrecisionType)std::min(fabs(mPhi[c-1]),    fabs(mPhi[c+1])),
+            (PrecisionType)std::min(fabs(mPhi[c-pitch]),fabs(mPhi[c+pitch])),
+            (PrecisionType)std::min(fabs(mPhi[c-slice]),fabs(mPhi[c+slice]))
+          };
+
+          std::sort(d,d+3);
+
+          PrecisionType dist = d[0] + h;
+
+          if(dist > d[1]) {
+            dist = 0.5f * (d[0] + d[1] + sqrt(std::max(2*h*h - (d[0]-d[1])*(d[0]-d[1]),zero)));
+            if(dist > d[2]) {
+              PrecisionType sum = d[0] + d[1] + d[2];
+              dist = (sum + sqrt(std::max(sum*sum - 3*(d[0]*d[0] + d[1]*d[1] + d[2]*d[2] - h*h),zero))) / 3.0f;
+            }
+          }
+
+          dist = std::min(dist,far);
+
+          mPhi[c] = mPhi[c] < 0.0f ? -std::min((PrecisionType)fabs(mPhi[c]),dist) : std::min(mPhi[c],dist);
+        }
+      }
+    }
+
+    #pragma omp parallel for
+    for(size_t b = 0; b < mBand.size(); b++) {
+      size_t c = mBand[b];
+      mMask[c]   = MASK_BAND;
+      mResult[c] = mPhi[c];
+      mAux[c]    = mPhi[c];
+    }
+  }
+
+  Block * pBlock;
+
+  size_t mWidth;
+  size_t mReinit;
+  size_t mSteps;
+  size_t mElements;
+  size_t mNumInterface;
+
+  PrecisionType mFar;
+
+  std::vector<PrecisionType> mPhi;
+  std::vector<PrecisionType> mResult;
+  std::vector<PrecisionType> mAux;
+
+  // Bits of the mask
+  enum MaskBits {
+    MASK_BAND   = 1,
+    MASK_FROZEN = 2,
+    MASK_ROW    = 4,
+    MASK_PLANE  = 8
+  };
+
+  std::vector<unsigned char> mMask;
+
+  std::vector<size_t> mBand;
+  std::vector<size_t> mSweepCells[8];
+  std::vector<size_t> mSweepPlanes[8];
+};
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef LINEAR_SOLVER_H
+#define LINEAR_SOLVER_H
+
+#include <math.h>
+
+#include "defines.h"
+#include "utils.h"
+#include "block.h"
+#include "ghost_fill.h"
+
+/**
+ * Base of the solvers for the pressure Poisson equation
+ *
+ *   -lap(x) = b
+ *
+ * with homogeneous Neumann conditions at the border of the block, or
+ * periodic ones in the directions set with SetPeriodic, and Dirichlet
+ * conditions on FIXED_PRESSURE cells, which keep their value.
+ **/
+class LinearSolver {
+public:
+
+  typedef Block::IndexType IndexType;
+
+  LinearSolver(Block * block) :
+      pBlock(block),
+      mTolerance(1.0e-6f),
+      mMaxIterations(1000),
+      mIterations(0),
+      mResidual(0.0f) {
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      mPeriodic[d] = false;
+    }
+  }
+
+  virtual ~LinearSolver() {
+  }
+
+  /**
+   * Solves the system
+   * @x:        initial guess and result
+   * @b:        right hand side
+   **/
+  virtual void Solve(PrecisionType * x, PrecisionType * b) = 0;
+
+  void SetTolerance(const PrecisionType &tolerance) {
+    mTolerance = tolerance;
+  }
+
+  void SetMaxIterations(const size_t &maxIterations) {
+    mMaxIterations = maxIterations;
+  }
+
+  /**
+   * Sets the border of a direction to wrap around the block. Must match
+   * the ghost cells of the solver that uses the pressure
+   * @axis:     direction (0: x, 1: y, 2: z)
+   * @periodic: true for periodic, false for Neumann
+   **/
+  void SetPeriodic(const size_t &axis, const bool &periodic) {
+    mPeriodic[axis] = periodic;
+  }
+
+  size_t GetIterations() {
+    return mIterations;
+  }
+
+  PrecisionType GetResidual() {
+    return mResidual;
+  }
+
+  /**
+   * 7-point stencil of -lap(x) over a given cell
+   * @block:    block
+   * @x:        field
+   * @cell:     index of the cell
+   **/
+  static inline PrecisionType Operator(
+      Block * block,
+      PrecisionType * x,
+      const size_t &cell) {
+
+    return (
+      6.0f * x[cell] -
+      x[cell - 1] -                                 // Left
+      x[cell + 1] -                                 // Right
+      x[cell - block->mPaddY] -                     // Up
+      x[cell + block->mPaddY] -                     // Down
+      x[cell - block->mPaddZ] -                     // Front
+      x[cell + block->mPaddZ]) * block->rIdx * block->rIdx;   // Back
+  }
+
+  /**
+   * Sets the ghost cells to the value of the adjacent interior cell
+   * (homogeneous Neumann) or of the opposite side in the periodic
+   * directions.
+   * @block:    block
+   * @x:        field
+   **/
+  void CopyGhosts(Block * block, PrecisionType * x) {
+
+    GhostFill ghosts(block);
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      ghosts.SetPeriodic(d,mPeriodic[d]);
+    }
+
+    ghosts.Fill(x,1);
+  }
+
+  /**
+   * Calculates r = b + lap(x) on free cells and r = 0 on fixed ones.
+   * Ghost cells of x must be up to date.
+   * @block:    block
+   * @x:        solution
+   * @b:        right hand side
+   * @r:        result
+   **/
+  static void Residual(
+      Block * block,
+      PrecisionType * x,
+      PrecisionType * b,
+      PrecisionType * r) {
+
+    #pragma omp parallel for
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          r[cell] = (block->pFlags[cell] & FIXED_PRESSURE) ? 0.0f : b[cell] - Operator(block,x,cell);
+          cell++;
+        }
+      }
+    }
+  }
+
+  /**
+   * Dot product over the free cells of the block
+   * @block:    block
+   * @a,b:      fields
+   **/
+  static PrecisionType Dot(
+      Block * block,
+      PrecisionType * a,
+      PrecisionType * b) {
+
+    PrecisionType result = 0.0f;
+
+    #pragma omp parallel for reduction(+:result)
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          if(!(block->pFlags[cell] & FIXED_PRESSURE))
+            result += a[cell] * b[cell];
+          cell++;
+        }
+      }
+    }
+
+    return result;
+  }
+
+  /**
+   * Removes the mean of a field over the free cells. Makes the right hand
+   * side compatible when there are no Dirichlet cells (pure Neumann).
+   * @block:    block
+   * @x:        field
+   * @return:   true if the block has no FIXED_PRESSURE cells
+   **/
+  static bool RemoveNullSpace(Block * block, PrecisionType * x) {
+
+    PrecisionType sum = 0.0f;
+    size_t fixed = 0;
+
+    #pragma omp parallel for reduction(+:sum,fixed)
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          sum   += x[cell];
+          fixed += (block->pFlags[cell] & FIXED_PRESSURE) ? 1 : 0;
+          cell++;
+        }
+      }
+    }
+
+    if(fixed) {
+      return false;
+    }
+
+    PrecisionType mean = sum / (PrecisionType)(block->rX * block->rY * block->rZ);
+
+    #pragma omp parallel for
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          x[cell++] -= mean;
+        }
+      }
+    }
+
+    return true;
+  }
+
+protected:
+
+  Block * pBlock;
+
+  PrecisionType mTolerance;
+  size_t        mMaxIterations;
+
+  size_t        mIterations;
+  PrecisionType mResidual;
+
+  bool          mPeriodic[MAX_DIM];
+};
+
+/**
+ * Conjugate gradient. Search directions are zero on FIXED_PRESSURE cells,
+ * so the iteration only acts on the free cells and the operator stays
+ * symmetric.
+ **/
+class ConjugateGradientSolver : public LinearSolver {
+public:
+
+  ConjugateGradientSolver(Block * block) :
+      LinearSolver(block) {
+
+    mMemManager.AllocateGrid(&mR , block->rX, block->rY, block->rZ, 1, 1);
+    mMemManager.AllocateGrid(&mP , block->rX, block->rY, block->rZ, 1, 1);
+    mMemManager.AllocateGrid(&mAp, block->rX, block->rY, block->rZ, 1, 1);
+  }
+
+  ~ConjugateGradientSolver() {
+
+    mMemManager.ReleaseGrid(&mR , 1);
+    mMemManager.ReleaseGrid(&mP , 1);
+    mMemManager.ReleaseGrid(&mAp, 1);
+  }
+
+  void Solve(PrecisionType * x, PrecisionType * b) {
+
+    Block * block = pBlock;
+
+    CopyGhosts(block,x);
+    Residual(block,x,b,mR);
+    RemoveNullSpace(block,mR);
+
+    PrecisionType norm = sqrt(Dot(block,b,b));
+    PrecisionType rr   = Dot(block,mR,mR);
+
+    if(norm == 0.0f) {
+      norm = 1.0f;
+    }
+
+    #pragma omp parallel for
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          mP[cell] = mR[cell];
+          cell++;
+        }
+      }
+    }
+
+    mIterations = 0;
+    mResidual   = sqrt(rr) / norm;
+
+    while(mResidual > mTolerance && mIterations < mMaxIterations) {
+
+      CopyGhosts(block,mP);
+
+      PrecisionType pAp = 0.0f;
+
+      #pragma omp parallel for reduction(+:pAp)
+      for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+        for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+          size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+          for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+            mAp[cell] = (block->pFlags[cell] & FIXED_PRESSURE) ? 0.0f : Operator(block,mP,cell);
+            pAp += mP[cell] * mAp[cell];
+            cell++;
+          }
+        }
+      }
+
+      PrecisionType alpha = rr / pAp;
+      PrecisionType rrNew = 0.0f;
+
+      #pragma omp parallel for reduction(+:rrNew)
+      for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+        for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+          size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+          for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+            x[cell]  += alpha * mP[cell];
+            mR[cell] -= alpha * mAp[cell];
+            rrNew    += mR[cell] * mR[cell];
+            cell++;
+          }
+        }
+      }
+
+      PrecisionType beta = rrNew / rr;
+
+      #pragma omp parallel for
+      for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+        for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+          size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+          for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+            mP[cell] = mR[cell] + beta * mP[cell];
+            cell++;
+          }
+        }
+      }
+
+      rr = rrNew;
+
+      mIterations++;
+      mResidual = sqrt(rr) / norm;
+    }
+
+    CopyGhosts(block,x);
+  }
+
+private:
+
+  MemManager mMemManager;
+
+  PrecisionType * mR;
+  PrecisionType * mP;
+  PrecisionType * mAp;
+};
+
+#endif
@@ -0,0 +1,514 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include "defines.h"
+#include "utils.h"
+#include "block.h"
+#include "linear_solver.h"
+
+enum Smoother {
+  SMOOTHER_JACOBI,        // Weighted Jacobi
+  SMOOTHER_RBGS           // Red-black Gauss-Seidel
+};
+
+/**
+ * Geometric multigrid for the pressure Poisson equation. Coarse levels are
+ * Blocks with half the cells per side, built until a side can not be
+ * halved or reaches the minimum size. Restriction averages the 8 children
+ * of a coarse cell and prolongation is trilinear (cell centered).
+ *
+ * A coarse cell is FIXED_PRESSURE if any of its children is, and the
+ * correction is zero on those cells.
+ **/
+class MultigridSolver : public LinearSolver {
+public:
+
+  /**
+   * @block:      fine block
+   * @cycle:      1 for V-cycles, 2 for W-cycles
+   * @smoother:   smoother used in all levels
+   * @minSize:    minimum cells per side of the coarsest level
+   **/
+  MultigridSolver(
+      Block * block,
+      const size_t &cycle = 1,
+      const Smoother &smoother = SMOOTHER_RBGS,
+      const size_t &minSize = 4) :
+      LinearSolver(block),
+      mCycle(cycle),
+      mSmoother(smoother),
+      mPreSmooth(2),
+      mPostSmooth(2),
+      mCoarseSmooth(50),
+      mWeight(6.0f/7.0f) {
+
+    mMaxIterations = 50;
+
+    mNumLevels = 1;
+    mLevels[0] = CreateLevel(block,NULL);
+
+    while(mNumLevels < MAX_LEVELS) {
+      Level * fine = mLevels[mNumLevels-1];
+
+      if((fine->X % 2) || (fine->Y % 2) || (fine->Z % 2) ||
+          fine->X / 2 < minSize || fine->Y / 2 < minSize || fine->Z / 2 < minSize) {
+        break;
+      }
+
+      mLevels[mNumLevels] = CreateLevel(NULL,fine);
+      mNumLevels++;
+    }
+  }
+
+  ~MultigridSolver() {
+
+    for(size_t l = 0; l < mNumLevels; l++) {
+      ReleaseLevel(mLevels[l]);
+    }
+  }
+
+  void SetSmoothing(const size_t &pre, const size_t &post, const size_t &coarse) {
+    mPreSmooth    = pre;
+    mPostSmooth   = post;
+    mCoarseSmooth = coarse;
+  }
+
+  size_t GetNumLevels() {
+    return mNumLevels;
+  }
+
+  void Solve(PrecisionType * x, PrecisionType * b) {
+
+    Level * fine = mLevels[0];
+
+    fine->x = x;
+
+    Copy(fine,b,fine->b);
+    RemoveNullSpace(fine->block,fine->b);
+
+    PrecisionType norm = sqrt(Dot(fine->block,fine->b,fine->b));
+
+    if(norm == 0.0f) {
+      norm = 1.0f;
+    }
+
+    mIterations = 0;
+
+    CopyGhosts(fine->block,x);
+    Residual(fine->block,x,fine->b,fine->r);
+    mResidual = sqrt(Dot(fine->block,fine->r,fine->r)) / norm;
+
+    while(mResidual > mTolerance && mIterations < mMaxIterations) {
+
+      Cycle(0);
+
+      CopyGhosts(fine->block,x);
+      Residual(fine->block,x,fine->b,fine->r);
+
+      mIterations++;
+      mResidual = sqrt(Dot(fine->block,fine->r,fine->r)) / norm;
+    }
+
+    CopyGhosts(fine->block,x);
+
+    fine->x = NULL;
+  }
+
+private:
+
+  static const size_t MAX_LEVELS = 16;
+
+  /**
+   * Storage of a level. Block keeps references to the sizes, so they live
+   * here.
+   **/
+  struct Level {
+    size_t X, Y, Z;
+    size_t NB, NE;
+    size_t Dim;
+    size_t BW;
+
+    PrecisionType Dx;
+
+    PrecisionType * Buffers[MAX_BUFF];
+    uint * Flags;
+
+    PrecisionType * x;
+    PrecisionType * b;
+    PrecisionType * r;
+    PrecisionType * t;
+
+    Block * block;
+  };
+
+  /**
+   * Creates the fine level from a block or a coarse level from a finer one
+   **/
+  Level * CreateLevel(Block * block, Level * fine) {
+
+    Level * level = new Level;
+
+    for(size_t i = 0; i < MAX_BUFF; i++) {
+      level->Buffers[i] = NULL;
+    }
+
+    level->x = NULL;
+
+    if(fine == NULL) {
+      level->block = block;
+      level->Flags = NULL;
+      level->X  = block->rX;
+      level->Y  = block->rY;
+      level->Z  = block->rZ;
+    } else {
+      level->X  = fine->X / 2;
+      level->Y  = fine->Y / 2;
+      level->Z  = fine->Z / 2;
+      level->NB = 1;
+      level->NE = level->X + BW;
+      level->Dim = 1;
+      level->BW = BW;
+      level->Dx = fine->block->rDx * 2.0f;
+
+      mMemManager.AllocateGrid(&level->Flags, level->X, level->Y, level->Z, 1, 1);
+      mMemManager.AllocateGrid(&level->x    , level->X, level->Y, level->Z, 1, 1);
+
+      level->block = new Block(
+        level->Buffers, level->Flags,
+        level->Dx,
+        pBlock->rOmega, pBlock->rRo, pBlock->rMu, pBlock->rKa, pBlock->rCC2,
+        level->BW,
+        level->X, level->Y, level->Z,
+        level->NB, level->NE, level->Dim
+      );
+
+      CoarsenFlags(fine,level);
+    }
+
+    mMemManager.AllocateGrid(&level->b, level->X, level->Y, level->Z, 1, 1);
+    mMemManager.AllocateGrid(&level->r, level->X, level->Y, level->Z, 1, 1);
+    mMemManager.AllocateGrid(&level->t, level->X, level->Y, level->Z, 1, 1);
+
+    Zero(level,level->b);
+    Zero(level,level->r);
+    Zero(level,level->t);
+
+    if(fine != NULL) {
+      Zero(level,level->x);
+    }
+
+    return level;
+  }
+
+  void ReleaseLevel(Level * level) {
+
+    mMemManager.ReleaseGrid(&level->b, 1);
+    mMemManager.ReleaseGrid(&level->r, 1);
+    mMemManager.ReleaseGrid(&level->t, 1);
+
+    if(level->Flags != NULL) {
+      delete level->block;
+
+      mMemManager.ReleaseGrid(&level->x, 1);
+      mMemManager.ReleaseGrid(&level->Flags, 1);
+    }
+
+    delete level;
+  }
+
+  /**
+   * Sets the whole padded field to zero (first touch is also parallel)
+   **/
+  void Zero(Level * level, PrecisionType * x) {
+
+    Block * block = level->block;
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < level->Z + BW; k++) {
+      for(size_t j = 0; j < level->Y + BW; j++) {
+        for(size_t i = 0; i < level->X + BW; i++) {
+          x[IndexType::GetIndex(i,j,k,block->mPaddY,block->mPaddZ)] = 0.0f;
+        }
+      }
+    }
+  }
+
+  void Copy(Level * level, PrecisionType * src, PrecisionType * dst) {
+
+    Block * block = level->block;
+
+    #pragma omp parallel for
+    for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+      for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+        size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+        for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+          dst[cell] = src[cell];
+          cell++;
+        }
+      }
+    }
+  }
+
+  void CoarsenFlags(Level * fine, Level * coarse) {
+
+    Block * fb = fine->block;
+    Block * cb = coarse->block;
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < coarse->Z + BW; k++) {
+      for(size_t j = 0; j < coarse->Y + BW; j++) {
+        for(size_t i = 0; i < coarse->X + BW; i++) {
+          coarse->Flags[IndexType::GetIndex(i,j,k,cb->mPaddY,cb->mPaddZ)] = 0;
+        }
+      }
+    }
+
+    #pragma omp parallel for
+    for(size_t k = BWP; k < coarse->Z + BWP; k++) {
+      for(size_t j = BWP; j < coarse->Y + BWP; j++) {
+        for(size_t i = BWP; i < coarse->X + BWP; i++) {
+          size_t child = IndexType::GetIndex(
+            BWP + 2 * (i - BWP),
+            BWP + 2 * (j - BWP),
+            BWP + 2 * (k - BWP),
+            fb->mPaddY, fb->mPaddZ);
+
+          uint fixed =
+            fb->pFlags[child                 ] | fb->pFlags[child + fb->mPaddA] |
+            fb->pFlags[child + fb->mPaddB    ] | fb->pFlags[child + fb->mPaddC] |
+            fb->pFlags[child + fb->mPaddD    ] | fb->pFlags[child + fb->mPaddE] |
+            fb->pFlags[child + fb->mPaddF    ] | fb->pFlags[child + fb->mPaddG];
+
+          coarse->Flags[IndexType::GetIndex(i,j,k,cb->mPaddY,cb->mPaddZ)] = fixed & FIXED_PRESSURE;
+        }
+      }
+    }
+  }
+
+  /**
+   * Sum of the interior neighbours of a cell. Missing neighbours are the
+   * Neumann border, which does not contribute to the stencil, except in
+   * the periodic directions, where they wrap around the block.
+   * @count:    number of neighbours
+   **/
+  inline PrecisionType Neighbours(
+      Block * block,
+      PrecisionType * x,
+      const size_t &i,
+      const size_t &j,
+      const size_t &k,
+      const size_t &cell,
+      PrecisionType &count) {
+
+    const size_t &BWP = block->rBWP;
+
+    PrecisionType sum = 0.0f;
+
+    count = 0.0f;
+
+    const size_t wrapX = (block->rX - 1);
+    const size_t wrapY = (block->rY - 1) * block->mPaddY;
+    const size_t wrapZ = (block->rZ - 1) * block->mPaddZ;
+
+    if(i > BWP)                 { sum += x[cell - 1];             count += 1.0f; }
+    else if(mPeriodic[0])       { sum += x[cell + wrapX];         count += 1.0f; }
+    if(i < block->rX + BWP - 1) { sum += x[cell + 1];             count += 1.0f; }
+    else if(mPeriodic[0])       { sum += x[cell - wrapX];         count += 1.0f; }
+    if(j > BWP)                 { sum += x[cell - block->mPaddY]; count += 1.0f; }
+    else if(mPeriodic[1])       { sum += x[cell + wrapY];         count += 1.0f; }
+    if(j < block->rY + BWP - 1) { sum += x[cell + block->mPaddY]; count += 1.0f; }
+    else if(mPeriodic[1])       { sum += x[cell - wrapY];         count += 1.0f; }
+    if(k > BWP)                 { sum += x[cell - block->mPaddZ]; count += 1.0f; }
+    else if(mPeriodic[2])       { sum += x[cell + wrapZ];         count += 1.0f; }
+    if(k < block->rZ + BWP - 1) { sum += x[cell + block->mPaddZ]; count += 1.0f; }
+    else if(mPeriodic[2])       { sum += x[cell - wrapZ];         count += 1.0f; }
+
+    return sum;
+  }
+
+  void Smooth(Level * level, const size_t &iterations) {
+
+    Block * block = level->block;
+
+    PrecisionType * x = level->x;
+    PrecisionType * b = level->b;
+    PrecisionType * t = level->t;
+
+    PrecisionType h2 = block->rDx * block->rDx;
+
+    for(size_t it = 0; it < iterations; it++) {
+      if(mSmoother == SMOOTHER_RBGS) {
+        for(size_t color = 0; color < 2; color++) {
+          #pragma omp parallel for
+          for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+            for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+              size_t i = block->rBWP + ((k + j + block->rBWP + color) % 2);
+              size_t cell = IndexType::GetIndex(i,j,k,block->mPaddY,block->mPaddZ);
+              for(; i < block->rX + block->rBWP; i += 2) {
+                if(!(block->pFlags[cell] & FIXED_PRESSURE)) {
+                  PrecisionType count;
+                  PrecisionType sum = Neighbours(block,x,i,j,k,cell,count);
+                  x[cell] = (h2 * b[cell] + sum) / count;
+                }
+                cell += 2;
+              }
+            }
+          }
+        }
+      } else {
+        #pragma omp parallel for
+        for(size_t k = block->rBWP; k < block->rZ + block->rBWP; k++) {
+          for(size_t j = block->rBWP; j < block->rY + block->rBWP; j++) {
+            size_t cell = IndexType::GetIndex(block->rBWP,j,k,block->mPaddY,block->mPaddZ);
+            for(size_t i = block->rBWP; i < block->rX + block->rBWP; i++) {
+              t[cell] = x[cell];
+              if(!(block->pFlags[cell] & FIXED_PRESSURE)) {
+                PrecisionType count;
+                PrecisionType sum = Neighbours(block,x,i,j,k,cell,count);
+                t[cell] += mWeight * ((h2 * b[cell] + sum) / count - x[cell]);
+              }
+              cell++;
+            }
+          }
+        }
+
+        Copy(level,t,x);
+      }
+    }
+  }
+
+  /**
+   * b(coarse) = average of the residual of the 8 children
+   **/
+  void Restrict(Level * fine, Level * coarse) {
+
+    Block * fb = fine->block;
+    Block * cb = coarse->block;
+
+    PrecisionType * r = fine->r;
+
+    #pragma omp parallel for
+    for(size_t k = BWP; k < coarse->Z + BWP; k++) {
+      for(size_t j = BWP; j < coarse->Y + BWP; j++) {
+        for(size_t i = BWP; i < coarse->X + BWP; i++) {
+          size_t cell  = IndexType::GetIndex(i,j,k,cb->mPaddY,cb->mPaddZ);
+          size_t child = IndexType::GetIndex(
+            BWP + 2 * (i - BWP),
+            BWP + 2 * (j - BWP),
+            BWP + 2 * (k - BWP),
+            fb->mPaddY, fb->mPaddZ);
+
+          coarse->b[cell] = 0.125f * (
+            r[child             ] + r[child + fb->mPaddA] +
+            r[child + fb->mPaddB] + r[child + fb->mPaddC] +
+            r[child + fb->mPaddD] + r[child + fb->mPaddE] +
+            r[child + fb->mPaddF] + r[child + fb->mPaddG]);
+
+          coarse->x[cell] = 0.0f;
+        }
+      }
+    }
+  }
+
+  /**
+   * x(fine) += trilinear interpolation of x(coarse)
+   **/
+  void Prolongate(Level * coarse, Level * fine) {
+
+    Block * fb = fine->block;
+    Block * cb = coarse->block;
+
+    PrecisionType * xc = coarse->x;
+    PrecisionType * xf = fine->x;
+
+    #pragma omp parallel for
+    for(size_t k = BWP; k < fine->Z + BWP; k++) {
+      for(size_t j = BWP; j < fine->Y + BWP; j++) {
+        for(size_t i = BWP; i < fine->X + BWP; i++) {
+          size_t cell = IndexType::GetIndex(i,j,k,fb->mPaddY,fb->mPaddZ);
+
+          if(fb->pFlags[cell] & FIXED_PRESSURE) {
+            continue;
+          }
+
+          size_t ijk[MAX_DIM] = {i, j, k};
+          size_t sizes[MAX_DIM] = {coarse->X, coarse->Y, coarse->Z};
+
+          // Parent and neighbour of the parent in the direction of the child,
+          // which wraps around the block in the periodic directions
+          size_t own[MAX_DIM];
+          size_t nbr[MAX_DIM];
+
+          for(size_t d = 0; d < MAX_DIM; d++) {
+            size_t local = ijk[d] - BWP;
+            own[d] = BWP + local / 2;
+            if(local % 2) {
+              nbr[d] = own[d] + 1 < sizes[d] + BWP ? own[d] + 1 : (mPeriodic[d] ? BWP : own[d]);
+            } else {
+              nbr[d] = own[d] > BWP ? own[d] - 1 : (mPeriodic[d] ? BWP + sizes[d] - 1 : own[d]);
+            }
+          }
+
+          PrecisionType value = 0.0f;
+
+          for(size_t c = 0; c < 8; c++) {
+            size_t ci = (c & 1) ? nbr[0] : own[0];
+            size_t cj = (c & 2) ? nbr[1] : own[1];
+            size_t ck = (c & 4) ? nbr[2] : own[2];
+
+            PrecisionType w =
+              ((c & 1) ? 0.25f : 0.75f) *
+              ((c & 2) ? 0.25f : 0.75f) *
+              ((c & 4) ? 0.25f : 0.75f);
+
+            value += w * xc[IndexType::GetIndex(ci,cj,ck,cb->mPaddY,cb->mPaddZ)];
+          }
+
+          xf[cell] += value;
+        }
+      }
+    }
+  }
+
+  void Cycle(const size_t &l) {
+
+    Level * level = mLevels[l];
+
+    if(l == mNumLevels - 1) {
+      Smooth(level,mCoarseSmooth);
+      return;
+    }
+
+    Level * coarse = mLevels[l+1];
+
+    Smooth(level,mPreSmooth);
+
+    CopyGhosts(level->block,level->x);
+    Residual(level->block,level->x,level->b,level->r);
+
+    Restrict(level,coarse);
+    RemoveNullSpace(coarse->block,coarse->b);
+
+    for(size_t c = 0; c < mCycle; c++) {
+      Cycle(l+1);
+    }
+
+    Prolongate(coarse,level);
+
+    Smooth(level,mPostSmooth);
+  }
+
+  MemManager mMemManager;
+
+  Level * mLevels[MAX_LEVELS];
+  size_t  mNumLevels;
+
+  size_t        mCycle;
+  Smoother      mSmoother;
+  size_t        mPreSmooth;
+  size_t        mPostSmooth;
+  size_t        mCoarseSmooth;
+  PrecisionType mWeight;
+};
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Phases of the solvers measured by the counters
+enum PerfPhase {
+  PERF_ADVECT_BACK,
+  PERF_ADVECT_FORTH,
+  PERF_ADVECT_ECC,
+  PERF_ACCELERATION,
+  PERF_GRADIENT,
+  PERF_LAPPLACIAN,
+  PERF_VELOCITY,
+  PERF_DIVERGENCE,
+  PERF_SMOOTHING,
+  PERF_PRESSURE,
+  MAX_PERF_PHASES
+};
+
+// Hardware events read in every phase
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_REFERENCES,
+  PERF_LLC_MISSES,
+  MAX_PERF_EVENTS
+};
+
+/**
+ * Hardware performance counters per solver phase and per thread, read with
+ * perf_event_open. Every thread of the team opens a group with its own
+ * counters, which only count while that thread runs, and the solvers read
+ * them at the beginning and the end of each phase from inside their
+ * parallel regions, so nothing is shared between threads.
+ *
+ * The memory traffic is estimated as one cache line per last level cache
+ * miss. Write-backs of dirty lines and hardware prefetches that hit are not
+ * counted, so the bandwidth is a lower bound of the real one.
+ *
+ * If the counters can not be opened (no PMU, perf_event_paranoid) only the
+ * time and the cells of the phases are reported.
+ **/
+class PerfCounters {
+public:
+
+  /**
+   * Opens the counters of every thread of the next parallel region
+   **/
+  PerfCounters() {
+
+    size_t threads = omp_get_max_threads();
+
+    mThreads.resize(threads);
+
+    #pragma omp parallel
+    {
+      size_t thread = omp_get_thread_num();
+
+      if(thread < threads) {
+        mThreads[thread] = new ThreadCounters();
+        Open(*mThreads[thread]);
+      }
+    }
+
+    mAvailable = false;
+
+    for(size_t t = 0; t < threads; t++) {
+      if(mThreads[t] != NULL && mThreads[t]->Leader >= 0) {
+        mAvailable = true;
+      }
+    }
+
+    if(!mAvailable) {
+      printf("Warning: Hardware counters not available, only times will be reported.\n");
+    }
+  }
+
+  ~PerfCounters() {
+    for(size_t t = 0; t < mThreads.size(); t++) {
+      if(mThreads[t] != NULL) {
+        Close(*mThreads[t]);
+        delete mThreads[t];
+      }
+    }
+  }
+
+  /**
+   * Starts a phase in the calling thread. The previous phase of the thread
+   * must have ended
+   * @phase:    phase
+   **/
+  void Begin(const PerfPhase &phase) {
+
+    ThreadCounters * counters = Current();
+
+    if(counters == NULL) {
+      return;
+    }
+
+    if(counters->Active != MAX_PERF_PHASES) {
+      printf("Error: Phase %s started while %s has not ended.\n",PhaseName(phase),PhaseName(counters->Active));
+      exit(1);
+    }
+
+    counters->Active = phase;
+
+    Read(*counters,counters->Start);
+    counters->StartTime = omp_get_wtime();
+  }
+
+  /**
+   * Ends a phase in the calling thread and accumulates its counters. The
+   * phase must be the one started by the thread
+   * @phase:    phase
+   * @cells:    cells updated by the thread in the phase
+   **/
+  void End(const PerfPhase &phase, const size_t &cells) {
+
+    ThreadCounters * counters = Current();
+
+    if(counters == NULL) {
+      return;
+    }
+
+    if(counters->Active != phase) {
+      printf("Error: Phase %s ended while %s is active.\n",
+        PhaseName(phase),
+        counters->Active == MAX_PERF_PHASES ? "no phase" : PhaseName(counters->Active));
+      exit(1);
+    }
+
+    counters->Active = MAX_PERF_PHASES;
+
+    uint64_t values[MAX_PERF_EVENTS];
+
+    double time = omp_get_wtime();
+
+    Read(*counters,values);
+
+    PhaseCounters &acc = counters->Interval[phase];
+
+    for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+      acc.Events[e] += values[e] - counters->Start[e];
+    }
+
+    acc.Time  += time - counters->StartTime;
+    acc.Cells += cells;
+    acc.Calls += 1;
+  }
+
+  /**
+   * Prints the counters since the previous report and adds them to the
+   * totals of the run
+   * @title:     title of the report
+   * @perThread: print also the counters of every thread
+   **/
+  void Report(const char * title, const bool &perThread) {
+
+    Print(title,&ThreadCounters::Interval,perThread);
+
+    for(size_t t = 0; t < mThreads.size(); t++) {
+      for(size_t p = 0; p < MAX_PERF_PHASES; p++) {
+        mThreads[t]->Total[p].Add(mThreads[t]->Interval[p]);
+        mThreads[t]->Interval[p] = PhaseCounters();
+      }
+    }
+  }
+
+  /**
+   * Prints the counters of the whole run, including the ones not reported
+   * yet
+   * @perThread: print also the counters of every thread
+   **/
+  void ReportTotal(const bool &perThread) {
+
+    for(size_t t = 0; t < mThreads.size(); t++) {
+      for(size_t p = 0; p < MAX_PERF_PHASES; p++) {
+        mThreads[t]->Total[p].Add(mThreads[t]->Interval[p]);
+        mThreads[t]->Interval[p] = PhaseCounters();
+      }
+    }
+
+    Print("Total",&ThreadCounters::Total,perThread);
+  }
+
+  bool IsAvailable() {
+    return mAvailable;
+  }
+
+private:
+
+  struct PhaseCounters {
+
+    PhaseCounters() : Time(0.0), Cells(0), Calls(0) {
+      for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+        Events[e] = 0;
+      }
+    }
+
+    void Add(const PhaseCounters &other) {
+      for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+        Events[e] += other.Events[e];
+      }
+
+      Time  += other.Time;
+      Cells += other.Cells;
+      Calls += other.Calls;
+    }
+
+    uint64_t Events[MAX_PERF_EVENTS];
+    double   Time;
+    size_t   Cells;
+    size_t   Calls;
+  };
+
+  // Allocated by its own thread, so threads do not share cache lines
+  struct ThreadCounters {
+
+    ThreadCounters() : Leader(-1), NumOpen(0), Active(MAX_PERF_PHASES) {
+      for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+        File[e] = -1;
+      }
+    }
+
+    int    Leader;
+    int    File[MAX_PERF_EVENTS];
+    size_t NumOpen;
+
+    uint64_t Start[MAX_PERF_EVENTS];
+    double   StartTime;
+
+    // Phase between Begin and End, MAX_PERF_PHASES if none
+    PerfPhase Active;
+
+    PhaseCounters Interval[MAX_PERF_PHASES];
+    PhaseCounters Total[MAX_PERF_PHASES];
+  };
+
+  /**
+   * Counters of the calling thread. Nested teams are not measured, their
+   * thread numbers do not identify a thread of the process
+   **/
+  ThreadCounters * Current() {
+
+    size_t thread = omp_get_thread_num();
+
+    if(omp_get_active_level() > 1 || thread >= mThreads.size()) {
+      return NULL;
+    }
+
+    return mThreads[thread];
+  }
+
+  static const char * PhaseName(const size_t &phase) {
+
+    static const char * names[MAX_PERF_PHASES] = {
+      "advect_back",
+      "advect_forth",
+      "advect_ecc",
+      "acceleration",
+      "gradient",
+      "lapplacian",
+      "velocity",
+      "divergence",
+      "smoothing",
+      "pressure"
+    };
+
+    return names[phase];
+  }
+
+  /**
+   * Opens the group of counters of the calling thread. Events not supported
+   * by the machine are left closed and read as zero
+   **/
+  static void Open(ThreadCounters &counters) {
+
+#ifdef __linux__
+    const uint64_t config[MAX_PERF_EVENTS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_REFERENCES,
+      PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+      struct perf_event_attr attr;
+
+      memset(&attr,0,sizeof(attr));
+
+      attr.type           = PERF_TYPE_HARDWARE;
+      attr.size           = sizeof(attr);
+      attr.config         = config[e];
+      attr.disabled       = counters.Leader < 0 ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv     = 1;
+      attr.read_format    = PERF_FORMAT_GROUP;
+
+      // pid 0 and cpu -1: the calling thread in any cpu
+      int file = syscall(__NR_perf_event_open,&attr,0,-1,counters.Leader,0);
+
+      if(file < 0) {
+        continue;
+      }
+
+      if(counters.Leader < 0) {
+        counters.Leader = file;
+      }
+
+      counters.File[e] = file;
+      counters.NumOpen++;
+    }
+
+    if(counters.Leader >= 0) {
+      ioctl(counters.Leader,PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+      ioctl(counters.Leader,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  static void Close(ThreadCounters &counters) {
+
+#ifdef __linux__
+    for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+      if(counters.File[e] >= 0) {
+        close(counters.File[e]);
+      }
+    }
+#endif
+  }
+
+  /**
+   * Reads the group of the calling thread. Values of the group come in the
+   * order the events were opened
+   * @counters: counters of the thread
+   * @values:   value of every event
+   **/
+  static void Read(ThreadCounters &counters, uint64_t * values) {
+
+    for(size_t e = 0; e < MAX_PERF_EVENTS; e++) {
+      values[e] = 0;
+    }
+
+#ifdef __linux__
+    if(counters.Leader < 0) {
+      return;
+    }
+
+    uint64_t buffer[1 + MAX_PERF_EVENTS];
+
+    if(read(counters.Leader,buffer,sizeof(buffer)) < (ssize_t)((1 + counters.NumOpen) * sizeof(uint64_t))) {
+      return;
+    }
+
+    for(size_t e = 0, v = 0; e < MAX_PERF_EVENTS; e++) {
+      if(counters.File[e] >= 0) {
+        values[e] = buffer[1 + v++];
+      }
+    }
+#endif
+  }
+
+  /**
+   * Prints one line of counters with the derived metrics
+   * @name:     name of the line
+   * @acc:      counters
+   * @time:     time used for the bandwidth
+   **/
+  void PrintLine(const char * name, const PhaseCounters &acc, const double &time) {
+
+    double cycles  = acc.Events[PERF_CYCLES];
+    double instr   = acc.Events[PERF_INSTRUCTIONS];
+    double refs    = acc.Events[PERF_LLC_REFERENCES];
+    double misses  = acc.Events[PERF_LLC_MISSES];
+    double bytes   = misses * CACHE_LINE;
+
+    printf("  %-14s %10.6f %12.4e %12.4e %6.2f %12.4e %6.1f%% %9.2f %8.2f\n",
+      name,
+      time,
+      cycles,
+      instr,
+      cycles > 0 ? instr / cycles : 0.0,
+      misses,
+      refs > 0 ? 100.0 * misses / refs : 0.0,
+      acc.Cells > 0 ? bytes / acc.Cells : 0.0,
+      time > 0 ? bytes / time * 1e-9 : 0.0);
+  }
+
+  /**
+   * Prints a set of counters of every phase. The time of a phase is the
+   * time of its slowest thread
+   * @title:     title of the report
+   * @set:       interval or total counters
+   * @perThread: print also the counters of every thread
+   **/
+  void Print(
+      const char * title,
+      PhaseCounters (ThreadCounters::*set)[MAX_PERF_PHASES],
+      const bool &perThread) {
+
+    printf("Counters: %s\n",title);
+    printf("  %-14s %10s %12s %12s %6s %12s %7s %9s %8s\n",
+      "phase","time (s)","cycles","instr","IPC","LLC miss","miss","B/cell","GB/s");
+
+    for(size_t p = 0; p < MAX_PERF_PHASES; p++) {
+      PhaseCounters phase;
+
+      double time = 0.0;
+
+      for(size_t t = 0; t < mThreads.size(); t++) {
+        phase.Add((mThreads[t]->*set)[p]);
+        time = std::max(time,(mThreads[t]->*set)[p].Time);
+      }
+
+      if(phase.Calls == 0) {
+        continue;
+      }
+
+      PrintLine(PhaseName(p),phase,time);
+
+      if(perThread) {
+        for(size_t t = 0; t < mThreads.size(); t++) {
+          char name[32];
+
+          sprintf(name,"  thread %zu",t);
+          PrintLine(name,(mThreads[t]->*set)[p],(mThreads[t]->*set)[p].Time);
+        }
+      }
+    }
+  }
+
+  static const size_t CACHE_LINE = 64;
+
+  std::vector<ThreadCounters *> mThreads;
+
+  bool mAvailable;
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+
+#include "defines.h"
+#include "block.h"
+#include "interpolator.h"
+
+/**
+ * In-situ sampling of fields at points, lines and planes.
+ *
+ * The corners and weights of every sample point are calculated once, when
+ * the probe is added, so sampling is a gather of the fields with the
+ * precalculated weights. Each probe appends its samples to a binary file
+ * "<prefix>_<name>.probe" with one record per sampled step:
+ *
+ *   size_t step, double time, PrecisionType values[points][components]
+ *
+ * where the components of all the fields are stored one after the other for
+ * each point. The coordinates of the points and the layout of the components
+ * are written to "<prefix>_<name>.probe.txt" the first time the probe is
+ * sampled.
+ **/
+template<class InterpolatorType = TrilinealInterpolator>
+class ProbeSet {
+public:
+
+  typedef typename InterpolatorType::WeightsType WeightsType;
+
+  /**
+   * Creates an empty set of probes
+   * @block:      block to sample
+   * @prefix:     prefix of the output files
+   * @frequency:  sample every "frequency" steps
+   **/
+  ProbeSet(Block * block, const char * prefix, const size_t &frequency) :
+      pBlock(block),
+      mPrefix(prefix),
+      mFrequency(std::max(frequency,(size_t)1)),
+      mComponents(0),
+      mStarted(false) {
+  }
+
+  ~ProbeSet() {
+    for(size_t p = 0; p < mProbes.size(); p++) {
+      if(mProbes[p].File != NULL) {
+        mProbes[p].File->close();
+        delete mProbes[p].File;
+      }
+    }
+  }
+
+  /**
+   * Adds a field to be sampled by all the probes. Fields must be added
+   * before the first call to Sample
+   * @buffer:   buffer of the block (VELOCITY, PRESSURE, ...)
+   * @dim:      number of components of the field
+   * @name:     name of the field in the description file
+   **/
+  void AddField(const size_t &buffer, const size_t &dim, const char * name) {
+
+    if(mStarted) {
+      printf("Error: Field \"%s\" added after the probes started sampling.\n",name);
+      exit(1);
+    }
+
+    Field field;
+
+    field.Buffer = buffer;
+    field.Dim    = dim;
+    field.Name   = name;
+
+    mFields.push_back(field);
+    mComponents += dim;
+  }
+
+  /**
+   * Adds a single point
+   * @name:     name of the probe
+   * @point:    coordinates of the point
+   **/
+  void AddPoint(const char * name, const PrecisionType * point) {
+
+    std::vector<PrecisionType> coords(point, point + MAX_DIM);
+
+    AddProbe(name,coords);
+  }
+
+  /**
+   * Adds a line of equally spaced points, both ends included
+   * @name:     name of the probe
+   * @from:     first point of the line
+   * @to:       last point of the line
+   * @samples:  number of points
+   **/
+  void AddLine(
+      const char * name,
+      const PrecisionType * from,
+      const PrecisionType * to,
+      const size_t &samples) {
+
+    std::vector<PrecisionType> coords(samples * MAX_DIM);
+
+    for(size_t s = 0; s < samples; s++) {
+      PrecisionType t = samples > 1 ? (PrecisionType)s / (PrecisionType)(samples - 1) : 0.0f;
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        coords[s*MAX_DIM+d] = from[d] + t * (to[d] - from[d]);
+      }
+    }
+
+    AddProbe(name,coords);
+  }
+
+  /**
+   * Adds a plane of equally spaced points spanned by two edges, edges
+   * included. Points are stored with "u" running fastest
+   * @name:     name of the probe
+   * @origin:   corner of the plane
+   * @u:        first edge, from the origin
+   * @v:        second edge, from the origin
+   * @nu:       number of points along "u"
+   * @nv:       number of points along "v"
+   **/
+  void AddPlane(
+      const char * name,
+      const PrecisionType * origin,
+      const PrecisionType * u,
+      const PrecisionType * v,
+      const size_t &nu,
+      const size_t &nv) {
+
+    std::vector<PrecisionType> coords(nu * nv * MAX_DIM);
+
+    for(size_t b = 0; b < nv; b++) {
+      PrecisionType tv = nv > 1 ? (PrecisionType)b / (PrecisionType)(nv - 1) : 0.0f;
+      for(size_t a = 0; a < nu; a++) {
+        PrecisionType tu = nu > 1 ? (PrecisionType)a / (PrecisionType)(nu - 1) : 0.0f;
+        for(size_t d = 0; d < MAX_DIM; d++) {
+          coords[(b*nu+a)*MAX_DIM+d] = origin[d] + tu * u[d] + tv * v[d];
+        }
+      }
+    }
+
+    AddProbe(name,coords);
+  }
+
+  /**
+   * Samples all the fields at all the probes, if the step is a sampling
+   * step. Points of a probe are sampled in parallel into a contiguous
+   * record that is appended to the file of the probe with a single write
+   * @step:     current step
+   * @time:     current time
+   **/
+  void Sample(const size_t &step, const double &time) {
+
+    if(step % mFrequency) {
+      return;
+    }
+
+    if(!mStarted) {
+      for(size_t p = 0; p < mProbes.size(); p++) {
+        WriteDescription(mProbes[p]);
+      }
+      mStarted = true;
+    }
+
+    for(size_t p = 0; p < mProbes.size(); p++) {
+
+      Probe &probe = mProbes[p];
+
+      size_t numPoints = probe.Weights.size();
+
+      mRecord.resize(numPoints * mComponents);
+
+      size_t offset = 0;
+
+      for(size_t f = 0; f < mFields.size(); f++) {
+
+        PrecisionType * field  = pBlock->pBuffers[mFields[f].Buffer];
+        PrecisionType * record = &mRecord[0];
+
+        const size_t dim = mFields[f].Dim;
+        const size_t components = mComponents;
+
+        #pragma omp parallel for if(numPoints > 1024)
+        for(size_t s = 0; s < numPoints; s++) {
+          InterpolatorType::Apply(field,record+s*components+offset,probe.Weights[s],dim);
+        }
+
+        offset += dim;
+      }
+
+      probe.File->write((const char *)&step,sizeof(size_t));
+      probe.File->write((const char *)&time,sizeof(double));
+      probe.File->write((const char *)&mRecord[0],sizeof(PrecisionType) * mRecord.size());
+      probe.File->flush();
+    }
+  }
+
+  /**
+   * Returns the number of probes
+   **/
+  size_t GetNumProbes() {
+    return mProbes.size();
+  }
+
+private:
+
+  struct Field {
+    size_t Buffer;
+    size_t Dim;
+    std::string Name;
+  };
+
+  struct Probe {
+    std::string Name;
+    std::vector<PrecisionType> Coords;
+    std::vector<WeightsType> Weights;
+    std::ofstream * File;
+  };
+
+  /**
+   * Calculates the weights of the points of a probe and opens its file
+   * @name:     name of the probe
+   * @coords:   coordinates of the points
+   **/
+  void AddProbe(const char * name, const std::vector<PrecisionType> &coords) {
+
+    Probe probe;
+
+    probe.Name   = name;
+    probe.Coords = coords;
+    probe.Weights.resize(coords.size() / MAX_DIM);
+
+    for(size_t s = 0; s < probe.Weights.size(); s++) {
+      PrecisionType point[MAX_DIM] = {
+        coords[s*MAX_DIM+0],
+        coords[s*MAX_DIM+1],
+        coords[s*MAX_DIM+2]
+      };
+
+      InterpolatorType::template CalculateWeights<true>(pBlock,point,probe.Weights[s]);
+    }
+
+    std::stringstream fileName;
+
+    fileName << mPrefix << "_" << name << ".probe";
+
+    probe.File = new std::ofstream(fileName.str().c_str(), std::ios::out | std::ios::binary);
+
+    if(!probe.File->is_open()) {
+      printf("Error: Unable to open the probe file \"%s\".\n",fileName.str().c_str());
+      exit(1);
+    }
+
+    mProbes.push_back(probe);
+  }
+
+  /**
+   * Writes the points and the layout of the records of a probe
+   * @probe:    probe
+   **/
+  void WriteDescription(const Probe &probe) {
+
+    std::stringstream fileName;
+
+    fileName << mPrefix << "_" << probe.Name << ".probe.txt";
+
+    std::ofstream file(fileName.str().c_str());
+
+    file << "# probe "      << probe.Name << std::endl;
+    file << "# precision "  << sizeof(PrecisionType) << std::endl;
+    file << "# points "     << probe.Weights.size() << std::endl;
+    file << "# components " << mComponents << std::endl;
+
+    for(size_t f = 0; f < mFields.size(); f++) {
+      file << "# field " << mFields[f].Name << " " << mFields[f].Dim << std::endl;
+    }
+
+    for(size_t s = 0; s < probe.Weights.size(); s++) {
+      file << probe.Coords[s*MAX_DIM+0] << " "
+           << probe.Coords[s*MAX_DIM+1] << " "
+           << probe.Coords[s*MAX_DIM+2] << std::endl;
+    }
+
+    file.close();
+  }
+
+  Block * pBlock;
+
+  std::string mPrefix;
+
+  size_t mFrequency;
+  size_t mComponents;
+  bool   mStarted;
+
+  std::vector<Field> mFields;
+  std::vector<Probe> mProbes;
+  std::vector<PrecisionType> mRecord;
+};
+
+#endif
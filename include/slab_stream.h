@@ -0,0 +1,250 @@
+#ifndef SLAB_STREAM_H
+#define SLAB_STREAM_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "defines.h"
+
+/**
+ * Out-of-core storage of the grids. Every grid lives in a file mapped in
+ * memory, so the grids can be larger than the RAM. The solvers walk the
+ * grids in k-slabs and notify every slab to the stream, which keeps a
+ * bounded window of slabs mapped around it: the next slabs are prefetched
+ * and the write-back of the finished ones is started, both asynchronously
+ * so the disk works while the solver computes. Dropping a slab is always
+ * safe, if it is needed again it is read back from the file.
+ *
+ * Slabs do not start at page boundaries. Only the pages that lie entirely
+ * behind the next slab are dropped, so the page shared with it is kept.
+ **/
+class SlabStream {
+public:
+
+  /**
+   * Creates an empty stream
+   * @directory:  directory of the files of the grids
+   * @ahead:      slabs to prefetch ahead of the current one
+   * @behind:     slabs to keep mapped behind the current one
+   **/
+  SlabStream(const char * directory, const size_t &ahead, const size_t &behind) :
+      mDirectory(directory),
+      mAhead(ahead),
+      mBehind(behind) {
+
+#ifndef _WIN32
+    mPageSize = sysconf(_SC_PAGESIZE);
+#else
+    mPageSize = 1;
+#endif
+  }
+
+  ~SlabStream() {
+    for(size_t g = 0; g < mGrids.size(); g++) {
+      Unmap(mGrids[g]);
+    }
+  }
+
+  /**
+   * Allocates a grid in a mapped file. Same interface as MemManager
+   * @grid:     grid to allocate
+   * @X,Y,Z:    size of the grid without padding
+   * @dim:      components per cell
+   **/
+  template <typename T>
+  void AllocateGrid(
+      T ** grid,
+      const size_t &X,
+      const size_t &Y,
+      const size_t &Z,
+      const size_t &dim) {
+
+#ifndef _WIN32
+    MappedGrid mapped;
+
+    std::stringstream name;
+
+    name << mDirectory << "/grid_" << mGrids.size() << ".raw";
+
+    mapped.Name      = name.str();
+    mapped.SlabBytes = (X+BW) * (Y+BW) * sizeof(T) * dim;
+    mapped.Slabs     = Z+BW;
+    mapped.Bytes     = mapped.SlabBytes * mapped.Slabs;
+
+    mapped.File = open(mapped.Name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if(mapped.File < 0) {
+      printf("Error: Unable to create the grid file \"%s\".\n",mapped.Name.c_str());
+      exit(1);
+    }
+
+    if(ftruncate(mapped.File, mapped.Bytes) != 0) {
+      printf("Error: Unable to resize the grid file \"%s\" to %zu bytes.\n",mapped.Name.c_str(),mapped.Bytes);
+      exit(1);
+    }
+
+    mapped.Data = (char *)mmap(NULL, mapped.Bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mapped.File, 0);
+
+    if(mapped.Data == MAP_FAILED) {
+      printf("Error: Unable to map the grid file \"%s\".\n",mapped.Name.c_str());
+      exit(1);
+    }
+
+    mapped.Warned = false;
+
+    if(madvise(mapped.Data, mapped.Bytes, MADV_SEQUENTIAL) != 0) {
+      warn(mapped,"madvise(MADV_SEQUENTIAL)");
+    }
+
+    mGrids.push_back(mapped);
+
+    *grid = (T *)mapped.Data;
+#else
+    printf("Error: Out-of-core grids are not supported on Windows.\n");
+    exit(1);
+#endif
+  }
+
+  /**
+   * Releases a grid allocated by the stream and removes its file
+   * @grid:     grid to release
+   **/
+  template <typename T>
+  void ReleaseGrid(T ** grid) {
+
+    for(size_t g = 0; g < mGrids.size(); g++) {
+      if(mGrids[g].Data == (char *)*grid) {
+        Unmap(mGrids[g]);
+        mGrids.erase(mGrids.begin() + g);
+        *grid = NULL;
+        return;
+      }
+    }
+  }
+
+  /**
+   * Notifies that the solver starts working in a slab. Can be called from
+   * several threads at the same time
+   * @k:        index of the slab
+   **/
+  void Slab(const size_t &k) {
+
+#ifndef _WIN32
+    for(size_t g = 0; g < mGrids.size(); g++) {
+      MappedGrid &mapped = mGrids[g];
+
+      size_t next = k + mAhead;
+
+      // Every page that holds a part of the slab
+      if(next < mapped.Slabs) {
+        size_t begin = pageDown(next * mapped.SlabBytes);
+        size_t end   = std::min(pageUp((next + 1) * mapped.SlabBytes),mapped.Bytes);
+
+        if(madvise(mapped.Data + begin, end - begin, MADV_WILLNEED) != 0) {
+          warn(mapped,"madvise(MADV_WILLNEED)");
+        }
+      }
+
+      // Pages that end before the slab after the finished one
+      if(k >= mBehind + 1) {
+        size_t done  = k - mBehind - 1;
+        size_t begin = pageDown(done * mapped.SlabBytes);
+        size_t end   = pageDown((done + 1) * mapped.SlabBytes);
+
+        if(end > begin) {
+          if(sync_file_range(mapped.File, begin, end - begin, SYNC_FILE_RANGE_WRITE) != 0) {
+            warn(mapped,"sync_file_range");
+          }
+
+          if(madvise(mapped.Data + begin, end - begin, MADV_DONTNEED) != 0) {
+            warn(mapped,"madvise(MADV_DONTNEED)");
+          }
+        }
+      }
+    }
+#endif
+  }
+
+  /**
+   * Returns the bytes of all the grids of the stream
+   **/
+  size_t GetBytes() {
+
+    size_t bytes = 0;
+
+    for(size_t g = 0; g < mGrids.size(); g++) {
+      bytes += mGrids[g].Bytes;
+    }
+
+    return bytes;
+  }
+
+private:
+
+  struct MappedGrid {
+    std::string Name;
+    int File;
+    char * Data;
+    size_t SlabBytes;
+    size_t Slabs;
+    size_t Bytes;
+    bool Warned;
+  };
+
+  size_t pageDown(const size_t &offset) {
+    return offset - offset % mPageSize;
+  }
+
+  size_t pageUp(const size_t &offset) {
+    return pageDown(offset + mPageSize - 1);
+  }
+
+  /**
+   * Reports the first failure of a call on a grid. The stream keeps
+   * working, it only loses the prefetch or the early write-back.
+   * @mapped:   grid
+   * @call:     call that failed
+   **/
+  void warn(MappedGrid &mapped, const char * call) {
+
+    int error = errno;
+
+    #pragma omp critical(slab_stream_warn)
+    {
+      if(!mapped.Warned) {
+        printf("Warning: %s failed on the grid file \"%s\": %s.\n",call,mapped.Name.c_str(),strerror(error));
+        mapped.Warned = true;
+      }
+    }
+  }
+
+  void Unmap(MappedGrid &mapped) {
+#ifndef _WIN32
+    munmap(mapped.Data, mapped.Bytes);
+    close(mapped.File);
+    unlink(mapped.Name.c_str());
+#endif
+  }
+
+  std::string mDirectory;
+
+  size_t mAhead;
+  size_t mBehind;
+
+  size_t mPageSize;
+
+  std::vector<MappedGrid> mGrids;
+};
+
+#endif
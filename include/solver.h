@@ -6,15 +6,24 @@
 #include "defines.h"
 #include "utils.h"
 #include "block.h"
+#include "grid.h"
+#include "slab_stream.h"
+#include "perf_counters.h"
 #include "kernels.h"
 #include "interpolator.h"
-
-template<class Derived>
+#include "ghost_fill.h"
+
+/**
+ * Base of the solvers
+ * @Derived:           solver implementation (CRTP)
+ * @InterpolatorType:  interpolation policy used by the solver
+ **/
+template<class Derived, class InterpolatorType = TrilinealInterpolator>
 class Solver {
 public:
 
   typedef Block::IndexType        IndexType;
-  typedef TrilinealInterpolator   InterpolateType;
+  typedef InterpolatorType        InterpolateType;
 
   Solver(Block * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
       pBlock(block),
@@ -37,7 +46,11 @@ public:
       rZ(block->rZ),
       rNB(block->rNB),
       rNE(block->rNE),
-      rDim(block->rDim) {
+      rDim(block->rDim),
+      mGrid(block),
+      mGhosts(block),
+      pStream(NULL),
+      pCounters(NULL) {
   }
 
   ~Solver() {
@@ -47,17 +60,20 @@ public:
       PrecisionType * buff,
       size_t * nodeList,
       size_t nodeListSize,
-      size_t * normal,
+      const long * normal,
       int bcType,
       size_t dim) {
 
+    // Offset of the neighbour in the direction of the normal
+    long offset = (long)((rZ+rBW)*(rY+rBW))*normal[2]+(long)(rZ+rBW)*normal[1]+normal[0];
+
     // Difference
     if(bcType == 0) {
       #pragma omp parallel for
       for(size_t n = 0; n < nodeListSize; n++) {
         size_t cell = nodeList[n];
-        size_t prev = cell-(rZ+rBW)*(rY+rBW)*normal[2]-(rZ+rBW)*normal[1]-normal[0];
-        size_t next = cell+(rZ+rBW)*(rY+rBW)*normal[2]+(rZ+rBW)*normal[1]+normal[0];
+        size_t prev = cell-offset;
+        size_t next = cell+offset;
 
         for(size_t d = 0; d < dim; d++)
           buff[next*dim+d] = 2 * buff[cell*dim+d] - buff[prev*dim+d];
@@ -69,7 +85,7 @@ public:
       #pragma omp parallel for
       for(size_t n = 0; n < nodeListSize; n++) {
         size_t cell = nodeList[n];
-        size_t next = cell+(rZ+rBW)*(rY+rBW)*normal[2]+(rZ+rBW)*normal[1]+normal[0];
+        size_t next = cell+offset;
 
         for(size_t d = 0; d < dim; d++)
           buff[next*dim+d] = buff[cell*dim+d];
@@ -78,163 +94,75 @@ public:
 
   }
 
+  /**
+   * Fills all the ghost cells of a field (faces, edges and corners) in one
+   * pass, with the boundaries set with SetPeriodic
+   * @buff:     field
+   * @dim:      components of the field
+   **/
   void copyAll(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t a = 0; a < rY + rBW; a++) {
-      for(size_t b = 0; b < rX + rBW; b++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(0,a,b)*dim+d] = buff[INDEX(1,a,b)*dim+d];
-          buff[INDEX(a,0,b)*dim+d] = buff[INDEX(a,1,b)*dim+d];
-          buff[INDEX(a,b,0)*dim+d] = buff[INDEX(a,b,1)*dim+d];
-
-          buff[INDEX(rX + rBW - 1,a,b)*dim+d] = buff[INDEX(rX + rBW - 2,a,b)*dim+d];
-          buff[INDEX(a,rY + rBW - 1,b)*dim+d] = buff[INDEX(a,rY + rBW - 2,b)*dim+d];
-          buff[INDEX(a,b,rZ + rBW - 1)*dim+d] = buff[INDEX(a,b,rZ + rBW - 2)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
-  }
-
-  void copyLeft(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(0,j,k)*dim+d] = buff[INDEX(1,j,k)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
-  }
-
-  void copyRight(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(rX + rBW - 1,j,k)*dim+d] = buff[INDEX(rX + rBW - 2,j,k)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
-  }
-
-  void copyDown(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t i = 0; i < rX + rBW; i++) {
-      for(size_t k = 0; k < rZ + rBW; k++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(i,0,k)*dim+d] = buff[INDEX(i,1,k)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
-  }
-
-  void copyUp(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t i = 0; i < rX + rBW; i++) {
-      for(size_t k = 0; k < rZ + rBW; k++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(i,rY + rBW - 1,k)*dim+d] = buff[INDEX(i,rY + rBW - 2,k)*dim+d];
-        }
-      }
+    mGhosts.Fill(buff,dim);
+  }
+
+  /**
+   * Sets the ghost cells of a direction to wrap around the block instead
+   * of copying the adjacent interior cell
+   * @axis:     direction (0: x, 1: y, 2: z)
+   * @periodic: true for periodic, false for Neumann
+   **/
+  void SetPeriodic(const size_t &axis, const bool &periodic) {
+    mGhosts.SetPeriodic(axis,periodic);
+  }
+
+  /**
+   * Sets the stream notified of the k-slabs walked by the solver, used
+   * when the buffers are out-of-core
+   * @stream:   stream of the buffers or NULL
+   **/
+  void SetStream(SlabStream * stream) {
+    pStream = stream;
+  }
+
+  /**
+   * Notifies the stream, if any, that the solver starts a k-slab
+   * @k:        index of the slab
+   **/
+  inline void streamSlab(const size_t &k) {
+    if(pStream != NULL) {
+      pStream->Slab(k);
     }
-
-    #undef INDEX
-
   }
 
-  void copyBack(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t i = 0; i < rX + rBW; i++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(i,j,0)*dim+d] = buff[INDEX(i,j,1)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
+  /**
+   * Sets the hardware counters read at the beginning and the end of every
+   * phase of the solver
+   * @counters: counters or NULL
+   **/
+  void SetCounters(PerfCounters * counters) {
+    pCounters = counters;
   }
 
-  void copyFront(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t i = 0; i < rX + rBW; i++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(i,j,rZ + rBW - 1)*dim+d] = buff[INDEX(i,j,rZ + rBW - 2)*dim+d];
-        }
-      }
+  /**
+   * Starts a phase in the counters, if any. Called by every thread
+   * @phase:    phase
+   **/
+  inline void phaseBegin(const PerfPhase &phase) {
+    if(pCounters != NULL) {
+      pCounters->Begin(phase);
     }
-
-    #undef INDEX
-
   }
 
-  void copyLeftToRight(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(0,j,k)*dim+d] = buff[INDEX(rX + rBW - 2,j,k)*dim+d];
-        }
-      }
+  /**
+   * Ends a phase in the counters, if any. Called by every thread
+   * @phase:    phase
+   * @kb,ke:    slabs of the thread
+   * @grid:     grid of the block
+   **/
+  template<class GridType>
+  inline void phaseEnd(const PerfPhase &phase, const size_t &kb, const size_t &ke, const GridType &grid) {
+    if(pCounters != NULL) {
+      pCounters->End(phase,(ke-kb)*grid.X*grid.Y);
     }
-
-    #undef INDEX
-
-  }
-
-  void copyUpToDown(PrecisionType * buff, size_t dim) {
-
-    #define INDEX(I,J,K) IndexType::GetIndex((I),(J),(K),pBlock->mPaddY,pBlock->mPaddZ)
-
-    #pragma omp parallel for
-    for(size_t k = 0; k < rZ + rBW; k++) {
-      for(size_t j = 0; j < rY + rBW; j++) {
-        for(size_t d = 0; d < dim; d++) {
-          buff[INDEX(j,k,1)*dim+d] = buff[INDEX(j,k,rX + rBW - 2)*dim+d];
-        }
-      }
-    }
-
-    #undef INDEX
-
   }
 
   void Prepare() {
@@ -257,6 +185,10 @@ public:
     static_cast<Derived*>(this)->ExecuteTask_impl();
   }
 
+  void ExecuteActive() {
+    static_cast<Derived*>(this)->ExecuteActive_impl();
+  }
+
 protected:
 
   Block * pBlock;
@@ -289,6 +221,15 @@ protected:
   const size_t &rNE;
 
   const size_t &rDim;
+
+  // Sizes and strides of the grid, for the kernels templated on the grid
+  const DynamicGrid mGrid;
+
+  GhostFill mGhosts;
+
+  SlabStream * pStream;
+
+  PerfCounters * pCounters;
 };
 
 #endif
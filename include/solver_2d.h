@@ -0,0 +1,119 @@
+#ifndef SOLVER_2D_H
+#define SOLVER_2D_H
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "defines.h"
+#include "utils.h"
+#include "block_2d.h"
+#include "ghost_fill.h"
+#include "topology.h"
+#include "interpolator.h"
+
+/**
+ * Base of the 2D solvers, the counterpart of Solver for a Block2D. Rows
+ * take the place of the slabs: every parallel loop gives each thread the
+ * rows of OwnedSlabs over the Y extent of the block.
+ * @Derived:           solver implementation (CRTP)
+ * @InterpolatorType:  interpolation policy used by the solver
+ **/
+template<class Derived, class InterpolatorType = BilinealInterpolator>
+class Solver2D {
+public:
+
+  typedef Block2D::IndexType      IndexType;
+  typedef InterpolatorType        InterpolateType;
+
+  Solver2D(Block2D * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
+      pBlock(block),
+      pBuffers(block->pBuffers),
+      pFlags(block->pFlags),
+      rDx(block->rDx),
+      rIdx(1.0f/block->rDx),
+      rDt(Dt),
+      rIdt(1.0f/Dt),
+      rPdt(Pdt),
+      rRo(block->rRo),
+      rMu(block->rMu),
+      rKa(block->rKa),
+      rCC2(block->rCC2),
+      rBW(block->rBW),
+      rBWP(block->rBW/2),
+      rX(block->rX),
+      rY(block->rY),
+      rDim(block->rDim),
+      mGhosts(block) {
+  }
+
+  ~Solver2D() {
+  }
+
+  /**
+   * Fills all the ghost cells of a field (edges and corners) in one pass,
+   * with the boundaries set with SetPeriodic
+   * @buff:     field
+   * @dim:      components of the field
+   **/
+  void copyAll(PrecisionType * buff, size_t dim) {
+    mGhosts.Fill(buff,dim);
+  }
+
+  /**
+   * Sets the ghost cells of a direction to wrap around the block instead
+   * of copying the adjacent interior cell
+   * @axis:     direction (0: x, 1: y)
+   * @periodic: true for periodic, false for Neumann
+   **/
+  void SetPeriodic(const size_t &axis, const bool &periodic) {
+    mGhosts.SetPeriodic(axis,periodic);
+  }
+
+  void Prepare() {
+    static_cast<Derived*>(this)->Prepare_impl();
+  }
+
+  void Finish() {
+    static_cast<Derived*>(this)->Finish_impl();
+  }
+
+  void Execute() {
+    static_cast<Derived*>(this)->Execute_impl();
+  }
+
+  void ExecuteTask() {
+    static_cast<Derived*>(this)->ExecuteTask_impl();
+  }
+
+protected:
+
+  Block2D * pBlock;
+
+  PrecisionType ** pBuffers;
+
+  uint * pFlags;
+
+  const PrecisionType & rDx;
+  const PrecisionType rIdx;
+  const PrecisionType & rDt;
+  const PrecisionType rIdt;
+  const PrecisionType & rPdt;
+
+  const PrecisionType & rRo;
+  const PrecisionType & rMu;
+  const PrecisionType & rKa;
+
+  const PrecisionType & rCC2;
+
+  const size_t &rBW;
+  const size_t  rBWP;
+
+  const size_t &rX;
+  const size_t &rY;
+
+  const size_t &rDim;
+
+  GhostFill mGhosts;
+};
+
+#endif
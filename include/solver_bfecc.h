@@ -1,11 +1,26 @@
 #include "solver.h"
 
-class BfeccSolver : public Solver<BfeccSolver> {
+/**
+ * BFECC advection solver
+ * @InterpolatorType:  interpolation policy used to find the departure values
+ **/
+template<class InterpolatorType = TrilinealInterpolator>
+class BfeccSolver : public Solver<BfeccSolver<InterpolatorType>,InterpolatorType> {
 public:
 
+  typedef Solver<BfeccSolver<InterpolatorType>,InterpolatorType> BaseType;
+
+  typedef typename BaseType::IndexType        IndexType;
+  typedef typename BaseType::InterpolateType  InterpolateType;
+
   BfeccSolver(Block * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
-      Solver(block,Dt,Pdt) {
+      BaseType(block,Dt,Pdt),
+      mActiveReady(false),
+      mMaxVelocityKnown(false) {
 
+    if(pBlock->pRunOffset == NULL) {
+      pBlock->BuildFluidRuns();
+    }
   }
 
   ~BfeccSolver() {
@@ -18,28 +33,101 @@ public:
   void Finish_impl() {
   }
 
+  /**
+   * Sets the maximum velocity component for the next advection, as given by
+   * Block::calculateMaxVelocity, so the advection does not reduce it again.
+   * Advections without it reduce the velocity of the block themselves.
+   * @maxv:     maximum velocity component
+   **/
+  void SetMaxVelocity(const PrecisionType &maxv) {
+    mMaxVelocity      = maxv;
+    mMaxVelocityKnown = true;
+  }
+
+  /**
+   * Field advected by AdvectFields
+   * @Phi:      field to advect
+   * @Result:   advected field. Also holds the backward step
+   * @Aux:      auxiliar buffer for the forward step
+   * @Dim:      number of components of the field
+   **/
+  struct AdvectedField {
+    PrecisionType * Phi;
+    PrecisionType * Result;
+    PrecisionType * Aux;
+    size_t Dim;
+  };
+
   /**
    * Executes the solver in parallel
    **/
   void Execute_impl() {
 
-    PrecisionType * aux_3d_0 = pBuffers[VELOCITY];
-    PrecisionType * aux_3d_1 = pBuffers[AUX_3D_1];
-    PrecisionType * aux_3d_3 = pBuffers[AUX_3D_3];
+    AdvectedField velocity = {
+      pBuffers[VELOCITY],
+      pBuffers[AUX_3D_1],
+      pBuffers[AUX_3D_3],
+      rDim
+    };
+
+    AdvectFields(&velocity,1);
+  }
+
+  /**
+   * Advects a set of fields of any dimension with the velocity of the block.
+   * Departure points and interpolation weights are calculated once per cell
+   * and applied to all the fields.
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   **/
+  void AdvectFields(AdvectedField * fields, const size_t &numFields) {
+
+    pBlock->UpdateFluidRuns();
+
+    DISPATCH_GRID(pBlock,AdvectFieldsGrid,fields,numFields)
+  }
+
+  /**
+   * Executes the solver only over the active tiles of the block. The first
+   * call advects the whole block so all the buffers are initialized.
+   **/
+  void ExecuteActive_impl() {
+
+    if(!mActiveReady) {
+      Execute_impl();
+      mActiveReady = true;
+      return;
+    }
+
+    AdvectedField velocity = {
+      pBuffers[VELOCITY],
+      pBuffers[AUX_3D_1],
+      pBuffers[AUX_3D_3],
+      rDim
+    };
+
+    AdvectFieldsActive(&velocity,1);
+  }
+
+  /**
+   * Same as AdvectFields but only over the active tiles of the block. Fields
+   * are not modified in quiet tiles, so the tiles retired in the last update
+   * copy the field to the result and auxiliar buffers, which may still be
+   * read by the interpolation of the neighbouring active tiles.
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   **/
+  void AdvectFieldsActive(AdvectedField * fields, const size_t &numFields) {
 
     size_t listL[rX*rX];
     size_t listR[rX*rX];
-    size_t listF[rX*rX];
-    size_t listB[rX*rX];
-    size_t listT[rX*rX];
-    size_t listD[rX*rX];
-
-    size_t normalL[3] = {0,-1,0};
-    size_t normalR[3] = {0,1,0};
-    size_t normalF[3] = {-1,0,0};
-    size_t normalB[3] = {1,0,0};
-    size_t normalT[3] = {0,0,-1};
-    size_t normalD[3] = {0,0,1};
+
+    long normalL[3] = {0,-1,0};
+    long normalR[3] = {0,1,0};
+
+    // Boundary conditions only apply on the faces on the border of the domain
+    size_t sizeL = pBlock->mDomainFace[FACE_Y_LOW]  ? rX*rX : 0;
+    size_t sizeR = pBlock->mDomainFace[FACE_Y_HIGH] ? rX*rX : 0;
 
     uint counter = 0;
 
@@ -48,54 +136,82 @@ public:
 
         listL[counter] = a*(rZ+rBW)*(rY+rBW)+2*(rZ+rBW)+b;
         listR[counter] = a*(rZ+rBW)*(rY+rBW)+(rY-1)*(rZ+rBW)+b;
-        listF[counter] = a*(rZ+rBW)*(rY+rBW)+b*(rZ+rBW)+2;
-        listB[counter] = a*(rZ+rBW)*(rY+rBW)+b*(rZ+rBW)+(rX-1);
-        listT[counter] = 1*(rZ+rBW)*(rY+rBW)+a*(rZ+rBW)+b;
-        listD[counter] = rZ*(rZ+rBW)*(rY+rBW)+a*(rZ+rBW)+b;
 
         counter++;
       }
     }
 
-    applyBc(aux_3d_0,listL,rX*rX,normalL,1,3);
-    applyBc(aux_3d_0,listR,rX*rX,normalR,1,3);
-
-    #pragma omp parallel for
-    for(size_t k = rBWP; k < rZ + rBWP; k++) {
-      for(size_t j = rBWP; j < rY + rBWP; j++) {
-        for(size_t i = rBWP; i < rX + rBWP; i++) {
-          ApplyBack(aux_3d_1,aux_3d_0,aux_3d_0,i,j,k);
+    size_t low[MAX_DIM];
+    size_t high[MAX_DIM];
+
+    calculateSafeRangeActive(low,high);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t r = 0; r < pBlock->mNumRetired; r++) {
+      size_t tileLow[MAX_DIM], tileHigh[MAX_DIM];
+      pBlock->GetTileRange(pBlock->pRetiredList[r],tileLow,tileHigh);
+      for(size_t k = tileLow[2]; k < tileHigh[2]; k++) {
+        for(size_t j = tileLow[1]; j < tileHigh[1]; j++) {
+          for(size_t f = 0; f < numFields; f++) {
+            const size_t &dim = fields[f].Dim;
+            size_t cb = IndexType::GetIndex(tileLow[0] ,j,k,pBlock->mPaddY,pBlock->mPaddZ) * dim;
+            size_t ce = IndexType::GetIndex(tileHigh[0],j,k,pBlock->mPaddY,pBlock->mPaddZ) * dim;
+            for(size_t c = cb; c < ce; c++) {
+              fields[f].Result[c] = fields[f].Phi[c];
+              fields[f].Aux[c]    = fields[f].Phi[c];
+            }
+          }
         }
       }
     }
 
-    applyBc(aux_3d_1,listL,rX*rX,normalL,1,3);
-    applyBc(aux_3d_1,listR,rX*rX,normalR,1,3);
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Phi,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Phi,listR,sizeR,normalR,1,fields[f].Dim);
+    }
 
-    #pragma omp parallel for
-    for(size_t k = rBWP; k < rZ + rBWP; k++) {
-      for(size_t j = rBWP; j < rY + rBWP; j++) {
-        for(size_t i = rBWP; i < rX + rBWP; i++) {
-          ApplyForth(aux_3d_3,aux_3d_1,aux_3d_0,i,j,k);
-        }
-      }
+    applyFieldsActive<PHASE_BACK>(fields,numFields,low,high);
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Result,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Result,listR,sizeR,normalR,1,fields[f].Dim);
     }
 
-    applyBc(aux_3d_3,listL,rX*rX,normalL,1,3);
-    applyBc(aux_3d_3,listR,rX*rX,normalR,1,3);
+    applyFieldsActive<PHASE_FORTH>(fields,numFields,low,high);
 
-    #pragma omp parallel for
-    for(size_t k = rBWP; k < rZ + rBWP; k++) {
-      for(size_t j = rBWP; j < rY + rBWP; j++) {
-        for(size_t i = rBWP; i < rX + rBWP; i++) {
-          ApplyEcc(aux_3d_1,aux_3d_3,i,j,k);
-        }
-      }
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Aux,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Aux,listR,sizeR,normalR,1,fields[f].Dim);
     }
 
-    applyBc(aux_3d_1,listL,rX*rX,normalL,1,3);
-    applyBc(aux_3d_1,listR,rX*rX,normalR,1,3);
+    applyFieldsActive<PHASE_ECC>(fields,numFields,low,high);
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Result,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Result,listR,sizeR,normalR,1,fields[f].Dim);
+    }
+  }
 
+  /**
+   * Same as AdvectFields but only over a list of cells, like the narrow band
+   * of a level set. Cells outside the list are not modified and must hold
+   * the same value in the field, result and auxiliar buffers, since they
+   * can be read by the interpolation of the cells of the list. Boundary
+   * conditions are not applied.
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @cells:      index of the cells
+   * @numCells:   number of cells
+   **/
+  void AdvectFieldsList(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t * cells,
+      const size_t &numCells) {
+
+    applyFieldsList<PHASE_BACK>(fields,numFields,cells,numCells);
+    applyFieldsList<PHASE_FORTH>(fields,numFields,cells,numCells);
+    applyFieldsList<PHASE_ECC>(fields,numFields,cells,numCells);
   }
 
   /**
@@ -103,8 +219,9 @@ public:
    **/
   void ExecuteTask_impl() {
 
+    // The last block ends at the padded size even if rNE*rNB does not match it
     #define BOT(_i_) std::max(rBWP,(_i_ * rNE))
-    #define TOP(_i_) rBWP + std::min(rNE*rNB-rBWP,((_i_+1) * rNE))
+    #define TOP(_i_) rBWP + std::min(rX+rBW-rBWP,((_i_+1) * rNE))
 
     PrecisionType * aux_3d_0 = pBuffers[VELOCITY];
     PrecisionType * aux_3d_1 = pBuffers[AUX_3D_1];
@@ -184,8 +301,9 @@ public:
    **/
   void ExecuteBlock_impl() {
 
+    // The last block ends at the padded size even if rNE*rNB does not match it
     #define BOT(_i_) std::max(rBWP,(_i_ * rNE))
-    #define TOP(_i_) rBWP + std::min(rNE*rNB-rBWP,((_i_+1) * rNE))
+    #define TOP(_i_) rBWP + std::min(rX+rBW-rBWP,((_i_+1) * rNE))
 
     PrecisionType * aux_3d_0 = pBuffers[VELOCITY];
     PrecisionType * aux_3d_1 = pBuffers[AUX_3D_1];
@@ -271,7 +389,7 @@ public:
       displacement[d] = origin[d] - pBuffers[VELOCITY][cell*rDim+d] * rDt;
     }
 
-    InterpolateType::Interpolate(pBlock,PhiAuxB,(PrecisionType*)iPhi,displacement,rDim);
+    InterpolateType::template Interpolate<MAX_DIM,true>(pBlock,PhiAuxB,(PrecisionType*)iPhi,displacement);
 
     Phi[cell*rDim+0] = iPhi[0];
     Phi[cell*rDim+1] = iPhi[1];
@@ -307,7 +425,7 @@ public:
       displacement[d] = origin[d] + pBuffers[VELOCITY][cell*rDim+d] * rDt;
     }
 
-    InterpolateType::Interpolate(pBlock,PhiAuxA,(PrecisionType*)iPhi,displacement,rDim);
+    InterpolateType::template Interpolate<MAX_DIM,true>(pBlock,PhiAuxA,(PrecisionType*)iPhi,displacement);
 
     Phi[cell*rDim+0] = 1.5f * PhiAuxB[cell*rDim+0] - 0.5f * iPhi[0];
     Phi[cell*rDim+1] = 1.5f * PhiAuxB[cell*rDim+1] - 0.5f * iPhi[1];
@@ -335,10 +453,524 @@ public:
       displacement[d] = origin[d] - pBuffers[VELOCITY][cell*rDim+d] * rDt;
     }
 
-    InterpolateType::Interpolate(pBlock,PhiAuxA,(PrecisionType*)iPhi,displacement,rDim);
+    InterpolateType::template Interpolate<MAX_DIM,true>(pBlock,PhiAuxA,(PrecisionType*)iPhi,displacement);
 
     Phi[cell*rDim+0] = iPhi[0];
     Phi[cell*rDim+1] = iPhi[1];
     Phi[cell*rDim+2] = iPhi[2];
   }
+
+  /**
+   * Backward step of AdvectFields over a given cell
+   * @grid:       grid of the block
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j,k:      Index of the cell
+   **/
+  template<bool Clamp, class GridType>
+  void ApplyBackFields(
+      const GridType &grid,
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t cell = IndexType::GetIndex(i,j,k,grid.Pitch,grid.Slice);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[MAX_DIM];
+
+    displacement[0] = (PrecisionType)i * rDx - pBuffers[VELOCITY][cell*grid.Dim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx - pBuffers[VELOCITY][cell*grid.Dim+1] * rDt;
+    displacement[2] = (PrecisionType)k * rDx - pBuffers[VELOCITY][cell*grid.Dim+2] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(grid,pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+      applyWeights(fields[f].Phi,&fields[f].Result[cell*dim],weights,dim);
+    }
+  }
+
+  /**
+   * Forward step of AdvectFields over a given cell
+   * @grid:       grid of the block
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j,k:      Index of the cell
+   **/
+  template<bool Clamp, class GridType>
+  void ApplyForthFields(
+      const GridType &grid,
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t cell = IndexType::GetIndex(i,j,k,grid.Pitch,grid.Slice);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[MAX_DIM];
+
+    displacement[0] = (PrecisionType)i * rDx + pBuffers[VELOCITY][cell*grid.Dim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx + pBuffers[VELOCITY][cell*grid.Dim+1] * rDt;
+    displacement[2] = (PrecisionType)k * rDx + pBuffers[VELOCITY][cell*grid.Dim+2] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(grid,pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+
+      PrecisionType * phi = &fields[f].Phi[cell*dim];
+      PrecisionType * aux = &fields[f].Aux[cell*dim];
+
+      applyWeights(fields[f].Result,aux,weights,dim);
+
+      for(size_t d = 0; d < dim; d++) {
+        aux[d] = 1.5f * phi[d] - 0.5f * aux[d];
+      }
+    }
+  }
+
+  /**
+   * Error correction step of AdvectFields over a given cell
+   * @grid:       grid of the block
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j,k:      Index of the cell
+   **/
+  template<bool Clamp, class GridType>
+  void ApplyEccFields(
+      const GridType &grid,
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t cell = IndexType::GetIndex(i,j,k,grid.Pitch,grid.Slice);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[MAX_DIM];
+
+    displacement[0] = (PrecisionType)i * rDx - pBuffers[VELOCITY][cell*grid.Dim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx - pBuffers[VELOCITY][cell*grid.Dim+1] * rDt;
+    displacement[2] = (PrecisionType)k * rDx - pBuffers[VELOCITY][cell*grid.Dim+2] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(grid,pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+      applyWeights(fields[f].Aux,&fields[f].Result[cell*dim],weights,dim);
+    }
+  }
+
+private:
+
+  /**
+   * AdvectFields over the grid selected by DISPATCH_GRID
+   * @grid:       grid of the block
+   **/
+  template<class GridType>
+  void AdvectFieldsGrid(const GridType &grid, AdvectedField * fields, const size_t &numFields) {
+
+    size_t listL[grid.X*grid.X];
+    size_t listR[grid.X*grid.X];
+
+    long normalL[3] = {0,-1,0};
+    long normalR[3] = {0,1,0};
+
+    // Boundary conditions only apply on the faces on the border of the domain
+    size_t sizeL = pBlock->mDomainFace[FACE_Y_LOW]  ? grid.X*grid.X : 0;
+    size_t sizeR = pBlock->mDomainFace[FACE_Y_HIGH] ? grid.X*grid.X : 0;
+
+    uint counter = 0;
+
+    for(uint a = BWP; a < grid.Z + BWP; a++) {
+      for(uint b = BWP; b < grid.Y + BWP; b++) {
+
+        listL[counter] = a*grid.Slice+2*grid.Pitch+b;
+        listR[counter] = a*grid.Slice+(grid.Y-1)*grid.Pitch+b;
+
+        counter++;
+      }
+    }
+
+    size_t low[MAX_DIM];
+    size_t high[MAX_DIM];
+
+    calculateSafeRange(low,high);
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Phi,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Phi,listR,sizeR,normalR,1,fields[f].Dim);
+    }
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      phaseBegin(PERF_ADVECT_BACK);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t ib, ie;
+          calculateSafeRow(low,high,j,k,ib,ie);
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t rb = pBlock->pRunStart[r];
+            size_t re = rb + pBlock->pRunLength[r];
+            for(size_t i = rb; i < std::min(ib,re); i++) {
+              ApplyBackFields<true>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ib,rb); i < std::min(ie,re); i++) {
+              ApplyBackFields<false>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ie,rb); i < re; i++) {
+              ApplyBackFields<true>(grid,fields,numFields,i,j,k);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_ADVECT_BACK,kb,ke,grid);
+    }
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Result,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Result,listR,sizeR,normalR,1,fields[f].Dim);
+    }
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      phaseBegin(PERF_ADVECT_FORTH);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t ib, ie;
+          calculateSafeRow(low,high,j,k,ib,ie);
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t rb = pBlock->pRunStart[r];
+            size_t re = rb + pBlock->pRunLength[r];
+            for(size_t i = rb; i < std::min(ib,re); i++) {
+              ApplyForthFields<true>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ib,rb); i < std::min(ie,re); i++) {
+              ApplyForthFields<false>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ie,rb); i < re; i++) {
+              ApplyForthFields<true>(grid,fields,numFields,i,j,k);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_ADVECT_FORTH,kb,ke,grid);
+    }
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Aux,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Aux,listR,sizeR,normalR,1,fields[f].Dim);
+    }
+
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      phaseBegin(PERF_ADVECT_ECC);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t ib, ie;
+          calculateSafeRow(low,high,j,k,ib,ie);
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t rb = pBlock->pRunStart[r];
+            size_t re = rb + pBlock->pRunLength[r];
+            for(size_t i = rb; i < std::min(ib,re); i++) {
+              ApplyEccFields<true>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ib,rb); i < std::min(ie,re); i++) {
+              ApplyEccFields<false>(grid,fields,numFields,i,j,k);
+            }
+            for(size_t i = std::max(ie,rb); i < re; i++) {
+              ApplyEccFields<true>(grid,fields,numFields,i,j,k);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_ADVECT_ECC,kb,ke,grid);
+    }
+
+    for(size_t f = 0; f < numFields; f++) {
+      applyBc(fields[f].Result,listL,sizeL,normalL,1,fields[f].Dim);
+      applyBc(fields[f].Result,listR,sizeR,normalR,1,fields[f].Dim);
+    }
+
+  }
+
+  enum AdvectionPhase {
+    PHASE_BACK,
+    PHASE_FORTH,
+    PHASE_ECC
+  };
+
+  template<int Phase, bool Clamp>
+  void applyFieldsCell(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j,
+      const size_t &k) {
+
+    switch(Phase) {
+      case PHASE_BACK:  ApplyBackFields<Clamp>(mGrid,fields,numFields,i,j,k); break;
+      case PHASE_FORTH: ApplyForthFields<Clamp>(mGrid,fields,numFields,i,j,k); break;
+      case PHASE_ECC:   ApplyEccFields<Clamp>(mGrid,fields,numFields,i,j,k); break;
+    }
+  }
+
+  /**
+   * Applies one of the steps of AdvectFields over the active tiles
+   * @low,high:   safe range of the block
+   **/
+  template<int Phase>
+  void applyFieldsActive(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t * low,
+      const size_t * high) {
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < pBlock->mNumActive; a++) {
+      size_t tileLow[MAX_DIM], tileHigh[MAX_DIM];
+      pBlock->GetTileRange(pBlock->pActiveList[a],tileLow,tileHigh);
+      for(size_t k = tileLow[2]; k < tileHigh[2]; k++) {
+        for(size_t j = tileLow[1]; j < tileHigh[1]; j++) {
+          size_t ib, ie;
+          calculateSafeRow(low,high,j,k,ib,ie);
+          ib = std::min(std::max(ib,tileLow[0]),tileHigh[0]);
+          ie = std::min(std::max(ie,ib),tileHigh[0]);
+          for(size_t i = tileLow[0]; i < ib; i++) {
+            applyFieldsCell<Phase,true>(fields,numFields,i,j,k);
+          }
+          for(size_t i = ib; i < ie; i++) {
+            applyFieldsCell<Phase,false>(fields,numFields,i,j,k);
+          }
+          for(size_t i = ie; i < tileHigh[0]; i++) {
+            applyFieldsCell<Phase,true>(fields,numFields,i,j,k);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Applies one of the steps of AdvectFields over a list of cells. Cells of
+   * the list can be anywhere in the block, so they are always clamped
+   * @cells:      index of the cells
+   * @numCells:   number of cells
+   **/
+  template<int Phase>
+  void applyFieldsList(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t * cells,
+      const size_t &numCells) {
+
+    #pragma omp parallel for schedule(static)
+    for(size_t c = 0; c < numCells; c++) {
+      size_t i = cells[c] % pBlock->mPaddY;
+      size_t j = (cells[c] % pBlock->mPaddZ) / pBlock->mPaddY;
+      size_t k = cells[c] / pBlock->mPaddZ;
+
+      applyFieldsCell<Phase,true>(fields,numFields,i,j,k);
+    }
+  }
+
+  /**
+   * Calculates the range of cells whose departure points can not reach the
+   * border of the block, so they can be interpolated without clamping.
+   * @low:      first safe cell in each direction
+   * @high:     last safe cell in each direction (not included)
+   **/
+  void calculateSafeRange(size_t * low, size_t * high) {
+
+    PrecisionType maxv;
+
+    takeMaxVelocity(maxv);
+
+    calculateSafeRange(maxv,low,high);
+  }
+
+  /**
+   * Maximum velocity component given with SetMaxVelocity, which is only used
+   * once, or reduced over the block
+   * @maxv:     maximum velocity component
+   **/
+  void takeMaxVelocity(PrecisionType &maxv) {
+
+    if(mMaxVelocityKnown) {
+      maxv = mMaxVelocity;
+      mMaxVelocityKnown = false;
+    } else {
+      pBlock->calculateMaxVelocity(maxv);
+    }
+  }
+
+  /**
+   * Same as calculateSafeRange but the maximum velocity is only reduced
+   * over the active tiles. Velocity in the quiet tiles is below the
+   * tolerance of the block.
+   **/
+  void calculateSafeRangeActive(size_t * low, size_t * high) {
+
+    PrecisionType * velocity = pBuffers[VELOCITY];
+    PrecisionType maxv = pBlock->mActiveTolerance;
+
+    size_t invalid = 0;
+
+    if(mMaxVelocityKnown) {
+      takeMaxVelocity(maxv);
+      calculateSafeRange(maxv,low,high);
+      return;
+    }
+
+    #pragma omp parallel for reduction(max:maxv) reduction(+:invalid) schedule(dynamic)
+    for(size_t a = 0; a < pBlock->mNumActive; a++) {
+      size_t tileLow[MAX_DIM], tileHigh[MAX_DIM];
+      pBlock->GetTileRange(pBlock->pActiveList[a],tileLow,tileHigh);
+      for(size_t k = tileLow[2]; k < tileHigh[2]; k++) {
+        for(size_t j = tileLow[1]; j < tileHigh[1]; j++) {
+          size_t cell = IndexType::GetIndex(tileLow[0],j,k,pBlock->mPaddY,pBlock->mPaddZ);
+          for(size_t i = tileLow[0]; i < tileHigh[0]; i++) {
+            for(size_t d = 0; d < MAX_DIM; d++) {
+              PrecisionType v = fabs(velocity[cell*rDim+d]);
+              maxv = std::max(v,maxv);
+              invalid += !std::isfinite(v);
+            }
+            cell++;
+          }
+        }
+      }
+    }
+
+    if(invalid) {
+      maxv = std::numeric_limits<PrecisionType>::quiet_NaN();
+    }
+
+    calculateSafeRange(maxv,low,high);
+  }
+
+  /**
+   * Safe range for a given maximum velocity
+   * @maxv:     maximum velocity component
+   **/
+  void calculateSafeRange(const PrecisionType &maxv, size_t * low, size_t * high) {
+
+    size_t size[MAX_DIM] = {rX + rBW, rY + rBW, rZ + rBW};
+
+    PrecisionType reach = maxv * rDt * rIdx;
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      low[d]  = 0;
+      high[d] = 0;
+    }
+
+    // Also catches NaN and infinite velocities
+    if(!std::isfinite(reach) || !(reach < (PrecisionType)size[0])) {
+      return;
+    }
+
+    // One extra cell absorbs the rounding of the local coordinates
+    size_t margin = (size_t)ceil(reach) + 1;
+
+    for(size_t d = 0; d < MAX_DIM; d++) {
+      if(size[d] > InterpolateType::StencilLow + InterpolateType::StencilHigh + 2 * margin) {
+        low[d]  = InterpolateType::StencilLow + margin;
+        high[d] = size[d] - InterpolateType::StencilHigh - margin;
+      }
+    }
+  }
+
+  /**
+   * Calculates the cells of a row that can be interpolated without clamping
+   * @low,high: safe range of the block
+   * @j,k:      Index of the row
+   * @ib,ie:    first and last safe cell of the row (empty if ib == ie)
+   **/
+  void calculateSafeRow(
+      const size_t * low,
+      const size_t * high,
+      const size_t &j,
+      const size_t &k,
+      size_t &ib,
+      size_t &ie) {
+
+    ib = rX + rBWP;
+    ie = rX + rBWP;
+
+    if(j >= low[1] && j < high[1] && k >= low[2] && k < high[2]) {
+      ib = std::min(std::max(rBWP,low[0]),rX + rBWP);
+      ie = std::max(std::min(rX + rBWP,high[0]),ib);
+    }
+  }
+
+  /**
+   * Interpolates a field with precalculated weights, fixing the number of
+   * components at compile time for the common cases.
+   **/
+  static void applyWeights(
+      PrecisionType * OldPhi,
+      PrecisionType * NewPhi,
+      const typename InterpolateType::WeightsType & weights,
+      const size_t &dim) {
+
+    switch(dim) {
+      case 1:  InterpolateType::template Apply<1>(OldPhi,NewPhi,weights); break;
+      case 3:  InterpolateType::template Apply<3>(OldPhi,NewPhi,weights); break;
+      default: InterpolateType::Apply(OldPhi,NewPhi,weights,dim);
+    }
+  }
+
+protected:
+
+  using BaseType::pBlock;
+  using BaseType::pBuffers;
+  using BaseType::rDx;
+  using BaseType::rIdx;
+  using BaseType::rDt;
+  using BaseType::rBW;
+  using BaseType::rBWP;
+  using BaseType::rX;
+  using BaseType::rY;
+  using BaseType::rZ;
+  using BaseType::rNB;
+  using BaseType::rNE;
+  using BaseType::rDim;
+  using BaseType::mGrid;
+  using BaseType::streamSlab;
+  using BaseType::phaseBegin;
+  using BaseType::phaseEnd;
+  using BaseType::applyBc;
+
+  bool mActiveReady;
+
+  PrecisionType mMaxVelocity;
+  bool mMaxVelocityKnown;
 };
@@ -0,0 +1,330 @@
+#ifndef SOLVER_BFECC_2D_H
+#define SOLVER_BFECC_2D_H
+
+#include "solver_2d.h"
+
+/**
+ * BFECC advection solver of a 2D block, with the same three steps as
+ * BfeccSolver::AdvectFields over the rows of the plane
+ * @InterpolatorType:  interpolation policy used to find the departure values
+ **/
+template<class InterpolatorType = BilinealInterpolator>
+class BfeccSolver2D : public Solver2D<BfeccSolver2D<InterpolatorType>,InterpolatorType> {
+public:
+
+  typedef Solver2D<BfeccSolver2D<InterpolatorType>,InterpolatorType> BaseType;
+
+  typedef typename BaseType::IndexType        IndexType;
+  typedef typename BaseType::InterpolateType  InterpolateType;
+
+  BfeccSolver2D(Block2D * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
+      BaseType(block,Dt,Pdt),
+      mMaxVelocityKnown(false) {
+  }
+
+  ~BfeccSolver2D() {
+
+  }
+
+  void Prepare_impl() {
+  }
+
+  void Finish_impl() {
+  }
+
+  /**
+   * Sets the maximum velocity component for the next advection, as in
+   * BfeccSolver::SetMaxVelocity
+   * @maxv:     maximum velocity component
+   **/
+  void SetMaxVelocity(const PrecisionType &maxv) {
+    mMaxVelocity      = maxv;
+    mMaxVelocityKnown = true;
+  }
+
+  /**
+   * Field advected by AdvectFields
+   * @Phi:      field to advect
+   * @Result:   advected field. Also holds the backward step
+   * @Aux:      auxiliar buffer for the forward step
+   * @Dim:      number of components of the field
+   **/
+  struct AdvectedField {
+    PrecisionType * Phi;
+    PrecisionType * Result;
+    PrecisionType * Aux;
+    size_t Dim;
+  };
+
+  /**
+   * Executes the solver in parallel
+   **/
+  void Execute_impl() {
+
+    AdvectedField velocity = {
+      pBuffers[VELOCITY],
+      pBuffers[AUX_3D_1],
+      pBuffers[AUX_3D_3],
+      rDim
+    };
+
+    AdvectFields(&velocity,1);
+  }
+
+  /**
+   * Advects a set of fields of any dimension with the velocity of the block.
+   * Departure points and interpolation weights are calculated once per cell
+   * and applied to all the fields.
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   **/
+  void AdvectFields(AdvectedField * fields, const size_t &numFields) {
+
+    size_t low[2];
+    size_t high[2];
+
+    calculateSafeRange(low,high);
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,BWP,rY+BWP,jb,je);
+
+      for(size_t j = jb; j < je; j++) {
+        size_t ib, ie;
+        calculateSafeRow(low,high,j,ib,ie);
+        for(size_t i = rBWP; i < ib; i++) {
+          ApplyBackFields<true>(fields,numFields,i,j);
+        }
+        for(size_t i = ib; i < ie; i++) {
+          ApplyBackFields<false>(fields,numFields,i,j);
+        }
+        for(size_t i = ie; i < rX + rBWP; i++) {
+          ApplyBackFields<true>(fields,numFields,i,j);
+        }
+      }
+    }
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,BWP,rY+BWP,jb,je);
+
+      for(size_t j = jb; j < je; j++) {
+        size_t ib, ie;
+        calculateSafeRow(low,high,j,ib,ie);
+        for(size_t i = rBWP; i < ib; i++) {
+          ApplyForthFields<true>(fields,numFields,i,j);
+        }
+        for(size_t i = ib; i < ie; i++) {
+          ApplyForthFields<false>(fields,numFields,i,j);
+        }
+        for(size_t i = ie; i < rX + rBWP; i++) {
+          ApplyForthFields<true>(fields,numFields,i,j);
+        }
+      }
+    }
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      OwnedSlabs(rY,BWP,rY+BWP,jb,je);
+
+      for(size_t j = jb; j < je; j++) {
+        size_t ib, ie;
+        calculateSafeRow(low,high,j,ib,ie);
+        for(size_t i = rBWP; i < ib; i++) {
+          ApplyEccFields<true>(fields,numFields,i,j);
+        }
+        for(size_t i = ib; i < ie; i++) {
+          ApplyEccFields<false>(fields,numFields,i,j);
+        }
+        for(size_t i = ie; i < rX + rBWP; i++) {
+          ApplyEccFields<true>(fields,numFields,i,j);
+        }
+      }
+    }
+  }
+
+  /**
+   * Backward step of AdvectFields over a given cell
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j:        Index of the cell
+   **/
+  template<bool Clamp>
+  void ApplyBackFields(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j) {
+
+    size_t cell = IndexType::GetIndex(i,j,0,pBlock->mPaddY,0);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[2];
+
+    displacement[0] = (PrecisionType)i * rDx - pBuffers[VELOCITY][cell*rDim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx - pBuffers[VELOCITY][cell*rDim+1] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+      InterpolateType::Apply(fields[f].Phi,&fields[f].Result[cell*dim],weights,dim);
+    }
+  }
+
+  /**
+   * Forward step of AdvectFields over a given cell
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j:        Index of the cell
+   **/
+  template<bool Clamp>
+  void ApplyForthFields(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j) {
+
+    size_t cell = IndexType::GetIndex(i,j,0,pBlock->mPaddY,0);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[2];
+
+    displacement[0] = (PrecisionType)i * rDx + pBuffers[VELOCITY][cell*rDim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx + pBuffers[VELOCITY][cell*rDim+1] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+
+      PrecisionType * phi = &fields[f].Phi[cell*dim];
+      PrecisionType * aux = &fields[f].Aux[cell*dim];
+
+      InterpolateType::Apply(fields[f].Result,aux,weights,dim);
+
+      for(size_t d = 0; d < dim; d++) {
+        aux[d] = 1.5f * phi[d] - 0.5f * aux[d];
+      }
+    }
+  }
+
+  /**
+   * Error correction step of AdvectFields over a given cell
+   * @fields:     fields to advect
+   * @numFields:  number of fields
+   * @i,j:        Index of the cell
+   **/
+  template<bool Clamp>
+  void ApplyEccFields(
+      AdvectedField * fields,
+      const size_t &numFields,
+      const size_t &i,
+      const size_t &j) {
+
+    size_t cell = IndexType::GetIndex(i,j,0,pBlock->mPaddY,0);
+
+    typename InterpolateType::WeightsType weights;
+    PrecisionType displacement[2];
+
+    displacement[0] = (PrecisionType)i * rDx - pBuffers[VELOCITY][cell*rDim+0] * rDt;
+    displacement[1] = (PrecisionType)j * rDx - pBuffers[VELOCITY][cell*rDim+1] * rDt;
+
+    InterpolateType::template CalculateWeights<Clamp>(pBlock,displacement,weights);
+
+    for(size_t f = 0; f < numFields; f++) {
+      const size_t &dim = fields[f].Dim;
+      InterpolateType::Apply(fields[f].Aux,&fields[f].Result[cell*dim],weights,dim);
+    }
+  }
+
+private:
+
+  /**
+   * Range of cells whose departure points can not leave the block for the
+   * current velocity, so they are interpolated without clamping. Same as
+   * BfeccSolver::calculateSafeRange
+   * @low,high: safe range in every direction
+   **/
+  void calculateSafeRange(size_t * low, size_t * high) {
+
+    PrecisionType maxv;
+
+    if(mMaxVelocityKnown) {
+      maxv = mMaxVelocity;
+      mMaxVelocityKnown = false;
+    } else {
+      pBlock->calculateMaxVelocity(maxv);
+    }
+
+    size_t size[2] = {rX + rBW, rY + rBW};
+
+    PrecisionType reach = maxv * rDt * rIdx;
+
+    for(size_t d = 0; d < 2; d++) {
+      low[d]  = 0;
+      high[d] = 0;
+    }
+
+    // Also catches NaN and infinite velocities
+    if(!std::isfinite(reach) || !(reach < (PrecisionType)size[0])) {
+      return;
+    }
+
+    // One extra cell absorbs the rounding of the local coordinates
+    size_t margin = (size_t)ceil(reach) + 1;
+
+    for(size_t d = 0; d < 2; d++) {
+      if(size[d] > InterpolateType::StencilLow + InterpolateType::StencilHigh + 2 * margin) {
+        low[d]  = InterpolateType::StencilLow + margin;
+        high[d] = size[d] - InterpolateType::StencilHigh - margin;
+      }
+    }
+  }
+
+  /**
+   * Calculates the cells of a row that can be interpolated without clamping
+   * @low,high: safe range of the block
+   * @j:        Index of the row
+   * @ib,ie:    first and last safe cell of the row (empty if ib == ie)
+   **/
+  void calculateSafeRow(
+      const size_t * low,
+      const size_t * high,
+      const size_t &j,
+      size_t &ib,
+      size_t &ie) {
+
+    ib = rX + rBWP;
+    ie = rX + rBWP;
+
+    if(j >= low[1] && j < high[1]) {
+      ib = std::min(std::max(rBWP,low[0]),rX + rBWP);
+      ie = std::max(std::min(rX + rBWP,high[0]),ib);
+    }
+  }
+
+protected:
+
+  using BaseType::pBlock;
+  using BaseType::pBuffers;
+  using BaseType::rDx;
+  using BaseType::rIdx;
+  using BaseType::rDt;
+  using BaseType::rBW;
+  using BaseType::rBWP;
+  using BaseType::rX;
+  using BaseType::rY;
+  using BaseType::rDim;
+
+  PrecisionType mMaxVelocity;
+  bool mMaxVelocityKnown;
+};
+
+#endif
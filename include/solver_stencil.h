@@ -1,5 +1,6 @@
 #include "solver.h"
 #include "simd.h"
+#include "linear_solver.h"
 
 class StencilSolver : public Solver<StencilSolver> {
 private:
@@ -16,7 +17,9 @@ private:
     }
   }
 
+  template<class GridType>
   inline void smoothing(
+      const GridType &grid,
       PrecisionType * gridA,
       PrecisionType * gridB,
       const size_t &cell,
@@ -32,16 +35,27 @@ private:
         m8 * gridA[(cell    )*Dim+d]   +
         m1 * gridA[(cell - 1)*Dim+d]   +               // Left
         m1 * gridA[(cell + 1)*Dim+d]   +               // Right
-        m4 * gridA[(cell - (rY+BW)*(rX+BW))*Dim+d] +   // Front
-        m4 * gridA[(cell + (rY+BW)*(rX+BW))*Dim+d] +
-        m2 * gridA[(cell - (rY+BW)*(rX+BW) + 1)*Dim+d] +   // Front
-        m2 * gridA[(cell + (rY+BW)*(rX+BW) + 1)*Dim+d] +
-        m2 * gridA[(cell - (rY+BW)*(rX+BW) - 1)*Dim+d] +   // Front
-        m2 * gridA[(cell + (rY+BW)*(rX+BW) - 1)*Dim+d]);
+        m4 * gridA[(cell - grid.Slice)*Dim+d] +       // Front
+        m4 * gridA[(cell + grid.Slice)*Dim+d] +
+        m2 * gridA[(cell - grid.Slice + 1)*Dim+d] +   // Front
+        m2 * gridA[(cell + grid.Slice + 1)*Dim+d] +
+        m2 * gridA[(cell - grid.Slice - 1)*Dim+d] +   // Front
+        m2 * gridA[(cell + grid.Slice - 1)*Dim+d]);
     }
   }
 
+  inline void smoothing(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell,
+      const size_t &Dim) {
+
+    smoothing(mGrid,gridA,gridB,cell,Dim);
+  }
+
+  template<class GridType>
   inline void lapplacian(
+      const GridType &grid,
       PrecisionType * gridA,
       PrecisionType * gridB,
       const size_t &cell,
@@ -51,14 +65,23 @@ private:
       gridB[cell*Dim+d] = (
         gridA[(cell - 1)*Dim+d]   +                  // Left
         gridA[(cell + 1)*Dim+d]   +                  // Right
-        gridA[(cell - (rX+BW))*Dim+d]   +             // Up
-        gridA[(cell + (rX+BW))*Dim+d]   +             // Down
-        gridA[(cell - (rY+BW)*(rX+BW))*Dim+d] +        // Front
-        gridA[(cell + (rY+BW)*(rX+BW))*Dim+d] -        // Back
+        gridA[(cell - grid.Pitch)*Dim+d]   +         // Up
+        gridA[(cell + grid.Pitch)*Dim+d]   +         // Down
+        gridA[(cell - grid.Slice)*Dim+d] +           // Front
+        gridA[(cell + grid.Slice)*Dim+d] -           // Back
         6.0f * gridA[(cell)*Dim+d]) * rIdx * rIdx;
     }
   }
 
+  inline void lapplacian(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell,
+      const size_t &Dim) {
+
+    lapplacian(mGrid,gridA,gridB,cell,Dim);
+  }
+
   inline void lapplacian2(
       PrecisionType * gridA,
       PrecisionType * gridB,
@@ -80,7 +103,9 @@ private:
     }
   }
 
+  template<class GridType>
   inline void gradient(
+      const GridType &grid,
       PrecisionType * press,
       PrecisionType * gridB,
       const size_t &cell ) {
@@ -92,40 +117,366 @@ private:
       press[(cell - 1)]);
 
     pressGrad[1] = (
-      press[(cell + (rX+BW))] -
-      press[(cell - (rX+BW))]);
+      press[(cell + grid.Pitch)] -
+      press[(cell - grid.Pitch)]);
 
     pressGrad[2] = (
-      press[(cell + (rY+BW)*(rX+BW))] -
-      press[(cell - (rY+BW)*(rX+BW))]);
+      press[(cell + grid.Slice)] -
+      press[(cell - grid.Slice)]);
 
-    for (size_t d = 0; d < rDim; d++) {
-      gridB[cell*rDim+d] = pressGrad[d] * 0.5f * rIdx;
+    for (size_t d = 0; d < grid.Dim; d++) {
+      gridB[cell*grid.Dim+d] = pressGrad[d] * 0.5f * rIdx;
     }
   }
 
+  inline void gradient(
+      PrecisionType * press,
+      PrecisionType * gridB,
+      const size_t &cell ) {
+
+    gradient(mGrid,press,gridB,cell);
+  }
+
+  template<class GridType>
   inline void divergence(
+      const GridType &grid,
       PrecisionType * gridA,
       PrecisionType * gridB,
       const size_t &cell ) {
 
     gridB[cell] =
-      (gridA[(cell + 1) * rDim + 0] - gridA[(cell - 1) * rDim + 0]) +
-      (gridA[(cell + (rX+BW)) *rDim + 1] - gridA[(cell - (rX+BW)) * rDim + 1]) +
-      (gridA[(cell + (rY+BW)*(rX+BW)) * rDim + 2] - gridA[(cell - (rY+BW)*(rX+BW)) * rDim + 2]);
+      (gridA[(cell + 1) * grid.Dim + 0] - gridA[(cell - 1) * grid.Dim + 0]) +
+      (gridA[(cell + grid.Pitch) *grid.Dim + 1] - gridA[(cell - grid.Pitch) * grid.Dim + 1]) +
+      (gridA[(cell + grid.Slice) * grid.Dim + 2] - gridA[(cell - grid.Slice) * grid.Dim + 2]);
 
     gridB[cell] *= 0.5f * rIdx;
   }
 
+  inline void divergence(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell ) {
+
+    divergence(mGrid,gridA,gridB,cell);
+  }
+
+  /**
+   * Rebuilds the lists of fixed cells and the runs of fluid cells of the
+   * block if its flags changed, and resizes the storage of the fixed cells
+   **/
+  void updateLists() {
+
+    if(pBlock->UpdateFixedLists()) {
+      free(mFixedSave);
+      mFixedSave = (PrecisionType *)malloc(sizeof(PrecisionType) * std::max(pBlock->mNumFixed,(size_t)1) * MAX_DIM);
+    }
+
+    pBlock->UpdateFluidRuns();
+  }
+
+  /**
+   * Saves the velocity of the fixed cells of a row, so the row can be
+   * updated without checking the flags of every cell.
+   * @vel:        velocity
+   * @j,k:        Index of the row
+   **/
+  inline void saveFixedVelocity(
+      PrecisionType * vel,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t row = pBlock->FixedRow(j,k);
+
+    for(size_t b = pBlock->pFixedOffset[row]; b < pBlock->pFixedOffset[row+1]; b++) {
+      size_t cell = pBlock->pFixedCells[b];
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        mFixedSave[b*MAX_DIM+d] = vel[cell*rDim+d];
+      }
+    }
+  }
+
+  /**
+   * Restores the fixed components of the velocity saved by saveFixedVelocity
+   * @vel:        velocity
+   * @j,k:        Index of the row
+   **/
+  inline void restoreFixedVelocity(
+      PrecisionType * vel,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t row = pBlock->FixedRow(j,k);
+
+    for(size_t b = pBlock->pFixedOffset[row]; b < pBlock->pFixedOffset[row+1]; b++) {
+      size_t cell = pBlock->pFixedCells[b];
+      unsigned char mask = pBlock->pFixedMask[b];
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        if(mask & (FIXED_MASK_X << d))
+          vel[cell*rDim+d] = mFixedSave[b*MAX_DIM+d];
+      }
+    }
+  }
+
+  /**
+   * Saves the pressure of the fixed cells of a row
+   * @press:      pressure
+   * @j,k:        Index of the row
+   **/
+  inline void saveFixedPressure(
+      PrecisionType * press,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t row = pBlock->FixedRow(j,k);
+
+    for(size_t b = pBlock->pFixedOffset[row]; b < pBlock->pFixedOffset[row+1]; b++) {
+      mFixedSave[b*MAX_DIM] = press[pBlock->pFixedCells[b]];
+    }
+  }
+
+  /**
+   * Restores the pressure of the FIXED_PRESSURE cells saved by saveFixedPressure
+   * @press:      pressure
+   * @j,k:        Index of the row
+   **/
+  inline void restoreFixedPressure(
+      PrecisionType * press,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t row = pBlock->FixedRow(j,k);
+
+    for(size_t b = pBlock->pFixedOffset[row]; b < pBlock->pFixedOffset[row+1]; b++) {
+      if(pBlock->pFixedMask[b] & FIXED_MASK_P)
+        press[pBlock->pFixedCells[b]] = mFixedSave[b*MAX_DIM];
+    }
+  }
+
+  /**
+   * Sets the pressure of the solid cells next to the fluid to the average
+   * of their fluid neighbours, so the pressure gradient across the faces of
+   * the obstacles is zero. Must be called from inside a parallel region
+   * @grid:       grid of the block
+   * @press:      pressure
+   **/
+  template<class GridType>
+  void extrapolateSolidPressure(const GridType &grid, PrecisionType * press) {
+
+    const size_t stride[3] = {1, grid.Pitch, grid.Slice};
+    const size_t size[3]   = {grid.X, grid.Y, grid.Z};
+
+    #pragma omp for
+    for(size_t f = 0; f < pBlock->mNumSolidFaces; f++) {
+      size_t cell = pBlock->pSolidFaces[f];
+
+      size_t index[3] = {cell % grid.Pitch, (cell % grid.Slice) / grid.Pitch, cell / grid.Slice};
+
+      PrecisionType sum = 0.0f;
+      size_t count = 0;
+
+      // Only interior neighbours, as in Block::isSolidFace
+      for(size_t d = 0; d < 3; d++) {
+        if(index[d] > BWP && !(pFlags[cell - stride[d]] & SOLID)) {
+          sum += press[cell - stride[d]];
+          count++;
+        }
+        if(index[d] + 1 < size[d] + BWP && !(pFlags[cell + stride[d]] & SOLID)) {
+          sum += press[cell + stride[d]];
+          count++;
+        }
+      }
+
+      press[cell] = sum / count;
+    }
+  }
+
+  /**
+   * Copies the pressure of the FIXED_PRESSURE cells of a row between buffers
+   * @pressOld:   source
+   * @pressNew:   destination
+   * @j,k:        Index of the row
+   **/
+  inline void copyFixedPressure(
+      PrecisionType * pressOld,
+      PrecisionType * pressNew,
+      const size_t &j,
+      const size_t &k) {
+
+    size_t row = pBlock->FixedRow(j,k);
+
+    for(size_t b = pBlock->pFixedOffset[row]; b < pBlock->pFixedOffset[row+1]; b++) {
+      size_t cell = pBlock->pFixedCells[b];
+      if(pBlock->pFixedMask[b] & FIXED_MASK_P)
+        pressNew[cell] = pressOld[cell];
+    }
+  }
+
+  /**
+   * Acoustic update of the velocity of a cell: u -= grad(p) * fact
+   * Fixed components are restored by the caller.
+   **/
+  inline void acousticVelocity(
+      PrecisionType * vel,
+      PrecisionType * press,
+      const PrecisionType &fact,
+      const size_t &cell) {
+
+    PrecisionType f = 0.5f * rIdx * fact;
+
+    vel[cell*rDim+0] -= (press[cell + 1] - press[cell - 1]) * f;
+    vel[cell*rDim+1] -= (press[cell + (rX+BW)] - press[cell - (rX+BW)]) * f;
+    vel[cell*rDim+2] -= (press[cell + (rY+BW)*(rX+BW)] - press[cell - (rY+BW)*(rX+BW)]) * f;
+  }
+
+  /**
+   * Acoustic update of the pressure of a cell:
+   *   p(new) = p(old) - div(u) * fact + damping * (mean of neighbours - p(old))
+   * Fixed cells are reset by the caller.
+   **/
+  inline void acousticPressure(
+      PrecisionType * vel,
+      PrecisionType * pressOld,
+      PrecisionType * pressNew,
+      const PrecisionType &fact,
+      const size_t &cell) {
+
+    pressNew[cell] = pressOld[cell] - (
+      (vel[(cell + 1) * rDim + 0] - vel[(cell - 1) * rDim + 0]) +
+      (vel[(cell + (rX+BW)) * rDim + 1] - vel[(cell - (rX+BW)) * rDim + 1]) +
+      (vel[(cell + (rY+BW)*(rX+BW)) * rDim + 2] - vel[(cell - (rY+BW)*(rX+BW)) * rDim + 2])
+    ) * 0.5f * rIdx * fact + mSubstepDamping * (
+      (pressOld[cell - 1] +
+       pressOld[cell + 1] +
+       pressOld[cell - (rX+BW)] +
+       pressOld[cell + (rX+BW)] +
+       pressOld[cell - (rY+BW)*(rX+BW)] +
+       pressOld[cell + (rY+BW)*(rX+BW)]) / 6.0f - pressOld[cell]);
+  }
+
+  /**
+   * Acoustic update of the velocity of a slab. Must be called from inside a
+   * parallel region.
+   **/
+  inline void acousticVelocitySlab(
+      PrecisionType * vel,
+      PrecisionType * press,
+      const PrecisionType &fact,
+      const size_t &k) {
+
+    #pragma omp for
+    for(size_t j = rBWP; j < rY + rBWP; j++) {
+      size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+      saveFixedVelocity(vel,j,k);
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        acousticVelocity(vel,press,fact,cell++);
+      }
+      restoreFixedVelocity(vel,j,k);
+    }
+  }
+
+  /**
+   * Acoustic update of the pressure of a slab. Also sets the Neumann ghost
+   * cells of the new pressure next to the slab, as CopyGhosts would. Must be
+   * called from inside a parallel region.
+   **/
+  inline void acousticPressureSlab(
+      PrecisionType * vel,
+      PrecisionType * pressOld,
+      PrecisionType * pressNew,
+      const PrecisionType &fact,
+      const size_t &k) {
+
+    size_t paddY = rY+BW;
+    size_t paddZ = (rZ+rBW)*(rY+rBW);
+
+    #pragma omp for
+    for(size_t j = rBWP; j < rY + rBWP; j++) {
+      size_t cell = k*paddZ+j*paddY+rBWP;
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        acousticPressure(vel,pressOld,pressNew,fact,cell++);
+      }
+      copyFixedPressure(pressOld,pressNew,j,k);
+
+      size_t row = k*paddZ+j*paddY;
+
+      pressNew[row + rBWP - 1] = pressNew[row + rBWP];
+      pressNew[row + rX + rBWP] = pressNew[row + rX + rBWP - 1];
+
+      for(size_t i = rBWP; i < rX + rBWP; i++) {
+        if(j == rBWP)
+          pressNew[row + i - paddY] = pressNew[row + i];
+        if(j == rY + rBWP - 1)
+          pressNew[row + i + paddY] = pressNew[row + i];
+        if(k == rBWP)
+          pressNew[row + i - paddZ] = pressNew[row + i];
+        if(k == rZ + rBWP - 1)
+          pressNew[row + i + paddZ] = pressNew[row + i];
+      }
+    }
+  }
+
+  /**
+   * Advances several acoustic sub-steps in a single sweep over the slabs.
+   * In each wavefront step w, level t updates the velocity of the slab
+   * w - 2t and the pressure of the slab w - 2t - 1. With a skew of two slabs
+   * every slab only reads data of its level that is already updated and no
+   * pressure of the previous-but-one level is overwritten while it is still
+   * needed, so both pressure buffers are enough for any number of levels
+   * and the result matches the sub-steps done one by one.
+   * @vel:        velocity, updated in place
+   * @pressOld:   pressure with its ghost cells set
+   * @pressNew:   second pressure buffer
+   * @levels:     number of sub-steps. The result is in pressNew if odd
+   **/
+  void acousticWavefront(
+      PrecisionType * vel,
+      PrecisionType * pressOld,
+      PrecisionType * pressNew,
+      const PrecisionType &velFact,
+      const PrecisionType &pressFact,
+      const size_t &levels) {
+
+    const long skew = 2;
+
+    const long kb = rBWP;
+    const long ke = rZ + rBWP;
+
+    #pragma omp parallel
+    for(long w = kb; w < ke + skew * (long)(levels - 1) + 1; w++) {
+      for(size_t t = 0; t < levels; t++) {
+        PrecisionType * src = (t % 2) ? pressNew : pressOld;
+        PrecisionType * dst = (t % 2) ? pressOld : pressNew;
+
+        long ku = w - skew * (long)t;
+        long kp = ku - 1;
+
+        if(ku >= kb && ku < ke)
+          acousticVelocitySlab(vel,src,velFact,ku);
+        if(kp >= kb && kp < ke)
+          acousticPressureSlab(vel,src,dst,pressFact,kp);
+      }
+    }
+  }
+
 public:
 
   StencilSolver(Block * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
-      Solver(block,Dt,Pdt) {
+      Solver(block,Dt,Pdt),
+      pLinearSolver(NULL),
+      mAcousticDamping(0.0f),
+      mSubstepDamping(0.0f),
+      mTemporalDepth(rBW),
+      mActiveReady(false) {
+
+    pBlock->BuildFixedLists();
+    pBlock->BuildFluidRuns();
 
+    mFixedSave = (PrecisionType *)malloc(sizeof(PrecisionType) * std::max(pBlock->mNumFixed,(size_t)1) * MAX_DIM);
   }
 
   ~StencilSolver() {
 
+    free(mFixedSave);
   }
 
   void Prepare_impl() {
@@ -162,12 +513,12 @@ public:
     size_t listT[rX*rX];
     size_t listD[rX*rX];
 
-    size_t normalL[3] = {0,-1,0};
-    size_t normalR[3] = {0,1,0};
-    size_t normalF[3] = {-1,0,0};
-    size_t normalB[3] = {1,0,0};
-    size_t normalT[3] = {0,0,-1};
-    size_t normalD[3] = {0,0,1};
+    long normalL[3] = {0,-1,0};
+    long normalR[3] = {0,1,0};
+    long normalF[3] = {-1,0,0};
+    long normalB[3] = {1,0,0};
+    long normalT[3] = {0,0,-1};
+    long normalD[3] = {0,0,1};
 
     uint counter = 0;
 
@@ -280,8 +631,6 @@ public:
     // applyBc(press,listF,rX*rX,normalF,1,1);
     // applyBc(press,listB,rX*rX,normalB,1,1);
 
-    // copyUpToDown(initVel,3);
-
     // applyBc(initVel,listT,rX*rX,normalT,1,3);
     // applyBc(initVel,listD,rX*rX,normalD,1,3);
 
@@ -289,8 +638,64 @@ public:
 
   void ExecuteBlock_impl() {}
 
+  /**
+   * Executes the solver with a task per slab of cells. Split in three
+   * phases, each one reading the ghost cells of the fields written by the
+   * previous one, so a mesh of blocks can exchange them in between.
+   **/
   void ExecuteTask_impl() {
 
+    ExecuteTaskVelocity();
+    ExecuteTaskDivergence();
+    ExecuteTaskPressure();
+  }
+
+  /**
+   * First phase of ExecuteTask: acceleration, pressure gradient and
+   * laplacian of the velocity, combined into the new velocity.
+   **/
+  void ExecuteTaskVelocity() {
+
+    updateLists();
+
+    DISPATCH_GRID(pBlock,ExecuteTaskVelocityGrid)
+  }
+
+  /**
+   * Second phase of ExecuteTask: divergence of the new velocity
+   **/
+  void ExecuteTaskDivergence() {
+
+    updateLists();
+
+    DISPATCH_GRID(pBlock,ExecuteTaskDivergenceGrid)
+  }
+
+  /**
+   * Third phase of ExecuteTask: smoothing of the divergence and update of
+   * the pressure
+   **/
+  void ExecuteTaskPressure() {
+
+    updateLists();
+
+    DISPATCH_GRID(pBlock,ExecuteTaskPressureGrid)
+  }
+
+  /**
+   * Same as ExecuteTask but only over the active tiles of the block. The
+   * first call executes the whole block so all the buffers are initialized.
+   * Tiles retired in the last update reset the divergence, which is read by
+   * the smoothing of the neighbouring active tiles.
+   **/
+  void ExecuteActive_impl() {
+
+    if(!mActiveReady) {
+      ExecuteTask_impl();
+      mActiveReady = true;
+      return;
+    }
+
     // Alias for the buffers
     PrecisionType * initVel   = pBuffers[VELOCITY];
     PrecisionType * vel       = pBuffers[AUX_3D_1];
@@ -309,17 +714,13 @@ public:
 
     size_t listL[rX*rX];
     size_t listR[rX*rX];
-    size_t listF[rX*rX];
-    size_t listB[rX*rX];
-    size_t listT[rX*rX];
-    size_t listD[rX*rX];
 
-    size_t normalL[3] = {0,-1,0};
-    size_t normalR[3] = {0,1,0};
-    size_t normalF[3] = {-1,0,0};
-    size_t normalB[3] = {1,0,0};
-    size_t normalT[3] = {0,0,-1};
-    size_t normalD[3] = {0,0,1};
+    long normalL[3] = {0,-1,0};
+    long normalR[3] = {0,1,0};
+
+    // Boundary conditions only apply on the faces on the border of the domain
+    size_t sizeL = pBlock->mDomainFace[FACE_Y_LOW]  ? rX*rX : 0;
+    size_t sizeR = pBlock->mDomainFace[FACE_Y_HIGH] ? rX*rX : 0;
 
     uint counter = 0;
 
@@ -328,209 +729,111 @@ public:
 
         listL[counter] = a*(rZ+rBW)*(rY+rBW)+2*(rZ+rBW)+b;
         listR[counter] = a*(rZ+rBW)*(rY+rBW)+(rY-1)*(rZ+rBW)+b;
-        listF[counter] = a*(rZ+rBW)*(rY+rBW)+b*(rZ+rBW)+2;
-        listB[counter] = a*(rZ+rBW)*(rY+rBW)+b*(rZ+rBW)+(rX-1);
-        listT[counter] = 1*(rZ+rBW)*(rY+rBW)+a*(rZ+rBW)+b;
-        listD[counter] = rZ*(rZ+rBW)*(rY+rBW)+a*(rZ+rBW)+b;
 
         counter++;
       }
     }
 
     ///////////////////////////////////////////////////////////////////////////
-    int bt = (rX + rBW);
-    int ss = 1;
-    int slice = bt*bt;
-    int slice3D = slice * 3;
-
-    #pragma omp parallel
-    #pragma omp single
-    {
-
-      // Calculate acceleration
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:initVel[(kk)*slice3D:ss*slice3D]) \
-          depend(in:vel[(kk)*slice3D:ss*slice3D]) \
-          depend(out:acc[(kk)*slice3D:ss*slice3D])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              calculateAcceleration(initVel,vel,acc,cell++,3);
-            }
-          }
-        }
-      }
-
-      #pragma omp taskwait
-
-      // Apply the pressure gradient
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:press[(kk)*slice:ss*slice]) \
-          depend(out:pressGrad[(kk)*slice3D:ss*slice3D])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              gradient(press,pressGrad,cell++);
-            }
-          }
-        }
-      }
 
-      #pragma omp taskwait
-
-      // divergence of the gradient of the velocity
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:vel[(kk)*slice3D:ss*slice3D]) \
-          depend(out:velLapp[(kk)*slice3D:ss*slice3D])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              lapplacian(initVel,velLapp,cell++,3);
-            }
+    size_t numActive  = pBlock->mNumActive;
+    size_t numRetired = pBlock->mNumRetired;
+
+    size_t * activeList  = pBlock->pActiveList;
+    size_t * retiredList = pBlock->pRetiredList;
+
+    // Reset the divergence of the retired tiles
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < numRetired; a++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+      pBlock->GetTileRange(retiredList[a],low,high);
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+low[0];
+          for(size_t i = low[0]; i < high[0]; i++) {
+            velDiv[cell++] = 0.0f;
           }
         }
       }
+    }
 
-      #pragma omp taskwait
-
-      // Combine it all together and store it back in A
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:velLapp[(kk)*slice3D:ss*slice3D]) \
-          depend(in:pressGrad[(kk)*slice3D:ss*slice3D]) \
-          depend(in:acc[(kk)*slice3D:ss*slice3D]) \
-          depend(out:initVel[(kk)*slice3D:ss*slice3D])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              if(!(pFlags[cell] & FIXED_VELOCITY_X))
-                initVel[cell*rDim+0] += ((rMu * velLapp[cell*rDim+0] / rRo) - (pressGrad[cell*rDim+0] / rRo) + (force[0] / rRo) - acc[cell*rDim+0]) * rDt;
-              if(!(pFlags[cell] & FIXED_VELOCITY_Y))
-                initVel[cell*rDim+1] += ((rMu * velLapp[cell*rDim+1] / rRo) - (pressGrad[cell*rDim+1] / rRo) + (force[1] / rRo) - acc[cell*rDim+1]) * rDt;
-              if(!(pFlags[cell] & FIXED_VELOCITY_Z))
-                initVel[cell*rDim+2] += ((rMu * velLapp[cell*rDim+2] / rRo) - (pressGrad[cell*rDim+2] / rRo) + (force[2] / rRo) - acc[cell*rDim+2]) * rDt;
-              cell++;
-            }
+    // Acceleration, pressure gradient and laplacian of the velocity
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < numActive; a++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+      pBlock->GetTileRange(activeList[a],low,high);
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+low[0];
+          for(size_t i = low[0]; i < high[0]; i++) {
+            calculateAcceleration(initVel,vel,acc,cell,3);
+            gradient(press,pressGrad,cell);
+            lapplacian(initVel,velLapp,cell,3);
+            cell++;
           }
         }
       }
+    }
 
-      #pragma omp taskwait
-
-      // applyBc(initVel,listL,rX*rX,normalL,1,3);
-      // applyBc(initVel,listR,rX*rX,normalR,1,3);
-      // applyBc(initVel,listT,rX*rX,normalT,1,3);
-      // applyBc(initVel,listB,rX*rX,normalB,1,3);
-      // applyBc(initVel,listF,rX*rX,normalF,1,3);
-      // applyBc(initVel,listD,rX*rX,normalD,1,3);
-
-      #pragma omp taskwait
-
-      // Combine it all together and store it back in A
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:initVel[(kk)*slice3D:ss*slice3D]) \
-          depend(out:pressDiff[(kk)*slice:ss*slice])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              divergence(initVel,velDiv,cell);
-              pressDiff[cell] = -rRo*rCC2*rDt * velDiv[cell];
-              cell++;
-            }
+    // Combine it all together and store it back in A
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < numActive; a++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+      pBlock->GetTileRange(activeList[a],low,high);
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+low[0];
+          for(size_t i = low[0]; i < high[0]; i++) {
+            if(!(pFlags[cell] & FIXED_VELOCITY_X))
+              initVel[cell*rDim+0] += ((rMu * velLapp[cell*rDim+0] / rRo) - (pressGrad[cell*rDim+0] / rRo) + (force[0] / rRo) - acc[cell*rDim+0]) * rDt;
+            if(!(pFlags[cell] & FIXED_VELOCITY_Y))
+              initVel[cell*rDim+1] += ((rMu * velLapp[cell*rDim+1] / rRo) - (pressGrad[cell*rDim+1] / rRo) + (force[1] / rRo) - acc[cell*rDim+1]) * rDt;
+            if(!(pFlags[cell] & FIXED_VELOCITY_Z))
+              initVel[cell*rDim+2] += ((rMu * velLapp[cell*rDim+2] / rRo) - (pressGrad[cell*rDim+2] / rRo) + (force[2] / rRo) - acc[cell*rDim+2]) * rDt;
+            cell++;
           }
         }
       }
+    }
 
-      #pragma omp taskwait
-
-      // applyBc(pressDiff,listL,rX*rX,normalL,1,1);
-      // applyBc(pressDiff,listR,rX*rX,normalR,1,1);
-      // applyBc(pressDiff,listT,rX*rX,normalT,1,1);
-      // applyBc(pressDiff,listB,rX*rX,normalB,1,1);
-      // applyBc(pressDiff,listF,rX*rX,normalF,1,1);
-      // applyBc(pressDiff,listD,rX*rX,normalD,1,1);
-
-      // #pragma omp taskwait
-      //
-      // Combine it all together and store it back in A
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:pressDiff[(kk)*slice:ss*slice]) \
-          depend(out:pressLapp[(kk)*slice:ss*slice])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              smoothing(velDiv,pressLapp,cell,1);
-              pressDiff[cell] = pressDiff[cell] * 0.1f + 0.9f*-rRo*rCC2*rDt * pressLapp[cell];
-              cell++;
-            }
+    // Divergence of the velocity
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < numActive; a++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+      pBlock->GetTileRange(activeList[a],low,high);
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+low[0];
+          for(size_t i = low[0]; i < high[0]; i++) {
+            divergence(initVel,velDiv,cell);
+            pressDiff[cell] = -rRo*rCC2*rDt * velDiv[cell];
+            cell++;
           }
         }
       }
+    }
 
-      #pragma omp taskwait
-
-      PrecisionType lapp_fact = (rDt) / rRo;
-
-      // Combine it all together and store it back in A
-      for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-        #pragma omp task \
-          depend(in:pressLapp[(kk)*slice:ss*slice]) \
-          depend(in:pressDiff[(kk)*slice:ss*slice]) \
-          depend(out:press[(kk)*slice:ss*slice])
-        for(size_t k = kk; k < kk+ss; k++) {
-          for(size_t j = rBWP; j < rY + rBWP; j++) {
-            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-            for(size_t i = rBWP; i < rX + rBWP; i++) {
-              if(!(pFlags[cell] & FIXED_PRESSURE))
-                press[cell] += pressDiff[cell];
-              cell++;
-            }
+    // Smooth the divergence and update the pressure
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t a = 0; a < numActive; a++) {
+      size_t low[MAX_DIM], high[MAX_DIM];
+      pBlock->GetTileRange(activeList[a],low,high);
+      for(size_t k = low[2]; k < high[2]; k++) {
+        for(size_t j = low[1]; j < high[1]; j++) {
+          size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+low[0];
+          for(size_t i = low[0]; i < high[0]; i++) {
+            smoothing(velDiv,pressLapp,cell,1);
+            pressDiff[cell] = pressDiff[cell] * 0.1f + 0.9f*-rRo*rCC2*rDt * pressLapp[cell];
+            if(!(pFlags[cell] & FIXED_PRESSURE))
+              press[cell] += pressDiff[cell];
+            cell++;
           }
         }
       }
-
-      // // Combine it all together and store it back in A
-      // for(size_t kk = rBWP; kk < rZ + rBWP; kk+=ss) {
-      //   #pragma omp task \
-      //     depend(in:pressDiff[(kk)*slice:ss*slice]) \
-      //     depend(out:pressLapp[(kk)*slice:ss*slice])
-      //   for(size_t k = kk; k < kk+ss; k++) {
-      //     for(size_t j = rBWP; j < rY + rBWP; j++) {
-      //       size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
-      //       for(size_t i = rBWP; i < rX + rBWP; i++) {
-      //         smoothing(pressLapp,press,cell,1);
-      //         cell++;
-      //       }
-      //     }
-      //   }
-      // }
-
     }
 
-    #pragma omp taskwait
-
-    applyBc(press,listL,rX*rX,normalL,1,1);
-    applyBc(press,listR,rX*rX,normalR,1,1);
-    // applyBc(press,listT,rX*rX,normalT,1,1);
-    // applyBc(press,listB,rX*rX,normalB,1,1);
-    // applyBc(press,listF,rX*rX,normalF,1,1);
-    // applyBc(press,listD,rX*rX,normalD,1,1);
-    // applyBc(press,listF,rX*rX,normalF,1,1);
-    // applyBc(press,listB,rX*rX,normalB,1,1);
-
-    // copyUpToDown(initVel,3);
-
+    applyBc(press,listL,sizeL,normalL,1,1);
+    applyBc(press,listR,sizeR,normalR,1,1);
   }
 
   void ExecuteVector_impl() {
@@ -589,11 +892,578 @@ public:
 
   }
 
-  void SetDiffTerm(PrecisionType diffTerm) {
-    mDiffTerm = diffTerm;
-  }
+  /**
+   * Executes an incompressible step, which is not limited by the speed of
+   * sound. The velocity is advanced without the pressure term and then
+   * projected with the pressure obtained from
+   *
+   *   -lap(p) = -ro/dt * div(u*)
+   *
+   * using the linear solver set with SetLinearSolver. Gradient and
+   * divergence are centered, so the projection is approximate.
+   **/
+  void ExecuteProjection() {
 
-private:
+    updateLists();
+
+    // Alias for the buffers
+    PrecisionType * initVel   = pBuffers[VELOCITY];
+    PrecisionType * vel       = pBuffers[AUX_3D_1];
+    PrecisionType * press     = pBuffers[PRESSURE];
+
+    PrecisionType * pressGrad = pBuffers[AUX_3D_4];
+    PrecisionType * velLapp   = pBuffers[AUX_3D_2];
+
+    PrecisionType * velDiv    = pBuffers[AUX_3D_5];
+    PrecisionType * pressRhs  = pBuffers[AUX_3D_6];
+
+    // PrecisionType force[3]    = {0.0f, 0.0f, -9.8f};
+    PrecisionType force[3]    = {0.0f, 0.0f, 0.0f};
+
+    if(pLinearSolver == NULL) {
+      printf("Error: No linear solver set for the pressure projection.\n");
+      exit(1);
+    }
+
+    // divergence of the gradient of the velocity
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          lapplacian(initVel,velLapp,cell++,3);
+        }
+      }
+    }
+
+    // Advected velocity without the pressure term
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        saveFixedVelocity(initVel,j,k);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          initVel[cell*rDim+0] = vel[cell*rDim+0] + ((rMu * velLapp[cell*rDim+0] / rRo) + (force[0] / rRo)) * rDt;
+          initVel[cell*rDim+1] = vel[cell*rDim+1] + ((rMu * velLapp[cell*rDim+1] / rRo) + (force[1] / rRo)) * rDt;
+          initVel[cell*rDim+2] = vel[cell*rDim+2] + ((rMu * velLapp[cell*rDim+2] / rRo) + (force[2] / rRo)) * rDt;
+          cell++;
+        }
+        restoreFixedVelocity(initVel,j,k);
+      }
+    }
+
+    // Right hand side of the pressure equation
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          divergence(initVel,velDiv,cell);
+          pressRhs[cell] = -rRo / rDt * velDiv[cell];
+          cell++;
+        }
+      }
+    }
+
+    pLinearSolver->Solve(press,pressRhs);
+
+    // Project the velocity
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        saveFixedVelocity(initVel,j,k);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          gradient(press,pressGrad,cell);
+          initVel[cell*rDim+0] -= pressGrad[cell*rDim+0] / rRo * rDt;
+          initVel[cell*rDim+1] -= pressGrad[cell*rDim+1] / rRo * rDt;
+          initVel[cell*rDim+2] -= pressGrad[cell*rDim+2] / rRo * rDt;
+          cell++;
+        }
+        restoreFixedVelocity(initVel,j,k);
+      }
+    }
+
+  }
+
+  /**
+   * Executes a split step. Viscous and external forces are applied once
+   * with dt over the advected velocity and the acoustic part is then
+   * sub-cycled round(dt/pdt) times with pdt (forward-backward):
+   *
+   *   u -= grad(p) / ro * pdt
+   *   p -= ro * cc2 * div(u) * pdt
+   *
+   * Each sub-step is one fused pass over velocity and one over pressure,
+   * so the advection only needs to run at the flow CFL. AUX_3D_6 is used
+   * as the second pressure buffer. Sub-steps are advanced in wavefronts of
+   * SetTemporalBlocking levels (rBW by default), so the grid is streamed
+   * once per group of levels instead of once per sub-step.
+   **/
+  void ExecuteSubcycle() {
+
+    updateLists();
+
+    // Alias for the buffers
+    PrecisionType * initVel   = pBuffers[VELOCITY];
+    PrecisionType * vel       = pBuffers[AUX_3D_1];
+    PrecisionType * press     = pBuffers[PRESSURE];
+
+    PrecisionType * velLapp   = pBuffers[AUX_3D_2];
+
+    // PrecisionType force[3]    = {0.0f, 0.0f, -9.8f};
+    PrecisionType force[3]    = {0.0f, 0.0f, 0.0f};
+
+    // divergence of the gradient of the velocity
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          lapplacian(initVel,velLapp,cell++,3);
+        }
+      }
+    }
+
+    // Advected velocity without the pressure term
+    #pragma omp parallel for
+    for(size_t k = rBWP; k < rZ + rBWP; k++) {
+      for(size_t j = rBWP; j < rY + rBWP; j++) {
+        size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+        saveFixedVelocity(initVel,j,k);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          initVel[cell*rDim+0] = vel[cell*rDim+0] + ((rMu * velLapp[cell*rDim+0] / rRo) + (force[0] / rRo)) * rDt;
+          initVel[cell*rDim+1] = vel[cell*rDim+1] + ((rMu * velLapp[cell*rDim+1] / rRo) + (force[1] / rRo)) * rDt;
+          initVel[cell*rDim+2] = vel[cell*rDim+2] + ((rMu * velLapp[cell*rDim+2] / rRo) + (force[2] / rRo)) * rDt;
+          cell++;
+        }
+        restoreFixedVelocity(initVel,j,k);
+      }
+    }
+
+    size_t substeps = GetSubsteps();
+
+    PrecisionType velFact   = rPdt / rRo;
+    PrecisionType pressFact = rRo * rCC2 * rPdt;
+
+    // The damping is given per step, each sub-step relaxes its share of it
+    mSubstepDamping = std::min(mAcousticDamping * rPdt / rDt,(PrecisionType)1.0f);
+
+    // The pressure alternates between both buffers
+    PrecisionType * pressOld  = press;
+    PrecisionType * pressNew  = pBuffers[AUX_3D_6];
+
+    // The wavefronts set Neumann ghosts inline
+    if(mTemporalDepth > 1 && !mGhosts.IsPeriodic(0) && !mGhosts.IsPeriodic(1) && !mGhosts.IsPeriodic(2)) {
+
+      mGhosts.Fill(pressOld,1);
+
+      for(size_t s = 0; s < substeps; s += mTemporalDepth) {
+        size_t levels = std::min(mTemporalDepth, substeps - s);
+
+        acousticWavefront(initVel,pressOld,pressNew,velFact,pressFact,levels);
+
+        if(levels % 2) {
+          std::swap(pressOld,pressNew);
+        }
+      }
+
+      substeps = 0;
+    } else {
+      mGhosts.Fill(pressOld,1);
+    }
+
+    for(size_t s = 0; s < substeps; s++) {
+
+      #pragma omp parallel
+      {
+        size_t kb, ke;
+
+        OwnedSlabs(rZ,BWP,rZ+BWP,kb,ke);
+
+        for(size_t k = kb; k < ke; k++) {
+          for(size_t j = rBWP; j < rY + rBWP; j++) {
+            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+            saveFixedVelocity(initVel,j,k);
+            for(size_t i = rBWP; i < rX + rBWP; i++) {
+              acousticVelocity(initVel,pressOld,velFact,cell++);
+            }
+            restoreFixedVelocity(initVel,j,k);
+          }
+        }
+
+        #pragma omp barrier
+
+        for(size_t k = kb; k < ke; k++) {
+          for(size_t j = rBWP; j < rY + rBWP; j++) {
+            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+            for(size_t i = rBWP; i < rX + rBWP; i++) {
+              acousticPressure(initVel,pressOld,pressNew,pressFact,cell++);
+            }
+            copyFixedPressure(pressOld,pressNew,j,k);
+          }
+        }
+
+        // Ghosts of the new pressure from the slabs of this thread, no barrier
+        mGhosts.FillOwned(pressNew,1,kb,ke);
+      }
+
+      std::swap(pressOld,pressNew);
+    }
+
+    // The ghosts of pressOld are already set
+    if(pressOld != press) {
+      #pragma omp parallel
+      {
+        size_t kb, ke;
+
+        OwnedSlabs(rZ,BWP,rZ+BWP,kb,ke);
+
+        for(size_t k = kb; k < ke; k++) {
+          for(size_t j = rBWP; j < rY + rBWP; j++) {
+            size_t cell = k*(rZ+rBW)*(rY+rBW)+j*(rY+BW)+rBWP;
+            for(size_t i = rBWP; i < rX + rBWP; i++) {
+              press[cell] = pressOld[cell];
+              cell++;
+            }
+          }
+        }
+
+        mGhosts.FillOwned(press,1,kb,ke);
+      }
+    }
+  }
+
+  /**
+   * Sets the number of acoustic sub-steps advanced per wavefront in
+   * ExecuteSubcycle. 1 runs one sweep over the grid per sub-step.
+   * @depth:      time levels per wavefront
+   **/
+  void SetTemporalBlocking(const size_t &depth) {
+    mTemporalDepth = std::max((size_t)1, depth);
+  }
+
+  /**
+   * Sets the damping of the acoustic pressure in ExecuteSubcycle, 0 (off)
+   * by default. The centered gradient and divergence do not see odd-even
+   * modes, which the damping relaxes towards the mean of the neighbours of
+   * the pressure. It is an artificial pressure diffusion that the explicit
+   * path does not have, so it is only an opt-in stabiliser for runs where
+   * those modes grow. The factor is the relaxation of a whole step of dt,
+   * split between the sub-steps in proportion to pdt, so it does not
+   * depend on their number.
+   * @damping:    relaxation factor per step in [0,1]
+   **/
+  void SetAcousticDamping(const PrecisionType &damping) {
+    mAcousticDamping = damping;
+  }
+
+  /**
+   * Number of acoustic sub-steps of ExecuteSubcycle for the current dt and pdt
+   **/
+  size_t GetSubsteps() {
+    return std::max((size_t)1, (size_t)(rDt / rPdt + 0.5f));
+  }
+
+  /**
+   * Sets the solver used for the pressure in ExecuteProjection. It takes
+   * the periodic directions of the solver
+   * @linearSolver:   linear solver
+   **/
+  void SetLinearSolver(LinearSolver * linearSolver) {
+
+    pLinearSolver = linearSolver;
+
+    if(pLinearSolver != NULL) {
+      for(size_t d = 0; d < MAX_DIM; d++) {
+        pLinearSolver->SetPeriodic(d,mGhosts.IsPeriodic(d));
+      }
+    }
+  }
+
+  /**
+   * Same as Solver::SetPeriodic, also for the linear solver
+   * @axis:     direction (0: x, 1: y, 2: z)
+   * @periodic: true for periodic, false for Neumann
+   **/
+  void SetPeriodic(const size_t &axis, const bool &periodic) {
+
+    Solver::SetPeriodic(axis,periodic);
+
+    if(pLinearSolver != NULL) {
+      pLinearSolver->SetPeriodic(axis,periodic);
+    }
+  }
+
+  void SetDiffTerm(PrecisionType diffTerm) {
+    mDiffTerm = diffTerm;
+  }
+
+private:
+
+  /**
+   * ExecuteTaskVelocity over the grid selected by DISPATCH_GRID
+   * @grid:     grid of the block
+   **/
+  template<class GridType>
+  void ExecuteTaskVelocityGrid(const GridType &grid) {
+
+    // Alias for the buffers
+    PrecisionType * initVel   = pBuffers[VELOCITY];
+    PrecisionType * vel       = pBuffers[AUX_3D_1];
+    PrecisionType * acc       = pBuffers[AUX_3D_3];
+    PrecisionType * press     = pBuffers[PRESSURE];
+
+    PrecisionType * pressGrad = pBuffers[AUX_3D_4];
+    PrecisionType * velLapp   = pBuffers[AUX_3D_2];
+
+    // PrecisionType force[3]    = {0.0f, 0.0f, -9.8f};
+    PrecisionType force[3]    = {0.0f, 0.0f, 0.0f};
+
+    ///////////////////////////////////////////////////////////////////////////
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      // Slabs owned by this thread, the same in every phase
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      // Calculate acceleration
+      phaseBegin(PERF_ACCELERATION);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              calculateAcceleration(initVel,vel,acc,cell++,3);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_ACCELERATION,kb,ke,grid);
+
+      #pragma omp barrier
+
+      // Apply the pressure gradient
+      phaseBegin(PERF_GRADIENT);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              gradient(grid,press,pressGrad,cell++);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_GRADIENT,kb,ke,grid);
+
+      #pragma omp barrier
+
+      // divergence of the gradient of the velocity
+      phaseBegin(PERF_LAPPLACIAN);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              lapplacian(grid,initVel,velLapp,cell++,3);
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_LAPPLACIAN,kb,ke,grid);
+
+      #pragma omp barrier
+
+      // Combine it all together and store it back in A
+      phaseBegin(PERF_VELOCITY);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          saveFixedVelocity(initVel,j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              initVel[cell*grid.Dim+0] += ((rMu * velLapp[cell*grid.Dim+0] / rRo) - (pressGrad[cell*grid.Dim+0] / rRo) + (force[0] / rRo) - acc[cell*grid.Dim+0]) * rDt;
+              initVel[cell*grid.Dim+1] += ((rMu * velLapp[cell*grid.Dim+1] / rRo) - (pressGrad[cell*grid.Dim+1] / rRo) + (force[1] / rRo) - acc[cell*grid.Dim+1]) * rDt;
+              initVel[cell*grid.Dim+2] += ((rMu * velLapp[cell*grid.Dim+2] / rRo) - (pressGrad[cell*grid.Dim+2] / rRo) + (force[2] / rRo) - acc[cell*grid.Dim+2]) * rDt;
+              cell++;
+            }
+          }
+          restoreFixedVelocity(initVel,j,k);
+        }
+      }
+
+      phaseEnd(PERF_VELOCITY,kb,ke,grid);
+    }
+  }
+
+  /**
+   * ExecuteTaskDivergence over the grid selected by DISPATCH_GRID
+   * @grid:     grid of the block
+   **/
+  template<class GridType>
+  void ExecuteTaskDivergenceGrid(const GridType &grid) {
+
+    // Alias for the buffers
+    PrecisionType * initVel   = pBuffers[VELOCITY];
+
+    PrecisionType * velDiv    = pBuffers[AUX_3D_5];
+    PrecisionType * pressDiff = pBuffers[AUX_3D_6];
+
+    ///////////////////////////////////////////////////////////////////////////
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      // Slabs owned by this thread, the same in every phase
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      // Combine it all together and store it back in A
+      phaseBegin(PERF_DIVERGENCE);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              divergence(grid,initVel,velDiv,cell);
+              pressDiff[cell] = -rRo*rCC2*rDt * velDiv[cell];
+              cell++;
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_DIVERGENCE,kb,ke,grid);
+    }
+  }
+
+  /**
+   * ExecuteTaskPressure over the grid selected by DISPATCH_GRID
+   * @grid:     grid of the block
+   **/
+  template<class GridType>
+  void ExecuteTaskPressureGrid(const GridType &grid) {
+
+    // Alias for the buffers
+    PrecisionType * press     = pBuffers[PRESSURE];
+
+    PrecisionType * velDiv    = pBuffers[AUX_3D_5];
+    PrecisionType * pressDiff = pBuffers[AUX_3D_6];
+    PrecisionType * pressLapp = pBuffers[AUX_3D_7];
+
+    size_t listL[grid.X*grid.X];
+    size_t listR[grid.X*grid.X];
+
+    long normalL[3] = {0,-1,0};
+    long normalR[3] = {0,1,0};
+
+    // Boundary conditions only apply on the faces on the border of the domain
+    size_t sizeL = pBlock->mDomainFace[FACE_Y_LOW]  ? grid.X*grid.X : 0;
+    size_t sizeR = pBlock->mDomainFace[FACE_Y_HIGH] ? grid.X*grid.X : 0;
+
+    uint counter = 0;
+
+    for(uint a = BWP; a < grid.Z + BWP; a++) {
+      for(uint b = BWP; b < grid.Y + BWP; b++) {
+
+        listL[counter] = a*grid.Slice+2*grid.Pitch+b;
+        listR[counter] = a*grid.Slice+(grid.Y-1)*grid.Pitch+b;
+
+        counter++;
+      }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    #pragma omp parallel
+    {
+      size_t kb, ke;
+
+      // Slabs owned by this thread, the same in every phase
+      OwnedSlabs(grid.Z,BWP,grid.Z+BWP,kb,ke);
+
+      // Combine it all together and store it back in A
+      phaseBegin(PERF_SMOOTHING);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              smoothing(grid,velDiv,pressLapp,cell,1);
+              pressDiff[cell] = pressDiff[cell] * 0.1f + 0.9f*-rRo*rCC2*rDt * pressLapp[cell];
+              cell++;
+            }
+          }
+        }
+      }
+
+      phaseEnd(PERF_SMOOTHING,kb,ke,grid);
+
+      #pragma omp barrier
+
+      // Combine it all together and store it back in A
+      phaseBegin(PERF_PRESSURE);
+
+      for(size_t k = kb; k < ke; k++) {
+        streamSlab(k);
+        for(size_t j = BWP; j < grid.Y + BWP; j++) {
+          size_t row = pBlock->FixedRow(j,k);
+          saveFixedPressure(press,j,k);
+          for(size_t r = pBlock->pRunOffset[row]; r < pBlock->pRunOffset[row+1]; r++) {
+            size_t cell = k*grid.Slice+j*grid.Pitch+pBlock->pRunStart[r];
+            for(size_t i = 0; i < pBlock->pRunLength[r]; i++) {
+              press[cell] += pressDiff[cell];
+              cell++;
+            }
+          }
+          restoreFixedPressure(press,j,k);
+        }
+      }
+
+      phaseEnd(PERF_PRESSURE,kb,ke,grid);
+
+      // Zero normal gradient of the pressure on the faces of the obstacles
+      if(pBlock->mNumSolidFaces) {
+        #pragma omp barrier
+        extrapolateSolidPressure(grid,press);
+      }
+    }
+
+    applyBc(press,listL,sizeL,normalL,1,1);
+    applyBc(press,listR,sizeR,normalR,1,1);
+  }
+
+  LinearSolver * pLinearSolver;
+
+  PrecisionType mAcousticDamping;
+  PrecisionType mSubstepDamping;
+  size_t        mTemporalDepth;
+
+  bool          mActiveReady;
+
+  // Values of the fixed cells during the flag-free updates
+  PrecisionType * mFixedSave;
 
   double mDiffTerm;
 
@@ -0,0 +1,254 @@
+#ifndef SOLVER_STENCIL_2D_H
+#define SOLVER_STENCIL_2D_H
+
+#include "solver_2d.h"
+
+/**
+ * Explicit weakly compressible solver of a 2D block, the counterpart of
+ * StencilSolver::ExecuteTask with 5 point stencils. The three phases of
+ * the 3D solver run in a single parallel region, and the acceleration and
+ * the pressure gradient are calculated inside the velocity update instead
+ * of being stored in their own buffers. Each thread fills the ghost cells
+ * of the fields read by the next phase right after its own rows.
+ **/
+class StencilSolver2D : public Solver2D<StencilSolver2D> {
+private:
+
+  inline void lapplacian(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell,
+      const size_t &Dim) {
+
+    const size_t &pitch = pBlock->mPaddY;
+
+    for (size_t d = 0; d < Dim; d++) {
+      gridB[cell*Dim+d] = (
+        gridA[(cell - 1)*Dim+d]   +                  // Left
+        gridA[(cell + 1)*Dim+d]   +                  // Right
+        gridA[(cell - pitch)*Dim+d]   +              // Up
+        gridA[(cell + pitch)*Dim+d]   -              // Down
+        4.0f * gridA[(cell)*Dim+d]) * rIdx * rIdx;
+    }
+  }
+
+  inline void divergence(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell ) {
+
+    const size_t &pitch = pBlock->mPaddY;
+
+    gridB[cell] =
+      (gridA[(cell + 1) * 2 + 0] - gridA[(cell - 1) * 2 + 0]) +
+      (gridA[(cell + pitch) * 2 + 1] - gridA[(cell - pitch) * 2 + 1]);
+
+    gridB[cell] *= 0.5f * rIdx;
+  }
+
+  /**
+   * Smoothing of the 3D solver in the plane of the block: the neighbours
+   * in z of StencilSolver::smoothing are the neighbours in y
+   **/
+  inline void smoothing(
+      PrecisionType * gridA,
+      PrecisionType * gridB,
+      const size_t &cell) {
+
+    const size_t &pitch = pBlock->mPaddY;
+
+    PrecisionType m1 = 1.0f/26.0f * 1.0f;
+    PrecisionType m2 = 1.0f/26.0f * 2.0f;
+    PrecisionType m4 = 1.0f/26.0f * 4.0f;
+    PrecisionType m8 = 1.0f/26.0f * 8.0f;
+
+    gridB[cell] = (
+      m8 * gridA[(cell    )]   +
+      m1 * gridA[(cell - 1)]   +                     // Left
+      m1 * gridA[(cell + 1)]   +                     // Right
+      m4 * gridA[(cell - pitch)] +                   // Up
+      m4 * gridA[(cell + pitch)] +                   // Down
+      m2 * gridA[(cell - pitch + 1)] +
+      m2 * gridA[(cell + pitch + 1)] +
+      m2 * gridA[(cell - pitch - 1)] +
+      m2 * gridA[(cell + pitch - 1)]);
+  }
+
+  /**
+   * Saves the velocity of the fixed cells of a row
+   * @vel:        velocity
+   * @j:          Index of the row
+   **/
+  inline void saveFixedVelocity(PrecisionType * vel, const size_t &j) {
+
+    for(size_t b = pBlock->pFixedOffset[j]; b < pBlock->pFixedOffset[j+1]; b++) {
+      size_t cell = pBlock->pFixedCells[b];
+      for(size_t d = 0; d < 2; d++) {
+        mFixedSave[b*MAX_DIM+d] = vel[cell*2+d];
+      }
+    }
+  }
+
+  /**
+   * Restores the fixed components of the velocity saved by saveFixedVelocity
+   * @vel:        velocity
+   * @j:          Index of the row
+   **/
+  inline void restoreFixedVelocity(PrecisionType * vel, const size_t &j) {
+
+    for(size_t b = pBlock->pFixedOffset[j]; b < pBlock->pFixedOffset[j+1]; b++) {
+      size_t cell = pBlock->pFixedCells[b];
+      unsigned char mask = pBlock->pFixedMask[b];
+      for(size_t d = 0; d < 2; d++) {
+        if(mask & (FIXED_MASK_X << d))
+          vel[cell*2+d] = mFixedSave[b*MAX_DIM+d];
+      }
+    }
+  }
+
+  /**
+   * Saves the pressure of the fixed cells of a row
+   * @press:      pressure
+   * @j:          Index of the row
+   **/
+  inline void saveFixedPressure(PrecisionType * press, const size_t &j) {
+
+    for(size_t b = pBlock->pFixedOffset[j]; b < pBlock->pFixedOffset[j+1]; b++) {
+      mFixedSave[b*MAX_DIM] = press[pBlock->pFixedCells[b]];
+    }
+  }
+
+  /**
+   * Restores the pressure of the FIXED_PRESSURE cells saved by saveFixedPressure
+   * @press:      pressure
+   * @j:          Index of the row
+   **/
+  inline void restoreFixedPressure(PrecisionType * press, const size_t &j) {
+
+    for(size_t b = pBlock->pFixedOffset[j]; b < pBlock->pFixedOffset[j+1]; b++) {
+      if(pBlock->pFixedMask[b] & FIXED_MASK_P)
+        press[pBlock->pFixedCells[b]] = mFixedSave[b*MAX_DIM];
+    }
+  }
+
+public:
+
+  StencilSolver2D(Block2D * block, const PrecisionType& Dt, const PrecisionType& Pdt) :
+      Solver2D(block,Dt,Pdt) {
+
+    pBlock->BuildFixedLists();
+
+    mFixedSave = (PrecisionType *)malloc(sizeof(PrecisionType) * std::max(pBlock->mNumFixed,(size_t)1) * MAX_DIM);
+  }
+
+  ~StencilSolver2D() {
+
+    free(mFixedSave);
+  }
+
+  void Prepare_impl() {
+  }
+
+  void Finish_impl() {
+  }
+
+  /**
+   * Advected velocity (AUX_3D_1) to new velocity and pressure, with the same
+   * operations as StencilSolver::ExecuteTask
+   **/
+  void ExecuteTask_impl() {
+
+    // Alias for the buffers
+    PrecisionType * initVel   = pBuffers[VELOCITY];
+    PrecisionType * vel       = pBuffers[AUX_3D_1];
+    PrecisionType * press     = pBuffers[PRESSURE];
+
+    PrecisionType * velLapp   = pBuffers[AUX_3D_2];
+
+    PrecisionType * velDiv    = pBuffers[AUX_3D_5];
+    PrecisionType * pressDiff = pBuffers[AUX_3D_6];
+    PrecisionType * pressLapp = pBuffers[AUX_3D_7];
+
+    PrecisionType force[2]    = {0.0f, 0.0f};
+
+    const size_t &pitch = pBlock->mPaddY;
+
+    #pragma omp parallel
+    {
+      size_t jb, je;
+
+      // Rows owned by this thread, the same in every phase
+      OwnedSlabs(rY,BWP,rY+BWP,jb,je);
+
+      // Laplacian of the velocity
+      for(size_t j = jb; j < je; j++) {
+        size_t cell = j*pitch+rBWP;
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          lapplacian(initVel,velLapp,cell++,2);
+        }
+      }
+
+      #pragma omp barrier
+
+      // Acceleration and pressure gradient, combined into the new velocity
+      for(size_t j = jb; j < je; j++) {
+        size_t cell = j*pitch+rBWP;
+        saveFixedVelocity(initVel,j);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          PrecisionType pressGrad[2];
+
+          pressGrad[0] = (press[cell + 1] - press[cell - 1]) * 0.5f * rIdx;
+          pressGrad[1] = (press[cell + pitch] - press[cell - pitch]) * 0.5f * rIdx;
+
+          for(size_t d = 0; d < 2; d++) {
+            PrecisionType acc = (vel[cell*2+d] - initVel[cell*2+d]) * rIdt;
+
+            initVel[cell*2+d] += ((rMu * velLapp[cell*2+d] / rRo) - (pressGrad[d] / rRo) + (force[d] / rRo) - acc) * rDt;
+          }
+          cell++;
+        }
+        restoreFixedVelocity(initVel,j);
+      }
+
+      mGhosts.FillOwned(initVel,2,jb,je);
+
+      #pragma omp barrier
+
+      // Divergence of the new velocity
+      for(size_t j = jb; j < je; j++) {
+        size_t cell = j*pitch+rBWP;
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          divergence(initVel,velDiv,cell);
+          pressDiff[cell] = -rRo*rCC2*rDt * velDiv[cell];
+          cell++;
+        }
+      }
+
+      mGhosts.FillOwned(velDiv,1,jb,je);
+
+      #pragma omp barrier
+
+      // Smooth the divergence and update the pressure
+      for(size_t j = jb; j < je; j++) {
+        size_t cell = j*pitch+rBWP;
+        saveFixedPressure(press,j);
+        for(size_t i = rBWP; i < rX + rBWP; i++) {
+          smoothing(velDiv,pressLapp,cell);
+          pressDiff[cell] = pressDiff[cell] * 0.1f + 0.9f*-rRo*rCC2*rDt * pressLapp[cell];
+          press[cell] += pressDiff[cell];
+          cell++;
+        }
+        restoreFixedPressure(press,j);
+      }
+
+      mGhosts.FillOwned(press,1,jb,je);
+    }
+  }
+
+private:
+
+  // Values of the fixed cells saved during the update of their rows
+  PrecisionType * mFixedSave;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef SUNBLOCK_C_H
+#define SUNBLOCK_C_H
+
+/**
+ * C interface of the solver (libsunblock.so).
+ *
+ * A domain is a cubic block of N^3 cells with its buffers, flags, the BFECC
+ * advection and the stencil diffusion. Buffers are stored in the padded
+ * layout of the solver, described by sunblock_layout. The host can register
+ * its own arrays with sunblock_set_buffer: they are used in place, without
+ * copies, as long as they follow the layout returned by sunblock_get_layout.
+ **/
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef USE_FLOAT
+typedef float  sunblock_real;
+#else
+typedef double sunblock_real;
+#endif
+
+typedef struct sunblock_domain sunblock_domain;
+
+enum sunblock_status {
+  SUNBLOCK_OK               = 0,
+  SUNBLOCK_ERROR_ARGUMENT   = 1,
+  SUNBLOCK_ERROR_LAYOUT     = 2
+};
+
+/* Same values as Buffers in defines.h */
+enum sunblock_buffer {
+  SUNBLOCK_VELOCITY         = 0,
+  SUNBLOCK_PRESSURE         = 1,
+  SUNBLOCK_NUM_BUFFERS      = 10
+};
+
+/* Same values as Flag in defines.h */
+enum sunblock_flag {
+  SUNBLOCK_FIXED_VELOCITY_X = 0x000001,
+  SUNBLOCK_FIXED_VELOCITY_Y = 0x000010,
+  SUNBLOCK_FIXED_VELOCITY_Z = 0x000100,
+  SUNBLOCK_FIXED_PRESSURE   = 0x001000
+};
+
+/**
+ * Memory layout of a buffer. Cell (i,j,k), with 0 <= i,j,k < cells + 2 *
+ * padding, starts at element i*stride[0] + j*stride[1] + k*stride[2] and
+ * holds "components" consecutive values of "element_size" bytes. Interior
+ * cells are padding <= i,j,k < cells + padding.
+ **/
+typedef struct sunblock_layout {
+  size_t cells;
+  size_t padding;
+  size_t stride[3];
+  size_t components;
+  size_t element_size;
+} sunblock_layout;
+
+typedef struct sunblock_timings {
+  size_t steps;
+  double advection;
+  double diffusion;
+  double total;
+} sunblock_timings;
+
+/**
+ * Creates a domain with zeroed buffers, no fixed cells and the properties of
+ * air. Returns NULL if the arguments are not valid
+ * @cells:    cells per side
+ * @size:     length of the side
+ **/
+sunblock_domain * sunblock_create(size_t cells, sunblock_real size);
+
+void sunblock_destroy(sunblock_domain * domain);
+
+/**
+ * Sets the density, viscosity, diffusivity and speed of sound
+ **/
+int sunblock_set_properties(
+  sunblock_domain * domain,
+  sunblock_real ro,
+  sunblock_real mu,
+  sunblock_real ka,
+  sunblock_real cc);
+
+/**
+ * Returns the layout a buffer registered with sunblock_set_buffer must have
+ **/
+int sunblock_get_layout(sunblock_domain * domain, int buffer, sunblock_layout * layout);
+
+/**
+ * Registers a host array as a buffer of the domain. The array is used in
+ * place and must outlive the domain or be unregistered passing NULL, which
+ * returns to the internal buffer. The layout must match sunblock_get_layout
+ **/
+int sunblock_set_buffer(
+  sunblock_domain * domain,
+  int buffer,
+  sunblock_real * data,
+  const sunblock_layout * layout);
+
+/**
+ * Returns the array currently used for a buffer, NULL if not valid
+ **/
+sunblock_real * sunblock_get_buffer(sunblock_domain * domain, int buffer);
+
+/**
+ * Registers a host array of flags (one unsigned int per cell, same layout
+ * as a buffer with one component). NULL returns to the internal flags
+ **/
+int sunblock_set_flags(
+  sunblock_domain * domain,
+  unsigned int * flags,
+  const sunblock_layout * layout);
+
+/**
+ * Returns the flags currently used. Call sunblock_update_flags after
+ * modifying them
+ **/
+unsigned int * sunblock_get_flags(sunblock_domain * domain);
+
+int sunblock_update_flags(sunblock_domain * domain);
+
+/**
+ * Fixes the velocity on the six walls of the domain, as the cavity of bfecc
+ **/
+int sunblock_fix_walls(sunblock_domain * domain);
+
+/**
+ * Initializes the lid driven cavity: zero pressure and velocity except on
+ * the lid
+ **/
+int sunblock_initialize_cavity(sunblock_domain * domain, sunblock_real lid);
+
+/**
+ * Advances the domain a number of steps of size dt
+ **/
+int sunblock_step(sunblock_domain * domain, sunblock_real dt, size_t steps);
+
+/**
+ * Returns the largest velocity component of the domain
+ **/
+sunblock_real sunblock_max_velocity(sunblock_domain * domain);
+
+/**
+ * Returns the time spent in each phase since the creation of the domain or
+ * the last call to sunblock_reset_timings
+ **/
+int sunblock_get_timings(sunblock_domain * domain, sunblock_timings * timings);
+
+int sunblock_reset_timings(sunblock_domain * domain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <vector>
+#include <algorithm>
+
+#include <omp.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+#include "defines.h"
+
+/**
+ * Slabs owned by the calling thread of a parallel region. Ownership is
+ * calculated on the interior slabs [BWP, Z+BWP) and the padding slabs go to
+ * the first and the last threads, so for a given number of threads a slab
+ * always belongs to the same thread whatever the range of the loop. Loops
+ * of every phase, allocation and first-touch that use it keep the data of
+ * a slab in the cache and the NUMA node of its owner.
+ * @Z:        interior slabs of the block
+ * @begin:    first slab of the loop
+ * @end:      last slab of the loop (not included)
+ * @low:      first slab of the thread
+ * @high:     last slab of the thread (not included)
+ **/
+inline void OwnedSlabs(
+    const size_t &Z,
+    const size_t &begin,
+    const size_t &end,
+    size_t &low,
+    size_t &high) {
+
+  size_t threads = omp_get_num_threads();
+  size_t thread  = omp_get_thread_num();
+
+  size_t chunk = Z / threads;
+  size_t extra = Z % threads;
+
+  low  = BWP + thread * chunk + std::min(thread,extra);
+  high = low + chunk + (thread < extra ? 1 : 0);
+
+  if(thread == 0)           low  = 0;
+  if(thread == threads - 1) high = Z + BW;
+
+  low  = std::max(low,begin);
+  high = std::min(high,end);
+  high = std::max(high,low);
+}
+
+/**
+ * Zeroes a grid with every slab written by its owner, so the pages of the
+ * slab are placed in the NUMA node of the thread that works on them
+ * @grid:     grid
+ * @X,Y,Z:    size of the grid without padding
+ * @dim:      components per cell
+ **/
+template <typename T>
+void FirstTouch(
+    T * grid,
+    const size_t &X,
+    const size_t &Y,
+    const size_t &Z,
+    const size_t &dim) {
+
+  size_t slab = (X+BW) * (Y+BW) * dim;
+
+  #pragma omp parallel
+  {
+    size_t kb, ke;
+
+    OwnedSlabs(Z,0,Z+BW,kb,ke);
+
+    for(size_t c = kb * slab; c < ke * slab; c++) {
+      grid[c] = 0;
+    }
+  }
+}
+
+/**
+ * CPU and NUMA layout of the machine, read from the Linux sysfs, used to
+ * pin the threads. CPUs are ordered by NUMA node and, inside a node, the
+ * first hardware thread of every core goes before their siblings, so the
+ * consecutive threads that own consecutive slabs share a node and do not
+ * share a core until all the cores are used.
+ **/
+class Topology {
+public:
+
+  Topology() {
+
+#ifndef _WIN32
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0,sizeof(allowed),&allowed);
+
+    std::vector<size_t> nodeOf(CPU_SETSIZE,0);
+
+    mNumNodes = 0;
+
+    for(size_t n = 0; n < CPU_SETSIZE; n++) {
+      char path[256];
+      sprintf(path,"/sys/devices/system/node/node%zu/cpulist",n);
+
+      std::vector<size_t> cpus;
+
+      if(!ReadList(path,cpus)) {
+        continue;
+      }
+
+      for(size_t c = 0; c < cpus.size(); c++) {
+        if(cpus[c] < CPU_SETSIZE) {
+          nodeOf[cpus[c]] = n;
+        }
+      }
+
+      mNumNodes = n + 1;
+    }
+
+    mNumNodes = std::max(mNumNodes,(size_t)1);
+
+    std::vector<Cpu> cpus;
+
+    for(size_t c = 0; c < CPU_SETSIZE; c++) {
+      if(!CPU_ISSET(c,&allowed)) {
+        continue;
+      }
+
+      Cpu cpu;
+      char path[256];
+
+      cpu.Id      = c;
+      cpu.Node    = nodeOf[c];
+      cpu.Package = 0;
+      cpu.Core    = c;
+      cpu.Sibling = 0;
+
+      sprintf(path,"/sys/devices/system/cpu/cpu%zu/topology/physical_package_id",c);
+      ReadValue(path,cpu.Package);
+
+      sprintf(path,"/sys/devices/system/cpu/cpu%zu/topology/core_id",c);
+      ReadValue(path,cpu.Core);
+
+      // Rank of the cpu among the hardware threads of its core
+      std::vector<size_t> siblings;
+
+      sprintf(path,"/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list",c);
+      if(ReadList(path,siblings)) {
+        cpu.Sibling = std::find(siblings.begin(),siblings.end(),c) - siblings.begin();
+      }
+
+      cpus.push_back(cpu);
+    }
+
+    std::sort(cpus.begin(),cpus.end(),CpuOrder);
+
+    for(size_t c = 0; c < cpus.size(); c++) {
+      mCpus.push_back(cpus[c].Id);
+      mNodes.push_back(cpus[c].Node);
+    }
+#endif
+
+    if(mCpus.empty()) {
+      mNumNodes = 1;
+      mCpus.push_back(0);
+      mNodes.push_back(0);
+    }
+  }
+
+  ~Topology() {}
+
+  /**
+   * Pins every thread of the OpenMP team to a CPU, in the order of the
+   * topology. Threads beyond the number of CPUs wrap around
+   **/
+  void Pin() {
+
+#ifndef _WIN32
+    #pragma omp parallel
+    {
+      size_t thread = omp_get_thread_num();
+
+      cpu_set_t set;
+
+      CPU_ZERO(&set);
+      CPU_SET(mCpus[thread % mCpus.size()],&set);
+
+      if(sched_setaffinity(0,sizeof(set),&set) != 0) {
+        printf("Warning: Unable to pin thread %zu to cpu %zu.\n",thread,mCpus[thread % mCpus.size()]);
+      }
+    }
+#endif
+  }
+
+  /**
+   * Prints the cpu and the node of every thread
+   * @threads:  number of threads
+   **/
+  void Print(const size_t &threads) {
+
+    printf("Topology: %zu cpus, %zu NUMA nodes\n",mCpus.size(),mNumNodes);
+
+    for(size_t t = 0; t < threads; t++) {
+      printf("  Thread %zu: cpu %zu, node %zu\n",t,mCpus[t % mCpus.size()],mNodes[t % mCpus.size()]);
+    }
+  }
+
+  size_t GetNumCpus() {
+    return mCpus.size();
+  }
+
+  size_t GetNumNodes() {
+    return mNumNodes;
+  }
+
+private:
+
+  struct Cpu {
+    size_t Id;
+    size_t Node;
+    size_t Package;
+    size_t Core;
+    size_t Sibling;
+  };
+
+  static bool CpuOrder(const Cpu &a, const Cpu &b) {
+    if(a.Node    != b.Node)    return a.Node    < b.Node;
+    if(a.Sibling != b.Sibling) return a.Sibling < b.Sibling;
+    if(a.Package != b.Package) return a.Package < b.Package;
+    if(a.Core    != b.Core)    return a.Core    < b.Core;
+    return a.Id < b.Id;
+  }
+
+  /**
+   * Reads a number from a sysfs file
+   * @path:     file
+   * @value:    result, unchanged if the file can not be read
+   **/
+  static bool ReadValue(const char * path, size_t &value) {
+
+    FILE * file = fopen(path,"r");
+
+    if(file == NULL) {
+      return false;
+    }
+
+    bool read = fscanf(file,"%zu",&value) == 1;
+
+    fclose(file);
+
+    return read;
+  }
+
+  /**
+   * Reads a list of cpus ("0-3,8,10-11") from a sysfs file
+   * @path:     file
+   * @list:     result
+   **/
+  static bool ReadList(const char * path, std::vector<size_t> &list) {
+
+    FILE * file = fopen(path,"r");
+
+    if(file == NULL) {
+      return false;
+    }
+
+    size_t first, last;
+    char separator = ',';
+
+    while(separator == ',' && fscanf(file,"%zu",&first) == 1) {
+      last = first;
+      if(fscanf(file,"%c",&separator) == 1 && separator == '-') {
+        if(fscanf(file,"%zu",&last) != 1 || fscanf(file,"%c",&separator) != 1) {
+          separator = '\n';
+        }
+      }
+      for(size_t c = first; c <= last; c++) {
+        list.push_back(c);
+      }
+    }
+
+    fclose(file);
+
+    return !list.empty();
+  }
+
+  size_t mNumNodes;
+
+  std::vector<size_t> mCpus;
+  std::vector<size_t> mNodes;
+};
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef TRACERS_H
+#define TRACERS_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "hacks.h"
+#include "block.h"
+#include "grid.h"
+#include "interpolator.h"
+
+/**
+ * Massless Lagrangian tracers advanced with the velocity of the block.
+ *
+ * Particles are stored as separate arrays of coordinates and advanced in
+ * batches of TRACER_BATCH particles, so the trilinear interpolation of the
+ * velocity runs vectorized over the particles of the batch. Batches are
+ * distributed between the threads. Particles are periodically sorted by
+ * the Morton key of their cell, so the particles of a batch and of a
+ * thread gather the velocity from nearby cells.
+ *
+ * Positions are written to the binary file "<prefix>.tracers" with one
+ * record per written step, with the particles always in the order they
+ * were added:
+ *
+ *   size_t step, double time, size_t count, float position[count][3]
+ **/
+class TracerParticles {
+public:
+
+  // Particles advanced together by the vectorized interpolation
+  static const size_t TRACER_BATCH = 64;
+
+  /**
+   * Creates an empty set of tracers
+   * @block:      block with the velocity field
+   * @prefix:     prefix of the output file
+   * @frequency:  write every "frequency" steps
+   * @sort:       sort the particles every "sort" steps (0 to disable)
+   **/
+  TracerParticles(Block * block, const char * prefix, const size_t &frequency, const size_t &sort) :
+      pBlock(block),
+      mPrefix(prefix),
+      mFrequency(std::max(frequency,(size_t)1)),
+      mSort(sort),
+      mSteps(0),
+      pFile(NULL) {
+
+    // Particles are kept between the centres of the first and the last
+    // interior cells of the block
+    mLow  = block->rDx * BWP;
+    mHigh[0] = block->rDx * (block->rX + BWP - 1);
+    mHigh[1] = block->rDx * (block->rY + BWP - 1);
+    mHigh[2] = block->rDx * (block->rZ + BWP - 1);
+  }
+
+  ~TracerParticles() {
+    if(pFile != NULL) {
+      pFile->close();
+      delete pFile;
+    }
+  }
+
+  /**
+   * Adds a particle
+   * @x,y,z:    global coordinates of the particle
+   **/
+  void AddParticle(const PrecisionType &x, const PrecisionType &y, const PrecisionType &z) {
+    mId.push_back(mX.size());
+    mX.push_back(std::min(std::max(x,mLow),mHigh[0]));
+    mY.push_back(std::min(std::max(y,mLow),mHigh[1]));
+    mZ.push_back(std::min(std::max(z,mLow),mHigh[2]));
+  }
+
+  /**
+   * Adds a regular lattice of particles in a box. Particles are placed at
+   * the centres of the cells of the lattice
+   * @from:     lower corner of the box
+   * @to:       upper corner of the box
+   * @n:        particles in every direction
+   **/
+  void AddLattice(const PrecisionType * from, const PrecisionType * to, const size_t * n) {
+
+    size_t first = mX.size();
+    size_t count = n[0] * n[1] * n[2];
+
+    mId.resize(first + count);
+    mX.resize(first + count);
+    mY.resize(first + count);
+    mZ.resize(first + count);
+
+    #pragma omp parallel for
+    for(size_t k = 0; k < n[2]; k++) {
+      for(size_t j = 0; j < n[1]; j++) {
+        for(size_t i = 0; i < n[0]; i++) {
+          size_t p = first + (k * n[1] + j) * n[0] + i;
+
+          PrecisionType x = from[0] + (to[0] - from[0]) * (i + 0.5f) / n[0];
+          PrecisionType y = from[1] + (to[1] - from[1]) * (j + 0.5f) / n[1];
+          PrecisionType z = from[2] + (to[2] - from[2]) * (k + 0.5f) / n[2];
+
+          mId[p] = p;
+          mX[p]  = std::min(std::max(x,mLow),mHigh[0]);
+          mY[p]  = std::min(std::max(y,mLow),mHigh[1]);
+          mZ[p]  = std::min(std::max(z,mLow),mHigh[2]);
+        }
+      }
+    }
+  }
+
+  /**
+   * Advances the particles one time step with the current velocity of the
+   * block, which is considered constant during the step. Sorts them if it
+   * is a sorting step
+   * @dt:       time step
+   * @order:    order of the Runge-Kutta integration (2 or 4)
+   **/
+  void Advance(const PrecisionType &dt, const size_t &order) {
+
+    if(order != 2 && order != 4) {
+      printf("Error: Runge-Kutta of order %zu is not supported for the tracers.\n",order);
+      exit(1);
+    }
+
+    if(mSort && !(mSteps % mSort)) {
+      Sort();
+    }
+
+    DISPATCH_GRID(pBlock,AdvanceGrid,dt,order)
+
+    mSteps++;
+  }
+
+  /**
+   * Sorts the particles by the Morton key of their cell
+   **/
+  void Sort() {
+
+    size_t count = mX.size();
+
+    std::vector<std::pair<uint64_t,size_t> > keys(count);
+
+    PrecisionType idx = pBlock->rIdx;
+
+    #pragma omp parallel for
+    for(size_t p = 0; p < count; p++) {
+      keys[p].first  = interleave64(
+        (uint64_t)(mX[p] * idx),
+        (uint64_t)(mY[p] * idx),
+        (uint64_t)(mZ[p] * idx));
+      keys[p].second = p;
+    }
+
+    // Particles move little between sorts, keys are almost sorted
+    std::sort(keys.begin(),keys.end());
+
+    Permute(mX,keys);
+    Permute(mY,keys);
+    Permute(mZ,keys);
+    Permute(mId,keys);
+  }
+
+  /**
+   * Writes the positions of the particles, if it is an output step
+   * @step:     current step
+   * @time:     current time
+   **/
+  void Write(const size_t &step, const double &time) {
+
+    if(step % mFrequency) {
+      return;
+    }
+
+    if(pFile == NULL) {
+      std::string fileName = mPrefix + ".tracers";
+
+      pFile = new std::ofstream(fileName.c_str(), std::ios::out | std::ios::binary);
+
+      if(!pFile->is_open()) {
+        printf("Error: Unable to open the tracers file \"%s\".\n",fileName.c_str());
+        exit(1);
+      }
+    }
+
+    size_t count = mX.size();
+
+    mRecord.resize(count * 3);
+
+    // Back to the order of addition
+    #pragma omp parallel for
+    for(size_t p = 0; p < count; p++) {
+      mRecord[mId[p]*3+0] = (float)mX[p];
+      mRecord[mId[p]*3+1] = (float)mY[p];
+      mRecord[mId[p]*3+2] = (float)mZ[p];
+    }
+
+    pFile->write((const char *)&step,sizeof(size_t));
+    pFile->write((const char *)&time,sizeof(double));
+    pFile->write((const char *)&count,sizeof(size_t));
+    pFile->write((const char *)&mRecord[0],sizeof(float) * mRecord.size());
+    pFile->flush();
+  }
+
+  /**
+   * Returns the number of particles
+   **/
+  size_t GetNumParticles() {
+    return mX.size();
+  }
+
+private:
+
+  /**
+   * Advance over the grid selected by DISPATCH_GRID
+   * @grid:     grid of the block
+   * @dt:       time step
+   * @order:    order of the Runge-Kutta integration (2 or 4)
+   **/
+  template<class GridType>
+  void AdvanceGrid(const GridType &grid, const PrecisionType &dt, const size_t &order) {
+
+    const PrecisionType * vel = pBlock->pBuffers[VELOCITY];
+
+    size_t count   = mX.size();
+    size_t batches = (count + TRACER_BATCH - 1) / TRACER_BATCH;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t b = 0; b < batches; b++) {
+      size_t first = b * TRACER_BATCH;
+      size_t size  = std::min((size_t)TRACER_BATCH,count - first);
+
+      PrecisionType * x = &mX[first];
+      PrecisionType * y = &mY[first];
+      PrecisionType * z = &mZ[first];
+
+      // Stage positions and velocities, and accumulated displacement
+      PrecisionType sx[TRACER_BATCH], sy[TRACER_BATCH], sz[TRACER_BATCH];
+      PrecisionType ku[TRACER_BATCH], kv[TRACER_BATCH], kw[TRACER_BATCH];
+      PrecisionType dx[TRACER_BATCH], dy[TRACER_BATCH], dz[TRACER_BATCH];
+
+      TrilinealInterpolator::InterpolateBatch(grid,pBlock,vel,x,y,z,ku,kv,kw,size);
+
+      if(order == 2) {
+        // Midpoint
+        stage(x,y,z,ku,kv,kw,0.5f * dt,sx,sy,sz,size);
+        TrilinealInterpolator::InterpolateBatch(grid,pBlock,vel,sx,sy,sz,ku,kv,kw,size);
+
+        #pragma omp simd
+        for(size_t p = 0; p < size; p++) {
+          dx[p] = dt * ku[p];
+          dy[p] = dt * kv[p];
+          dz[p] = dt * kw[p];
+        }
+      } else {
+        const PrecisionType h[3] = {0.5f * dt, 0.5f * dt, dt};
+        const PrecisionType w[3] = {2.0f, 2.0f, 1.0f};
+
+        #pragma omp simd
+        for(size_t p = 0; p < size; p++) {
+          dx[p] = ku[p];
+          dy[p] = kv[p];
+          dz[p] = kw[p];
+        }
+
+        for(size_t s = 0; s < 3; s++) {
+          stage(x,y,z,ku,kv,kw,h[s],sx,sy,sz,size);
+          TrilinealInterpolator::InterpolateBatch(grid,pBlock,vel,sx,sy,sz,ku,kv,kw,size);
+
+          #pragma omp simd
+          for(size_t p = 0; p < size; p++) {
+            dx[p] += w[s] * ku[p];
+            dy[p] += w[s] * kv[p];
+            dz[p] += w[s] * kw[p];
+          }
+        }
+
+        #pragma omp simd
+        for(size_t p = 0; p < size; p++) {
+          dx[p] *= dt / 6.0f;
+          dy[p] *= dt / 6.0f;
+          dz[p] *= dt / 6.0f;
+        }
+      }
+
+      const PrecisionType low = mLow;
+      const PrecisionType hx  = mHigh[0];
+      const PrecisionType hy  = mHigh[1];
+      const PrecisionType hz  = mHigh[2];
+
+      #pragma omp simd
+      for(size_t p = 0; p < size; p++) {
+        PrecisionType nx = x[p] + dx[p];
+        PrecisionType ny = y[p] + dy[p];
+        PrecisionType nz = z[p] + dz[p];
+
+        x[p] = nx < low ? low : nx > hx ? hx : nx;
+        y[p] = ny < low ? low : ny > hy ? hy : ny;
+        z[p] = nz < low ? low : nz > hz ? hz : nz;
+      }
+    }
+  }
+
+  /**
+   * Position of an intermediate stage of the integration
+   * @x,y,z:    positions at the beginning of the step
+   * @u,v,w:    velocities of the previous stage
+   * @h:        time to the stage
+   * @sx,sy,sz: result
+   * @size:     particles of the batch
+   **/
+  static void stage(
+      const PrecisionType * x,
+      const PrecisionType * y,
+      const PrecisionType * z,
+      const PrecisionType * u,
+      const PrecisionType * v,
+      const PrecisionType * w,
+      const PrecisionType &h,
+      PrecisionType * sx,
+      PrecisionType * sy,
+      PrecisionType * sz,
+      const size_t &size) {
+
+    #pragma omp simd
+    for(size_t p = 0; p < size; p++) {
+      sx[p] = x[p] + h * u[p];
+      sy[p] = y[p] + h * v[p];
+      sz[p] = z[p] + h * w[p];
+    }
+  }
+
+  /**
+   * Reorders an array of the particles with the result of the sort
+   * @values:   array
+   * @keys:     sorted keys and previous position of every particle
+   **/
+  template<typename T>
+  static void Permute(std::vector<T> &values, const std::vector<std::pair<uint64_t,size_t> > &keys) {
+
+    std::vector<T> sorted(values.size());
+
+    #pragma omp parallel for
+    for(size_t p = 0; p < keys.size(); p++) {
+      sorted[p] = values[keys[p].second];
+    }
+
+    values.swap(sorted);
+  }
+
+  Block * pBlock;
+
+  std::string mPrefix;
+
+  size_t mFrequency;
+  size_t mSort;
+  size_t mSteps;
+
+  PrecisionType mLow;
+  PrecisionType mHigh[MAX_DIM];
+
+  std::vector<size_t>        mId;
+  std::vector<PrecisionType> mX;
+  std::vector<PrecisionType> mY;
+  std::vector<PrecisionType> mZ;
+
+  std::vector<float> mRecord;
+
+  std::ofstream * pFile;
+};
+
+#endif
@@ -25,7 +25,30 @@ public:
       const size_t &dim,
       const size_t align) {
 
-    size_t elements     = (X+BW) * (Y+BW) * (Z+BW);
+    allocateElements(grid, (X+BW) * (Y+BW) * (Z+BW), dim, align);
+  }
+
+  /**
+   * Allocates a padded 2D grid, (X+BW)*(Y+BW) elements of dim components
+   **/
+  template <typename T>
+  void AllocateGrid2D(
+      T ** grid,
+      const size_t &X,
+      const size_t &Y,
+      const size_t &dim,
+      const size_t align) {
+
+    allocateElements(grid, (X+BW) * (Y+BW), dim, align);
+  }
+
+  template <typename T>
+  void allocateElements(
+      T ** grid,
+      const size_t &elements,
+      const size_t &dim,
+      const size_t align) {
+
     size_t element_size = sizeof(T) * dim;
 
     size_t size         = elements * element_size;
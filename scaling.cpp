@@ -0,0 +1,415 @@
+#include <vector>
+
+#include <sys/types.h>
+#include <omp.h>
+
+// Solver
+#include "include/utils.h"
+#include "include/block.h"
+#include "include/defines.h"
+#include "include/solver_stencil.h"
+#include "include/solver_bfecc.h"
+#include "include/interpolator.h"
+#include "include/topology.h"
+
+#if defined(USE_MONOTONE_CUBIC)
+typedef MonotoneCubicInterpolator InterpolatorType;
+#elif defined(USE_TRICUBIC)
+typedef TricubicInterpolator      InterpolatorType;
+#else
+typedef TrilinealInterpolator     InterpolatorType;
+#endif
+
+// Steps of every measurement, at least, and steps between restarts of the cavity
+const size_t        MIN_STEPS        = 3;
+const size_t        RESTART_STEPS    = 50;
+
+// Cells per side of the blocks of ExecuteBlock
+const size_t        BLOCK_CELLS      = 16;
+
+// Executors of the solvers
+enum Executor {
+  EXECUTOR_EXECUTE,   // Execute
+  EXECUTOR_BLOCK,     // ExecuteBlock (the stencil solver has none, it uses ExecuteTask)
+  EXECUTOR_TASK,      // ExecuteTask
+  MAX_EXECUTOR
+};
+
+const char * EXECUTOR_NAMES[MAX_EXECUTOR] = {"execute", "block", "task"};
+
+// Phases of a step timed by the driver
+enum ScalingPhase {
+  SCALING_ADVECTION,  // BfeccSolver
+  SCALING_DIFFUSION,  // StencilSolver
+  SCALING_STEP,       // Whole step
+  MAX_SCALING_PHASE
+};
+
+const char * PHASE_NAMES[MAX_SCALING_PHASE] = {"advection", "diffusion", "step"};
+
+// Scaling studies
+enum Study {
+  STUDY_STRONG,       // Same grid for all the thread counts
+  STUDY_WEAK,         // Same cells per thread for all the thread counts
+  MAX_STUDY
+};
+
+const char * STUDY_NAMES[MAX_STUDY] = {"strong", "weak"};
+
+/**
+ * Result of a run of the step loop
+ **/
+struct Measure {
+  size_t Study;
+  size_t Executor;
+  size_t N;
+  size_t Threads;
+  size_t Steps;
+  size_t Block;                             // Cells per side of the blocks of ExecuteBlock
+
+  double Time[MAX_SCALING_PHASE];           // Seconds per step
+  double Efficiency[MAX_SCALING_PHASE];
+};
+
+PrecisionType calculateMaxDt(PrecisionType h, PrecisionType cc, PrecisionType maxv) {
+  return std::min(h/cc,h/maxv);
+}
+
+/**
+ * Runs the step loop of bfecc (explicit pressure) in a lid driven cavity
+ * until the budget is spent, and returns the time per step of each phase.
+ * The grids are allocated and first touched by the threads of the run.
+ * @N:        cells per side
+ * @threads:  number of threads
+ * @executor: executor of the solvers
+ * @budget:   wall clock time of the step loop, in seconds
+ **/
+Measure run(
+    const size_t &N,
+    const size_t &threads,
+    const size_t &executor,
+    const double &budget) {
+
+  // The last block of each side is ragged when BLOCK_CELLS does not divide N+BW
+  size_t NE       = std::min(BLOCK_CELLS,N+BW);
+  size_t NB       = (N+BW+NE-1)/NE;
+  size_t Dim      = 3;
+
+  PrecisionType h        = 1.0f;
+  PrecisionType omega    = 1.0f;
+  PrecisionType dx       = h/(PrecisionType)N;
+  PrecisionType dt       = 0.1f;
+  PrecisionType pdt      = 0.1f;
+  PrecisionType maxv     = 0.0f;
+
+  // air
+  PrecisionType ro       = 1.0f;
+  PrecisionType mu       = 1.9e-5;
+  PrecisionType ka       = 1.0e-5f;
+  PrecisionType cc       = 1.0f;
+  PrecisionType cc2      = cc * cc;
+
+  omp_set_num_threads(threads);
+
+  MemManager memmrg(false);
+
+  PrecisionType * buffers[MAX_BUFF];
+  uint          * flags = NULL;
+
+  for(size_t b = 0; b < MAX_BUFF; b++) {
+    memmrg.AllocateGrid(&buffers[b], N, N, N, 3, 1);
+    FirstTouch(buffers[b], N, N, N, 3);
+  }
+
+  memmrg.AllocateGrid(&flags, N, N, N, 1, 1);
+  FirstTouch(flags, N, N, N, 1);
+
+  for(uint a = BWP; a < N+BWP; a++) {
+    for(uint b = BWP; b < N+BWP; b++) {
+      uint fixed = FIXED_VELOCITY_X | FIXED_VELOCITY_Y | FIXED_VELOCITY_Z;
+
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+1] |= fixed;
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+N] |= fixed;
+      flags[a*(N+BW)*(N+BW)+1*(N+BW)+b] |= fixed;
+      flags[a*(N+BW)*(N+BW)+N*(N+BW)+b] |= fixed;
+      flags[1*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+      flags[N*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+    }
+  }
+
+  Block * block = new Block(
+    buffers, flags,
+    dx, omega, ro, mu, ka, cc2, BW,
+    N, N, N, NB, NE, Dim
+  );
+
+  block->Zero();
+  block->InitializeVelocity();
+  block->InitializePressure();
+
+  block->calculateMaxVelocity(maxv);
+  dt = calculateMaxDt(dx,cc,maxv);
+
+  BfeccSolver<InterpolatorType> AdvectionSolver(block,dt,pdt);
+  StencilSolver                 DiffusionSolver(block,dt,pdt);
+
+  AdvectionSolver.Prepare();
+
+  Measure measure;
+
+  measure.N        = N;
+  measure.Threads  = threads;
+  measure.Executor = executor;
+  measure.Steps    = 0;
+  measure.Block    = NE;
+
+  for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+    measure.Time[p]       = 0.0;
+    measure.Efficiency[p] = 0.0;
+  }
+
+  // The first step is not timed, it brings the grids into the caches
+  for(size_t s = 0; measure.Time[SCALING_STEP] < budget || measure.Steps < MIN_STEPS; s++) {
+
+    // Restart the cavity, so every run advances the same range of the flow
+    if(s && !(s%RESTART_STEPS)) {
+      block->InitializeVelocity();
+      block->InitializePressure();
+    }
+
+    block->calculateMaxVelocity(maxv);
+    dt = calculateMaxDt(dx,cc,maxv);
+
+    AdvectionSolver.SetMaxVelocity(maxv);
+
+    double t0 = omp_get_wtime();
+
+    switch(executor) {
+      case EXECUTOR_EXECUTE: AdvectionSolver.Execute();      break;
+      case EXECUTOR_BLOCK:   AdvectionSolver.ExecuteBlock(); break;
+      case EXECUTOR_TASK:    AdvectionSolver.ExecuteTask();  break;
+    }
+
+    double t1 = omp_get_wtime();
+
+    switch(executor) {
+      case EXECUTOR_EXECUTE: DiffusionSolver.Execute();      break;
+      case EXECUTOR_BLOCK:   DiffusionSolver.ExecuteTask();  break;
+      case EXECUTOR_TASK:    DiffusionSolver.ExecuteTask();  break;
+    }
+
+    double t2 = omp_get_wtime();
+
+    if(s > 0) {
+      measure.Time[SCALING_ADVECTION] += t1 - t0;
+      measure.Time[SCALING_DIFFUSION] += t2 - t1;
+      measure.Time[SCALING_STEP]      += t2 - t0;
+      measure.Steps++;
+    }
+  }
+
+  AdvectionSolver.Finish();
+
+  for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+    measure.Time[p] /= measure.Steps;
+  }
+
+  delete block;
+
+  for(size_t b = 0; b < MAX_BUFF; b++) {
+    memmrg.ReleaseGrid(&buffers[b], 1);
+  }
+
+  memmrg.ReleaseGrid(&flags, 1);
+
+  return measure;
+}
+
+/**
+ * Cells per side of the weak scaling grid of a thread count: the cells of
+ * the base grid times the threads, rounded to an even size (ExecuteTask
+ * advects the slabs in pairs)
+ * @N:        cells per side with one thread
+ * @threads:  number of threads
+ **/
+size_t weakSize(const size_t &N, const size_t &threads) {
+  return std::max((size_t)(N * cbrt((double)threads) / 2.0 + 0.5) * 2,(size_t)2);
+}
+
+/**
+ * Prints the time per step and the efficiency of every phase of the runs of
+ * a study, grid and executor
+ * @measures: all the runs
+ * @first:    first run of the table
+ * @last:     last run of the table + 1
+ **/
+void printTable(const std::vector<Measure> &measures, const size_t &first, const size_t &last) {
+
+  const Measure &base = measures[first];
+
+  printf("\n%s scaling, %s, N %zu\n",
+    STUDY_NAMES[base.Study],
+    EXECUTOR_NAMES[base.Executor],
+    base.N);
+
+  printf("%8s %6s %6s %6s","threads","N","block","steps");
+  for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+    printf(" %12s %6s",PHASE_NAMES[p],"eff");
+  }
+  printf("\n");
+
+  for(size_t m = first; m < last; m++) {
+    const Measure &measure = measures[m];
+
+    if(measure.Executor == EXECUTOR_BLOCK) {
+      printf("%8zu %6zu %6zu %6zu",measure.Threads,measure.N,measure.Block,measure.Steps);
+    } else {
+      printf("%8zu %6zu %6s %6zu",measure.Threads,measure.N,"-",measure.Steps);
+    }
+    for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+      printf(" %9.3f ms %5.1f%%",measure.Time[p] * 1e3,measure.Efficiency[p] * 100.0);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  if(argc < 3) {
+    printf("Usage: %s budget N [N ...]\n",argv[0]);
+    exit(1);
+  }
+
+  double budget = atof(argv[1]);
+
+  std::vector<size_t> sizes;
+
+  for(int a = 2; a < argc; a++) {
+    size_t N = atoi(argv[a]);
+
+    if(N < 2 || N % 2) {
+      printf("Error: Grid sizes must be even, %s is not.\n",argv[a]);
+      exit(1);
+    }
+
+    sizes.push_back(N);
+  }
+
+  // 1, 2, 4, ... up to all the threads of the machine (or OMP_NUM_THREADS)
+  size_t maxThreads = omp_get_max_threads();
+
+  std::vector<size_t> threadCounts;
+
+  for(size_t t = 1; t < maxThreads; t *= 2) {
+    threadCounts.push_back(t);
+  }
+
+  threadCounts.push_back(maxThreads);
+
+  printf("-------------------\n");
+  printf("Scaling up to OMP %zu, %f s per run\n",maxThreads,budget);
+  printf("-------------------\n");
+
+  std::vector<Measure> measures;
+  std::vector<size_t>  tables;
+
+  // Strong scaling of every grid, weak scaling from the first one
+  for(size_t study = 0; study < MAX_STUDY; study++) {
+    size_t numSizes = study == STUDY_STRONG ? sizes.size() : 1;
+
+    for(size_t n = 0; n < numSizes; n++) {
+      for(size_t executor = 0; executor < MAX_EXECUTOR; executor++) {
+
+        tables.push_back(measures.size());
+
+        for(size_t t = 0; t < threadCounts.size(); t++) {
+          size_t threads = threadCounts[t];
+          size_t N = study == STUDY_STRONG ? sizes[n] : weakSize(sizes[n],threads);
+
+          Measure measure = run(N,threads,executor,budget);
+
+          measure.Study = study;
+
+          const Measure &base = t ? measures[tables.back()] : measure;
+
+          // Time of the cells of one thread, relative to the run with one thread
+          double cells = ((double)measure.N * measure.N * measure.N) / ((double)base.N * base.N * base.N);
+
+          for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+            measure.Efficiency[p] = base.Time[p] * cells / (threads * measure.Time[p]);
+          }
+
+          measures.push_back(measure);
+        }
+      }
+    }
+  }
+
+  tables.push_back(measures.size());
+
+  for(size_t t = 0; t + 1 < tables.size(); t++) {
+    printTable(measures,tables[t],tables[t+1]);
+  }
+
+  // Fastest executor of every run
+  printf("\nFastest executor per step\n");
+  printf("%8s %8s %6s %10s %12s\n","study","threads","N","executor","step");
+
+  for(size_t a = 0; a < measures.size(); a++) {
+    const Measure &measure = measures[a];
+
+    if(measure.Executor != 0) {
+      continue;
+    }
+
+    size_t best = a;
+
+    for(size_t b = 0; b < measures.size(); b++) {
+      if(measures[b].Study == measure.Study && measures[b].N == measure.N && measures[b].Threads == measure.Threads &&
+         measures[b].Time[SCALING_STEP] < measures[best].Time[SCALING_STEP]) {
+        best = b;
+      }
+    }
+
+    printf("%8s %8zu %6zu %10s %9.3f ms\n",
+      STUDY_NAMES[measure.Study],
+      measure.Threads,
+      measure.N,
+      EXECUTOR_NAMES[measures[best].Executor],
+      measures[best].Time[SCALING_STEP] * 1e3);
+  }
+
+  FILE * csv = fopen("scaling.csv","w");
+
+  if(csv == NULL) {
+    printf("Error: Unable to open the output file \"scaling.csv\".\n");
+    exit(1);
+  }
+
+  fprintf(csv,"study,executor,N,threads,steps,phase,time,cells_per_second,efficiency\n");
+
+  for(size_t m = 0; m < measures.size(); m++) {
+    const Measure &measure = measures[m];
+
+    double cells = (double)measure.N * measure.N * measure.N;
+
+    for(size_t p = 0; p < MAX_SCALING_PHASE; p++) {
+      fprintf(csv,"%s,%s,%zu,%zu,%zu,%s,%e,%e,%f\n",
+        STUDY_NAMES[measure.Study],
+        EXECUTOR_NAMES[measure.Executor],
+        measure.N,
+        measure.Threads,
+        measure.Steps,
+        PHASE_NAMES[p],
+        measure.Time[p],
+        cells / measure.Time[p],
+        measure.Efficiency[p]);
+    }
+  }
+
+  fclose(csv);
+
+  printf("\nResults written to scaling.csv\n");
+
+  return 0;
+}
@@ -0,0 +1,434 @@
+#include <sys/types.h>
+#include <omp.h>
+
+// Solver
+#include "include/utils.h"
+#include "include/block.h"
+#include "include/defines.h"
+#include "include/solver_stencil.h"
+#include "include/solver_bfecc.h"
+#include "include/interpolator.h"
+
+#include "include/sunblock_c.h"
+
+#if defined(USE_MONOTONE_CUBIC)
+typedef MonotoneCubicInterpolator InterpolatorType;
+#elif defined(USE_TRICUBIC)
+typedef TricubicInterpolator      InterpolatorType;
+#else
+typedef TrilinealInterpolator     InterpolatorType;
+#endif
+
+typedef BfeccSolver<InterpolatorType> AdvectionType;
+typedef StencilSolver                 DiffusionType;
+
+/**
+ * Domain of the C interface. Block keeps references to the sizes and the
+ * properties and the solvers to the time step, so they live here. Solvers
+ * are created on the first step after a change of the flags or the time
+ * step, since both are precalculated when they are built.
+ **/
+struct sunblock_domain {
+  size_t N;
+  size_t NB;
+  size_t NE;
+  size_t Dim;
+
+  PrecisionType Dx;
+  PrecisionType Omega;
+  PrecisionType Ro;
+  PrecisionType Mu;
+  PrecisionType Ka;
+  PrecisionType CC2;
+
+  PrecisionType Dt;
+  PrecisionType Pdt;
+
+  PrecisionType * Owned[MAX_BUFF];
+  PrecisionType * Buffers[MAX_BUFF];
+
+  uint * OwnedFlags;
+  uint * Flags;
+
+  Block * block;
+  AdvectionType * advection;
+  DiffusionType * diffusion;
+
+  MemManager * memmrg;
+
+  sunblock_timings Timings;
+};
+
+/**
+ * Components per cell of a buffer. Scalar buffers only use the first
+ * component of the internal allocation
+ **/
+static size_t bufferComponents(const int &buffer) {
+  return buffer == PRESSURE || buffer == AUX_3D_5 || buffer == AUX_3D_6 || buffer == AUX_3D_7 ? 1 : 3;
+}
+
+static void fillLayout(sunblock_domain * domain, const size_t &components, const size_t &elementSize, sunblock_layout * layout) {
+  layout->cells        = domain->N;
+  layout->padding      = BWP;
+  layout->stride[0]    = components;
+  layout->stride[1]    = components * (domain->N + BW);
+  layout->stride[2]    = components * (domain->N + BW) * (domain->N + BW);
+  layout->components   = components;
+  layout->element_size = elementSize;
+}
+
+static bool sameLayout(const sunblock_layout * a, const sunblock_layout * b) {
+  return a->cells        == b->cells        &&
+         a->padding      == b->padding      &&
+         a->stride[0]    == b->stride[0]    &&
+         a->stride[1]    == b->stride[1]    &&
+         a->stride[2]    == b->stride[2]    &&
+         a->components   == b->components   &&
+         a->element_size == b->element_size;
+}
+
+static void releaseSolvers(sunblock_domain * domain) {
+  delete domain->advection;
+  delete domain->diffusion;
+
+  domain->advection = NULL;
+  domain->diffusion = NULL;
+}
+
+static void buildBlock(sunblock_domain * domain) {
+  releaseSolvers(domain);
+
+  delete domain->block;
+
+  domain->block = new Block(
+    domain->Buffers, domain->Flags,
+    domain->Dx, domain->Omega, domain->Ro, domain->Mu, domain->Ka, domain->CC2, BW,
+    domain->N, domain->N, domain->N, domain->NB, domain->NE, domain->Dim
+  );
+}
+
+static void buildSolvers(sunblock_domain * domain) {
+  domain->advection = new AdvectionType(domain->block,domain->Dt,domain->Pdt);
+  domain->diffusion = new DiffusionType(domain->block,domain->Dt,domain->Pdt);
+
+  domain->advection->Prepare();
+}
+
+extern "C" {
+
+sunblock_domain * sunblock_create(size_t cells, sunblock_real size) {
+
+  if(cells < 2 || !(size > 0)) {
+    return NULL;
+  }
+
+  sunblock_domain * domain = new sunblock_domain();
+
+  domain->N     = cells;
+  domain->NB    = 1;
+  domain->NE    = (cells+BW)/domain->NB;
+  domain->Dim   = 3;
+
+  domain->Dx    = size/(PrecisionType)cells;
+  domain->Omega = 1.0f;
+  domain->Dt    = 0.0f;
+  domain->Pdt   = 0.0f;
+
+  // air
+  domain->Ro    = 1.0f;
+  domain->Mu    = 1.9e-5;
+  domain->Ka    = 1.0e-5f;
+  domain->CC2   = 1.0f;
+
+  domain->memmrg = new MemManager(false);
+
+  size_t elements = (cells+BW)*(cells+BW)*(cells+BW);
+
+  for(size_t b = 0; b < MAX_BUFF; b++) {
+    domain->memmrg->AllocateGrid(&domain->Owned[b], cells, cells, cells, 3, 1);
+    domain->Buffers[b] = domain->Owned[b];
+
+    #pragma omp parallel for
+    for(size_t c = 0; c < elements * 3; c++) {
+      domain->Owned[b][c] = 0.0f;
+    }
+  }
+
+  domain->memmrg->AllocateGrid(&domain->OwnedFlags, cells, cells, cells, 1, 1);
+  domain->Flags = domain->OwnedFlags;
+
+  #pragma omp parallel for
+  for(size_t c = 0; c < elements; c++) {
+    domain->OwnedFlags[c] = 0;
+  }
+
+  domain->block     = NULL;
+  domain->advection = NULL;
+  domain->diffusion = NULL;
+
+  buildBlock(domain);
+  sunblock_reset_timings(domain);
+
+  return domain;
+}
+
+void sunblock_destroy(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return;
+  }
+
+  if(domain->advection != NULL) {
+    domain->advection->Finish();
+  }
+
+  releaseSolvers(domain);
+
+  delete domain->block;
+
+  for(size_t b = 0; b < MAX_BUFF; b++) {
+    domain->memmrg->ReleaseGrid(&domain->Owned[b], 1);
+  }
+
+  domain->memmrg->ReleaseGrid(&domain->OwnedFlags, 1);
+
+  delete domain->memmrg;
+  delete domain;
+}
+
+int sunblock_set_properties(
+    sunblock_domain * domain,
+    sunblock_real ro,
+    sunblock_real mu,
+    sunblock_real ka,
+    sunblock_real cc) {
+
+  if(domain == NULL || !(ro > 0) || mu < 0 || ka < 0 || !(cc > 0)) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  // Block and solvers hold references, no need to rebuild them
+  domain->Ro  = ro;
+  domain->Mu  = mu;
+  domain->Ka  = ka;
+  domain->CC2 = cc * cc;
+
+  return SUNBLOCK_OK;
+}
+
+int sunblock_get_layout(sunblock_domain * domain, int buffer, sunblock_layout * layout) {
+
+  if(domain == NULL || layout == NULL || buffer < 0 || buffer >= MAX_BUFF) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  fillLayout(domain,bufferComponents(buffer),sizeof(PrecisionType),layout);
+
+  return SUNBLOCK_OK;
+}
+
+int sunblock_set_buffer(
+    sunblock_domain * domain,
+    int buffer,
+    sunblock_real * data,
+    const sunblock_layout * layout) {
+
+  if(domain == NULL || buffer < 0 || buffer >= MAX_BUFF) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  if(data == NULL) {
+    domain->Buffers[buffer] = domain->Owned[buffer];
+    return SUNBLOCK_OK;
+  }
+
+  sunblock_layout expected;
+
+  fillLayout(domain,bufferComponents(buffer),sizeof(PrecisionType),&expected);
+
+  if(layout == NULL || !sameLayout(layout,&expected)) {
+    return SUNBLOCK_ERROR_LAYOUT;
+  }
+
+  // Block and solvers read the buffers through this array on every step
+  domain->Buffers[buffer] = data;
+
+  return SUNBLOCK_OK;
+}
+
+sunblock_real * sunblock_get_buffer(sunblock_domain * domain, int buffer) {
+
+  if(domain == NULL || buffer < 0 || buffer >= MAX_BUFF) {
+    return NULL;
+  }
+
+  return domain->Buffers[buffer];
+}
+
+int sunblock_set_flags(
+    sunblock_domain * domain,
+    unsigned int * flags,
+    const sunblock_layout * layout) {
+
+  if(domain == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  if(flags == NULL) {
+    domain->Flags = domain->OwnedFlags;
+  } else {
+    sunblock_layout expected;
+
+    fillLayout(domain,1,sizeof(uint),&expected);
+
+    if(layout == NULL || !sameLayout(layout,&expected)) {
+      return SUNBLOCK_ERROR_LAYOUT;
+    }
+
+    domain->Flags = flags;
+  }
+
+  // Block keeps its own copy of the flags pointer
+  buildBlock(domain);
+
+  return SUNBLOCK_OK;
+}
+
+unsigned int * sunblock_get_flags(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return NULL;
+  }
+
+  return domain->Flags;
+}
+
+int sunblock_update_flags(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  // The solvers rebuild the lists of fixed cells on their next step
+  domain->block->FlagsChanged();
+
+  return SUNBLOCK_OK;
+}
+
+int sunblock_fix_walls(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  size_t N  = domain->N;
+  uint * flags = domain->Flags;
+  uint fixed = FIXED_VELOCITY_X | FIXED_VELOCITY_Y | FIXED_VELOCITY_Z;
+
+  for(size_t a = BWP; a < N+BWP; a++) {
+    for(size_t b = BWP; b < N+BWP; b++) {
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+1] |= fixed;
+      flags[a*(N+BW)*(N+BW)+b*(N+BW)+N] |= fixed;
+      flags[a*(N+BW)*(N+BW)+1*(N+BW)+b] |= fixed;
+      flags[a*(N+BW)*(N+BW)+N*(N+BW)+b] |= fixed;
+      flags[1*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+      flags[N*(N+BW)*(N+BW)+a*(N+BW)+b] |= fixed;
+    }
+  }
+
+  return sunblock_update_flags(domain);
+}
+
+int sunblock_initialize_cavity(sunblock_domain * domain, sunblock_real lid) {
+
+  if(domain == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  domain->block->Zero();
+  domain->block->InitializeVelocity(lid);
+  domain->block->InitializePressure();
+
+  return SUNBLOCK_OK;
+}
+
+int sunblock_step(sunblock_domain * domain, sunblock_real dt, size_t steps) {
+
+  if(domain == NULL || !(dt > 0)) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  // Solvers precalculate the inverse of the time step
+  if(dt != domain->Dt) {
+    releaseSolvers(domain);
+
+    domain->Dt  = dt;
+    domain->Pdt = dt;
+  }
+
+  double start = omp_get_wtime();
+
+  if(domain->advection == NULL) {
+    buildSolvers(domain);
+  }
+
+  for(size_t s = 0; s < steps; s++) {
+    double phase = omp_get_wtime();
+
+    domain->advection->Execute();
+
+    double middle = omp_get_wtime();
+
+    domain->diffusion->ExecuteTask();
+
+    double end = omp_get_wtime();
+
+    domain->Timings.advection += middle - phase;
+    domain->Timings.diffusion += end - middle;
+  }
+
+  domain->Timings.steps += steps;
+  domain->Timings.total += omp_get_wtime() - start;
+
+  return SUNBLOCK_OK;
+}
+
+sunblock_real sunblock_max_velocity(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return 0.0f;
+  }
+
+  PrecisionType maxv;
+
+  domain->block->calculateRealMaxVelocity(maxv);
+
+  return maxv;
+}
+
+int sunblock_get_timings(sunblock_domain * domain, sunblock_timings * timings) {
+
+  if(domain == NULL || timings == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  *timings = domain->Timings;
+
+  return SUNBLOCK_OK;
+}
+
+int sunblock_reset_timings(sunblock_domain * domain) {
+
+  if(domain == NULL) {
+    return SUNBLOCK_ERROR_ARGUMENT;
+  }
+
+  domain->Timings.steps     = 0;
+  domain->Timings.advection = 0.0;
+  domain->Timings.diffusion = 0.0;
+  domain->Timings.total     = 0.0;
+
+  return SUNBLOCK_OK;
+}
+
+}